@@ -0,0 +1,515 @@
+#include "apu.hpp"
+
+#include "blip_buffer.hpp"
+#include "memory.hpp"
+#include "scheduler.hpp"
+#include "types.hpp"
+
+#include <optional>
+
+namespace tomboy {
+
+/// High or low for each of the 8 steps of the four duty cycles
+constexpr std::array<u8, 4> duties = {0x01, 0x81, 0x87, 0x7E};
+/// Amplitude of one step of a channel's level at full volume
+constexpr i32 gain = 64;
+/// Seconds of samples buffered before unread ones are dropped
+constexpr u32 buffer_fraction = 4;
+constexpr u64 never = Scheduler::never;
+
+Apu::Apu(Memory *memory, Scheduler *scheduler)
+  : memory_(memory),
+    scheduler_(scheduler),
+    channels_(),
+    sweep_(),
+    wave_(),
+    powered_(true),
+    sequencer_step_(0),
+    next_sequence_(scheduler->now() + sequencer_cycles),
+    left_volume_(8),
+    right_volume_(8),
+    panning_(0xF3),
+    sample_rate_(0),
+    synced_(0),
+    frame_start_(0),
+    left_(),
+    right_()
+{
+    channels_[0].kind = Kind::Square;
+    channels_[1].kind = Kind::Square;
+    channels_[2].kind = Kind::Wave;
+    channels_[3].kind = Kind::Noise;
+    for (Channel &channel : channels_) {
+        channel.next_step = never;
+        channel.wave_shift = 4;
+    }
+
+    // The boot ROM leaves channel 1 enabled after its chime has decayed
+    Channel &chime = channels_[0];
+    chime.enabled = true;
+    chime.dac = true;
+    chime.duty = 2;
+    chime.envelope_initial = 0x0F;
+    chime.envelope_period = 3;
+    set_frequency(chime, 0x7C1);
+
+    synced_ = now();
+    frame_start_ = synced_;
+}
+
+auto Apu::set_sample_rate(u32 sample_rate) -> void
+{
+    catch_up();
+    sample_rate_ = sample_rate;
+    frame_start_ = synced_;
+    if (sample_rate == 0) {
+        left_.reset();
+        right_.reset();
+        return;
+    }
+
+    const double clock_rate =
+        static_cast<double>(Scheduler::cycles_per_second * ticks_per_cycle);
+    left_.emplace(clock_rate, sample_rate, sample_rate / buffer_fraction);
+    right_.emplace(clock_rate, sample_rate, sample_rate / buffer_fraction);
+    for (Channel &channel : channels_) {
+        channel.left = 0;
+        channel.right = 0;
+    }
+    update_outputs();
+}
+
+auto Apu::sample_rate() const -> u32
+{
+    return sample_rate_;
+}
+
+auto Apu::samples_available() -> size_t
+{
+    if (!left_) {
+        return 0;
+    }
+    catch_up();
+    end_frame(synced_);
+    return left_->samples_available();
+}
+
+auto Apu::read_samples(i16 *output, size_t count) -> size_t
+{
+    if (!left_) {
+        return 0;
+    }
+    catch_up();
+    end_frame(synced_);
+    count = left_->read(output, count, 2);
+    right_->read(output + 1, count, 2);
+    return count;
+}
+
+auto Apu::writable(u8 offset) const -> bool
+{
+    return powered_ || offset >= 0x26;
+}
+
+auto Apu::written(u8 offset, u8 value) -> void
+{
+    catch_up();
+
+    const auto envelope = [&](Channel &channel) {
+        channel.envelope_initial = value >> 4;
+        channel.envelope_up = (value & 0x08) != 0;
+        channel.envelope_period = value & 0x07;
+        channel.dac = (value & 0xF8) != 0;
+    };
+    const auto control = [&](size_t index) {
+        Channel &channel = channels_[index];
+        set_frequency(channel,
+            static_cast<u16>((channel.frequency & 0xFF) | (value & 0x07) << 8));
+        channel.length_enabled = (value & 0x40) != 0;
+        if ((value & 0x80) != 0) {
+            trigger(index);
+        }
+    };
+    const auto frequency_low = [&](Channel &channel) {
+        set_frequency(
+            channel, static_cast<u16>((channel.frequency & 0x700) | value));
+    };
+
+    switch (offset) {
+    case 0x10:
+        sweep_.period = value >> 4 & 0x07;
+        sweep_.negate = (value & 0x08) != 0;
+        sweep_.shift = value & 0x07;
+        break;
+    case 0x11:
+    case 0x16: {
+        Channel &channel = channels_[offset == 0x11 ? 0 : 1];
+        channel.duty = value >> 6;
+        channel.length = 64 - (value & 0x3F);
+        break;
+    }
+    case 0x12: envelope(channels_[0]); break;
+    case 0x17: envelope(channels_[1]); break;
+    case 0x21: envelope(channels_[3]); break;
+    case 0x13: frequency_low(channels_[0]); break;
+    case 0x18: frequency_low(channels_[1]); break;
+    case 0x1D: frequency_low(channels_[2]); break;
+    case 0x14: control(0); break;
+    case 0x19: control(1); break;
+    case 0x1E: control(2); break;
+    case 0x1A: channels_[2].dac = (value & 0x80) != 0; break;
+    case 0x1B: channels_[2].length = 256 - value; break;
+    case 0x1C: {
+        constexpr std::array<u8, 4> shifts = {4, 0, 1, 2};
+        channels_[2].wave_shift = shifts[value >> 5 & 0x03];
+        break;
+    }
+    case 0x20: channels_[3].length = 64 - (value & 0x3F); break;
+    case 0x22: {
+        // Divided down from 4 MiHz, 2 clocks to a tick
+        Channel &noise = channels_[3];
+        const u32 divisor = (value & 0x07) == 0 ? 8 : (value & 0x07) * 16;
+        const u8 shift = value >> 4;
+        noise.narrow = (value & 0x08) != 0;
+        noise.period = shift < 14 ? (divisor << shift) / 2 : 0;
+        // Shifts of 14 and 15 stop the LFSR clock until a usable one returns
+        if (noise.period == 0) {
+            noise.next_step = never;
+        }
+        else if (noise.enabled && noise.next_step == never) {
+            noise.next_step = synced_ + noise.period;
+        }
+        break;
+    }
+    case 0x23:
+        channels_[3].length_enabled = (value & 0x40) != 0;
+        if ((value & 0x80) != 0) {
+            trigger(3);
+        }
+        break;
+    case 0x24:
+        left_volume_ = (value >> 4 & 0x07) + 1;
+        right_volume_ = (value & 0x07) + 1;
+        break;
+    case 0x25: panning_ = value; break;
+    case 0x26:
+        if ((value & 0x80) == 0 && powered_) {
+            power_off();
+        }
+        else if ((value & 0x80) != 0 && !powered_) {
+            powered_ = true;
+            sequencer_step_ = 0;
+        }
+        break;
+    default:
+        if (offset >= 0x30 && offset < 0x40) {
+            wave_[offset - 0x30] = value;
+        }
+        break;
+    }
+
+    // Turning a DAC off also disables its channel
+    for (Channel &channel : channels_) {
+        channel.enabled = channel.enabled && channel.dac;
+    }
+    update_outputs();
+}
+
+auto Apu::status() -> u8
+{
+    catch_up();
+    u8 bits = 0;
+    for (size_t i = 0; i < channels_.size(); i++) {
+        if (channels_[i].enabled) {
+            bits |= 1 << i;
+        }
+    }
+    return bits;
+}
+
+auto Apu::catch_up() -> void
+{
+    const u64 cycle = scheduler_->now();
+    while (next_sequence_ <= cycle) {
+        if (sequencer_idle()) {
+            const u64 steps = (cycle - next_sequence_) / sequencer_cycles + 1;
+            sequencer_step_ = static_cast<u8>((sequencer_step_ + steps) & 7);
+            next_sequence_ += steps * sequencer_cycles;
+            break;
+        }
+        run(next_sequence_ * ticks_per_cycle);
+        step_sequencer();
+        next_sequence_ += sequencer_cycles;
+    }
+    run(now());
+}
+
+auto Apu::run(u64 tick) -> void
+{
+    if (tick <= synced_) {
+        return;
+    }
+    for (size_t i = 0; i < channels_.size(); i++) {
+        run_channel(i, tick);
+    }
+    synced_ = tick;
+}
+
+auto Apu::run_channel(size_t index, u64 tick) -> void
+{
+    Channel &channel = channels_[index];
+    if (!channel.enabled || channel.next_step > tick) {
+        return;
+    }
+
+    // Steps the output cannot show are counted rather than taken. Without
+    // buffers nothing can be heard, and the LFSR cannot be read back.
+    const bool silent = !left_ ||
+                        (channel.kind == Kind::Square && channel.volume == 0) ||
+                        (channel.kind == Kind::Wave && channel.wave_shift == 4);
+    if (silent) {
+        const u64 steps = (tick - channel.next_step) / channel.period + 1;
+        const u64 length = channel.kind == Kind::Wave ? 32 : 8;
+        channel.position = static_cast<u8>((channel.position + steps) % length);
+        channel.next_step += steps * channel.period;
+        return;
+    }
+
+    while (channel.next_step <= tick) {
+        switch (channel.kind) {
+        case Kind::Square: channel.position = (channel.position + 1) & 7; break;
+        case Kind::Wave: channel.position = (channel.position + 1) & 31; break;
+        case Kind::Noise: {
+            const u16 bit = (channel.lfsr ^ channel.lfsr >> 1) & 1;
+            channel.lfsr = static_cast<u16>(channel.lfsr >> 1 | bit << 14);
+            if (channel.narrow) {
+                channel.lfsr = static_cast<u16>(
+                    (channel.lfsr & ~0x40) | bit << 6);
+            }
+            break;
+        }
+        }
+        update_output(index, channel.next_step);
+        channel.next_step += channel.period;
+    }
+}
+
+auto Apu::level(const Channel &channel) const -> u8
+{
+    if (!channel.enabled) {
+        return 0;
+    }
+    switch (channel.kind) {
+    case Kind::Square:
+        return (duties[channel.duty] >> (7 - channel.position) & 1) != 0
+                   ? channel.volume
+                   : 0;
+    case Kind::Wave: {
+        const u8 byte = wave_[channel.position / 2];
+        const u8 sample = (channel.position & 1) != 0 ? byte & 0x0F : byte >> 4;
+        return sample >> channel.wave_shift;
+    }
+    case Kind::Noise: return (channel.lfsr & 1) == 0 ? channel.volume : 0;
+    }
+    return 0;
+}
+
+auto Apu::update_output(size_t index, u64 tick) -> void
+{
+    if (!left_) {
+        return;
+    }
+    Channel &channel = channels_[index];
+    const i32 amplitude = level(channel) * gain;
+    const i32 left =
+        (panning_ >> (4 + index) & 1) != 0 ? amplitude * left_volume_ : 0;
+    const i32 right =
+        (panning_ >> index & 1) != 0 ? amplitude * right_volume_ : 0;
+    if (left != channel.left) {
+        left_->add_delta(tick - frame_start_, left - channel.left);
+        channel.left = left;
+    }
+    if (right != channel.right) {
+        right_->add_delta(tick - frame_start_, right - channel.right);
+        channel.right = right;
+    }
+}
+
+auto Apu::update_outputs() -> void
+{
+    for (size_t i = 0; i < channels_.size(); i++) {
+        update_output(i, synced_);
+    }
+}
+
+auto Apu::end_frame(u64 tick) -> void
+{
+    left_->end_frame(tick - frame_start_);
+    right_->end_frame(tick - frame_start_);
+    frame_start_ = tick;
+}
+
+auto Apu::step_sequencer() -> void
+{
+    if ((sequencer_step_ & 1) == 0) {
+        clock_lengths();
+    }
+    if (sequencer_step_ == 2 || sequencer_step_ == 6) {
+        clock_sweep();
+    }
+    if (sequencer_step_ == 7) {
+        clock_envelopes();
+    }
+    sequencer_step_ = (sequencer_step_ + 1) & 7;
+    update_outputs();
+}
+
+auto Apu::sequencer_idle() const -> bool
+{
+    // Powered off, every channel is disabled
+    for (const Channel &channel : channels_) {
+        if (!channel.enabled) {
+            continue;
+        }
+        const bool settled = channel.kind == Kind::Wave ||
+                             channel.envelope_period == 0 ||
+                             channel.volume == (channel.envelope_up ? 15 : 0);
+        if (channel.length_enabled || !settled) {
+            return false;
+        }
+    }
+    return !channels_[0].enabled || !sweep_.enabled || sweep_.period == 0;
+}
+
+auto Apu::clock_lengths() -> void
+{
+    for (Channel &channel : channels_) {
+        if (channel.length_enabled && channel.length > 0) {
+            channel.length--;
+            if (channel.length == 0) {
+                channel.enabled = false;
+            }
+        }
+    }
+}
+
+auto Apu::clock_envelopes() -> void
+{
+    for (Channel &channel : channels_) {
+        if (channel.kind == Kind::Wave || channel.envelope_period == 0) {
+            continue;
+        }
+        if (--channel.envelope_timer > 0) {
+            continue;
+        }
+        channel.envelope_timer = channel.envelope_period;
+        if (channel.envelope_up && channel.volume < 15) {
+            channel.volume++;
+        }
+        else if (!channel.envelope_up && channel.volume > 0) {
+            channel.volume--;
+        }
+    }
+}
+
+auto Apu::clock_sweep() -> void
+{
+    if (--sweep_.timer > 0) {
+        return;
+    }
+    sweep_.timer = sweep_.period != 0 ? sweep_.period : 8;
+    if (!sweep_.enabled || sweep_.period == 0) {
+        return;
+    }
+
+    Channel &channel = channels_[0];
+    const std::optional<u16> frequency = sweep_frequency();
+    if (!frequency) {
+        channel.enabled = false;
+        return;
+    }
+    if (sweep_.shift != 0) {
+        sweep_.shadow = *frequency;
+        set_frequency(channel, *frequency);
+        // The next frequency is checked for overflow straight away
+        if (!sweep_frequency()) {
+            channel.enabled = false;
+        }
+    }
+}
+
+auto Apu::sweep_frequency() const -> std::optional<u16>
+{
+    const u16 delta = sweep_.shadow >> sweep_.shift;
+    const int frequency =
+        sweep_.negate ? sweep_.shadow - delta : sweep_.shadow + delta;
+    if (frequency > 0x7FF) {
+        return std::nullopt;
+    }
+    return static_cast<u16>(frequency);
+}
+
+auto Apu::trigger(size_t index) -> void
+{
+    Channel &channel = channels_[index];
+    channel.enabled = channel.dac;
+    if (channel.length == 0) {
+        channel.length = channel.kind == Kind::Wave ? 256 : 64;
+    }
+    channel.next_step = channel.period != 0 ? synced_ + channel.period : never;
+    channel.volume = channel.envelope_initial;
+    channel.envelope_timer = channel.envelope_period;
+
+    switch (channel.kind) {
+    case Kind::Square:
+        if (index == 0) {
+            sweep_.shadow = channel.frequency;
+            sweep_.timer = sweep_.period != 0 ? sweep_.period : 8;
+            sweep_.enabled = sweep_.period != 0 || sweep_.shift != 0;
+            if (sweep_.shift != 0 && !sweep_frequency()) {
+                channel.enabled = false;
+            }
+        }
+        break;
+    case Kind::Wave: channel.position = 0; break;
+    case Kind::Noise: channel.lfsr = 0x7FFF; break;
+    }
+}
+
+auto Apu::set_frequency(Channel &channel, u16 frequency) -> void
+{
+    channel.frequency = frequency & 0x7FF;
+    const u32 steps = 2048 - channel.frequency;
+    channel.period = channel.kind == Kind::Wave ? steps : steps * 2;
+}
+
+auto Apu::power_off() -> void
+{
+    // Every register but NR52 clears and stays clear until powered on
+    for (u8 offset = 0x10; offset < 0x26; offset++) {
+        memory_->set_io(offset, 0x00);
+    }
+    for (Channel &channel : channels_) {
+        const Kind kind = channel.kind;
+        const i32 left = channel.left;
+        const i32 right = channel.right;
+        channel = {};
+        channel.kind = kind;
+        channel.next_step = never;
+        channel.wave_shift = 4;
+        channel.left = left;
+        channel.right = right;
+        set_frequency(channel, 0);
+    }
+    sweep_ = {};
+    left_volume_ = 1;
+    right_volume_ = 1;
+    panning_ = 0;
+    powered_ = false;
+}
+
+auto Apu::now() const -> u64
+{
+    return scheduler_->now() * ticks_per_cycle;
+}
+} // namespace tomboy
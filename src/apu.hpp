@@ -0,0 +1,170 @@
+#pragma once
+
+#include "blip_buffer.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstddef>
+#include <optional>
+
+namespace tomboy {
+class Memory;
+class Scheduler;
+} // namespace tomboy
+
+namespace tomboy {
+/// Audio processing unit, two square channels, a wave and a noise channel
+///
+/// Nothing runs as the CPU does. The APU remembers the cycle it last caught
+/// up to and runs to the current one in a batch when a sound register is
+/// written, NR52 is read or samples are read. Catching up runs each channel
+/// from one change of its output to the next, and each change is added to a
+/// band-limited buffer per side that resamples to the host rate. Steps of
+/// the frame sequencer in between are applied in order, and skipped in one
+/// go while no length, envelope or sweep is running, so without output the
+/// cost is a little arithmetic per access.
+class Apu {
+  public:
+    /// Timer units per machine cycle, wave channel samples can change on
+    /// every half cycle
+    static constexpr u64 ticks_per_cycle = 2;
+    /// Machine cycles between steps of the frame sequencer, 512 per second
+    static constexpr u64 sequencer_cycles = 2048;
+
+  public:
+    Apu(Memory *memory, Scheduler *scheduler);
+
+    Apu(const Apu &) = delete;
+    auto operator=(const Apu &) -> Apu & = delete;
+
+    /// Synthesise stereo samples at sample_rate, 0 to only keep the
+    /// registers up to date
+    auto set_sample_rate(u32 sample_rate) -> void;
+    [[nodiscard]] auto sample_rate() const -> u32;
+
+    /// Stereo frames ready to read
+    [[nodiscard]] auto samples_available() -> size_t;
+    /// Read up to count stereo frames, left then right, returns the number
+    /// read
+    auto read_samples(i16 *output, size_t count) -> size_t;
+
+    /// Whether a register can be written, only NR52 and wave RAM can while
+    /// powered off
+    [[nodiscard]] auto writable(u8 offset) const -> bool;
+    /// Called by Memory after a sound register or wave RAM is written
+    auto written(u8 offset, u8 value) -> void;
+    /// Low bits of NR52, set for each channel playing, called by Memory as
+    /// it is read
+    [[nodiscard]] auto status() -> u8;
+
+  private:
+    enum class Kind : u8 {
+        Square,
+        Wave,
+        Noise,
+    };
+
+    struct Channel {
+        Kind kind;
+        bool enabled;
+        /// Whether the DAC is on, a channel cannot be enabled without it
+        bool dac;
+        bool length_enabled;
+        /// Length counter, disables the channel when clocked down to 0
+        u16 length;
+        /// 11-bit frequency, the period is derived from it
+        u16 frequency;
+        /// Ticks between steps of the duty, wave or noise
+        u32 period;
+        /// Tick of the next step
+        u64 next_step;
+        /// Step of the duty cycle or sample of the wave
+        u8 position;
+        u8 duty;
+
+        /// Volume, set by triggering and changed by the envelope
+        u8 volume;
+        u8 envelope_initial;
+        bool envelope_up;
+        u8 envelope_period;
+        u8 envelope_timer;
+
+        /// Right shift of wave samples, 4 mutes
+        u8 wave_shift;
+
+        u16 lfsr;
+        /// Use a 7-bit LFSR instead of 15
+        bool narrow;
+
+        /// Amplitudes last added to each side's buffer
+        i32 left;
+        i32 right;
+    };
+
+    struct Sweep {
+        u8 period;
+        bool negate;
+        u8 shift;
+        u8 timer;
+        bool enabled;
+        u16 shadow;
+    };
+
+  private:
+    /// Run the frame sequencer and the channels up to the current cycle
+    auto catch_up() -> void;
+    /// Synthesise every channel up to tick
+    auto run(u64 tick) -> void;
+    auto run_channel(size_t index, u64 tick) -> void;
+    /// Level of a channel's output, 0 to 15
+    [[nodiscard]] auto level(const Channel &channel) const -> u8;
+    /// Add the change in a channel's output at tick to the buffers
+    auto update_output(size_t index, u64 tick) -> void;
+    auto update_outputs() -> void;
+    /// Move the samples up to tick into the buffers' readable part
+    auto end_frame(u64 tick) -> void;
+
+    auto step_sequencer() -> void;
+    /// Whether steps of the frame sequencer would change nothing, every
+    /// enabled channel having no length, a settled envelope and no sweep
+    [[nodiscard]] auto sequencer_idle() const -> bool;
+    auto clock_lengths() -> void;
+    auto clock_envelopes() -> void;
+    auto clock_sweep() -> void;
+    /// Frequency the sweep changes to next, nullopt if it overflows
+    [[nodiscard]] auto sweep_frequency() const -> std::optional<u16>;
+
+    auto trigger(size_t index) -> void;
+    auto set_frequency(Channel &channel, u16 frequency) -> void;
+    auto power_off() -> void;
+
+    /// Current tick
+    [[nodiscard]] auto now() const -> u64;
+
+  private:
+    Memory *memory_;
+    Scheduler *scheduler_;
+
+    std::array<Channel, 4> channels_;
+    Sweep sweep_;
+    std::array<u8, 16> wave_;
+    bool powered_;
+    /// Step of the frame sequencer, 0 to 7
+    u8 sequencer_step_;
+    /// Cycle the next step of the frame sequencer is due
+    u64 next_sequence_;
+    /// NR50 volumes plus one
+    u8 left_volume_;
+    u8 right_volume_;
+    /// NR51, a bit per channel for the right then the left side
+    u8 panning_;
+
+    u32 sample_rate_;
+    /// Tick the channels have been synthesised up to
+    u64 synced_;
+    /// Tick the buffers' current frame started at
+    u64 frame_start_;
+    std::optional<BlipBuffer> left_;
+    std::optional<BlipBuffer> right_;
+};
+} // namespace tomboy
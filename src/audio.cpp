@@ -0,0 +1,72 @@
+#include "audio.hpp"
+
+#include "types.hpp"
+
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+namespace tomboy {
+
+/// Seconds of samples queued at most, bounding the latency
+constexpr u32 queue_fraction = 10;
+
+auto Audio::create(u32 sample_rate) -> std::unique_ptr<Audio>
+{
+    std::unique_ptr<Audio> audio(
+        new Audio(static_cast<size_t>(sample_rate / queue_fraction) * 2));
+    const SDL_AudioSpec spec = {
+        .format = SDL_AUDIO_S16,
+        .channels = 2,
+        .freq = static_cast<int>(sample_rate),
+    };
+    audio->stream_ = SDL_OpenAudioDeviceStream(
+        SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, &on_request, audio.get());
+    if (audio->stream_ == nullptr) {
+        return nullptr;
+    }
+    if (!SDL_ResumeAudioStreamDevice(audio->stream_)) {
+        return nullptr;
+    }
+    return audio;
+}
+
+Audio::Audio(size_t capacity)
+  : stream_(nullptr),
+    samples_(capacity)
+{
+}
+
+Audio::~Audio()
+{
+    // Closing stops the callback before the ring buffer goes
+    if (stream_ != nullptr) {
+        SDL_DestroyAudioStream(stream_);
+    }
+}
+
+auto Audio::push(const i16 *samples, size_t count) -> size_t
+{
+    return samples_.push(samples, count * 2) / 2;
+}
+
+auto Audio::on_request(void *object, SDL_AudioStream *stream, int additional,
+    int /*total*/) -> void
+{
+    auto *audio = static_cast<Audio *>(object);
+    std::array<i16, 1024> chunk;
+    size_t wanted = static_cast<size_t>(std::max(additional, 0)) / sizeof(i16);
+    while (wanted > 0) {
+        const size_t count =
+            audio->samples_.pop(chunk.data(), std::min(wanted, chunk.size()));
+        if (count == 0) {
+            break;
+        }
+        SDL_PutAudioStreamData(
+            stream, chunk.data(), static_cast<int>(count * sizeof(i16)));
+        wanted -= count;
+    }
+}
+} // namespace tomboy
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "ring_buffer.hpp"
+#include "types.hpp"
+
+#include <cstddef>
+#include <memory>
+
+struct SDL_AudioStream;
+
+namespace tomboy {
+/// Stereo output to the default playback device
+///
+/// The emulation thread pushes samples into a ring buffer and SDL's audio
+/// thread pulls them out as the device asks for more, so neither waits for
+/// the other. Running dry plays silence instead of blocking.
+class Audio {
+  public:
+    /// Open the default device at sample_rate, nullptr on failure with the
+    /// reason left in SDL_GetError. SDL audio must be initialised.
+    [[nodiscard]] static auto create(u32 sample_rate)
+        -> std::unique_ptr<Audio>;
+
+    ~Audio();
+
+    Audio(const Audio &) = delete;
+    auto operator=(const Audio &) -> Audio & = delete;
+
+    /// Queue count stereo frames, left then right, returns the number
+    /// queued, the rest do not fit
+    auto push(const i16 *samples, size_t count) -> size_t;
+
+  private:
+    explicit Audio(size_t capacity);
+
+    /// Called on SDL's audio thread when the stream wants more bytes
+    static auto on_request(void *object, SDL_AudioStream *stream,
+        int additional, int total) -> void;
+
+  private:
+    SDL_AudioStream *stream_ = nullptr;
+    /// Interleaved samples, two per frame
+    RingBuffer<i16> samples_;
+};
+} // namespace tomboy
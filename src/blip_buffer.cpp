@@ -0,0 +1,133 @@
+#include "blip_buffer.hpp"
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <numbers>
+
+namespace tomboy {
+
+/// Step positions resolved between output samples
+constexpr int phase_bits = 6;
+constexpr int phase_count = 1 << phase_bits;
+/// Output samples each step is spread over
+constexpr int kernel_size = 16;
+/// Precision of the kernel, each phase sums to 1 << kernel_bits
+constexpr int kernel_bits = 13;
+/// Strength of the filter removing DC, higher keeps more bass
+constexpr int bass_shift = 9;
+
+namespace {
+using Kernel = std::array<std::array<i32, kernel_size>, phase_count>;
+
+/// Windowed sinc impulses, one per phase, low-passed just below Nyquist
+auto make_kernel() -> Kernel
+{
+    constexpr double cutoff = 0.45;
+    constexpr double half = kernel_size / 2.0;
+    Kernel kernel{};
+    for (int phase = 0; phase < phase_count; phase++) {
+        std::array<double, kernel_size> taps{};
+        double sum = 0.0;
+        for (int i = 0; i < kernel_size; i++) {
+            const double x = i - (half - 1.0) -
+                             static_cast<double>(phase) / phase_count;
+            const double angle = 2.0 * std::numbers::pi * cutoff * x;
+            const double sinc = x == 0.0 ? 1.0 : std::sin(angle) / angle;
+            // Blackman window over the width of the kernel
+            const double w = (x + half) / kernel_size;
+            const double window = 0.42 -
+                                  0.5 * std::cos(2.0 * std::numbers::pi * w) +
+                                  0.08 * std::cos(4.0 * std::numbers::pi * w);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+
+        // Each phase must sum exactly so steps settle at their full height
+        i32 total = 0;
+        for (int i = 0; i < kernel_size; i++) {
+            kernel[phase][i] = static_cast<i32>(
+                std::lround(taps[i] / sum * (1 << kernel_bits)));
+            total += kernel[phase][i];
+        }
+        kernel[phase][kernel_size / 2 - 1] += (1 << kernel_bits) - total;
+    }
+    return kernel;
+}
+
+const Kernel kernel = make_kernel();
+} // namespace
+
+BlipBuffer::BlipBuffer(double clock_rate, double sample_rate, size_t capacity)
+  : factor_(static_cast<u64>(
+        std::ldexp(sample_rate / clock_rate, fraction_bits))),
+    offset_(0),
+    capacity_(capacity),
+    integrator_(0),
+    deltas_(capacity + kernel_size)
+{
+}
+
+auto BlipBuffer::add_delta(u64 time, i32 delta) -> void
+{
+    const u64 position = offset_ + time * factor_;
+    const size_t index = position >> fraction_bits;
+    if (index >= capacity_) {
+        return;
+    }
+    const auto phase =
+        static_cast<size_t>(position >> (fraction_bits - phase_bits)) &
+        (phase_count - 1);
+    i32 *out = deltas_.data() + index;
+    for (int i = 0; i < kernel_size; i++) {
+        out[i] += kernel[phase][i] * delta;
+    }
+}
+
+auto BlipBuffer::end_frame(u64 time) -> void
+{
+    offset_ += time * factor_;
+    // Samples nobody reads are dropped rather than overflowing
+    if ((offset_ >> fraction_bits) > capacity_) {
+        offset_ = (offset_ & ((u64{1} << fraction_bits) - 1)) |
+                  (static_cast<u64>(capacity_) << fraction_bits);
+    }
+}
+
+auto BlipBuffer::samples_available() const -> size_t
+{
+    return offset_ >> fraction_bits;
+}
+
+auto BlipBuffer::read(i16 *output, size_t count, size_t stride) -> size_t
+{
+    count = std::min(count, samples_available());
+    i64 sum = integrator_;
+    for (size_t i = 0; i < count; i++) {
+        const i64 sample = std::clamp<i64>(sum >> kernel_bits, -32768, 32767);
+        output[i * stride] = static_cast<i16>(sample);
+        sum += deltas_[i];
+        sum -= sample << (kernel_bits - bass_shift);
+    }
+    integrator_ = sum;
+
+    // Keep the tails of the steps reaching past what was read
+    const size_t remaining = samples_available() - count + kernel_size;
+    std::copy_n(deltas_.begin() + static_cast<std::ptrdiff_t>(count),
+        remaining, deltas_.begin());
+    std::fill(deltas_.begin() + static_cast<std::ptrdiff_t>(remaining),
+        deltas_.end(), 0);
+    offset_ -= static_cast<u64>(count) << fraction_bits;
+    return count;
+}
+
+auto BlipBuffer::clear() -> void
+{
+    offset_ = 0;
+    integrator_ = 0;
+    std::ranges::fill(deltas_, 0);
+}
+} // namespace tomboy
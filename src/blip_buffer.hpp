@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace tomboy {
+/// Resamples a signal made of steps to the host rate without aliasing
+///
+/// Rather than being stepped at the emulated clock, the signal is described
+/// by the changes in its amplitude and when they happen. Each change adds a
+/// band-limited step, a windowed sinc impulse later integrated, at its
+/// fractional position in the output, so the cost follows the number of
+/// changes rather than the clock rate.
+class BlipBuffer {
+  public:
+    /// Buffer up to capacity output samples of a clock_rate signal
+    BlipBuffer(double clock_rate, double sample_rate, size_t capacity);
+
+    /// Add a change in amplitude time clocks after the start of the frame
+    auto add_delta(u64 time, i32 delta) -> void;
+    /// End the frame time clocks after its start, making the samples before
+    /// then available. Times of later deltas count from here.
+    auto end_frame(u64 time) -> void;
+
+    [[nodiscard]] auto samples_available() const -> size_t;
+    /// Read up to count samples into output, stride apart, returns the
+    /// number read
+    auto read(i16 *output, size_t count, size_t stride) -> size_t;
+    /// Drop every sample and pending change
+    auto clear() -> void;
+
+  private:
+    /// Fractional bits of positions in output samples
+    static constexpr int fraction_bits = 32;
+
+  private:
+    /// Output samples per clock, as a fixed point fraction
+    u64 factor_;
+    /// Position of the frame start in output samples, fixed point
+    u64 offset_;
+    size_t capacity_;
+    /// Running sum of the deltas already read
+    i64 integrator_;
+    std::vector<i32> deltas_;
+};
+} // namespace tomboy
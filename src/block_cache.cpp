@@ -0,0 +1,59 @@
+#include "block_cache.hpp"
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace tomboy {
+
+auto BlockCache::find(u16 bank, u16 address) const -> const Block *
+{
+    const auto it = blocks_.find(key(bank, address));
+    return it != blocks_.end() ? &it->second : nullptr;
+}
+
+auto BlockCache::insert(Block block) -> const Block &
+{
+    const u32 block_key = key(block.bank, block.address);
+    const u8 first_page = block.address >> 8;
+    const u8 last_page = static_cast<u16>(block.address + block.size - 1) >> 8;
+    for (u8 page = first_page;; page++) {
+        auto &keys = page_blocks_[page];
+        if (std::ranges::find(keys, block_key) == keys.end()) {
+            keys.push_back(block_key);
+        }
+        if (page == last_page) {
+            break;
+        }
+    }
+    return blocks_.insert_or_assign(block_key, std::move(block)).first->second;
+}
+
+auto BlockCache::clear() -> void
+{
+    blocks_.clear();
+    for (auto &keys : page_blocks_) {
+        keys.clear();
+    }
+    generation_++;
+    epoch_++;
+}
+
+auto BlockCache::key(u16 bank, u16 address) -> u32
+{
+    return static_cast<u32>(bank) << 16 | address;
+}
+
+auto BlockCache::invalidate_page(u8 page) -> void
+{
+    // Blocks spanning several pages stay listed on the others, erasing an
+    // already dropped key there is harmless
+    for (const u32 block_key : page_blocks_[page]) {
+        blocks_.erase(block_key);
+    }
+    page_blocks_[page].clear();
+    generation_++;
+    epoch_++;
+}
+} // namespace tomboy
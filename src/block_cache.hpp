@@ -0,0 +1,90 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+namespace tomboy {
+/// Cache of decoded basic blocks keyed by bank and address
+class BlockCache {
+  public:
+    /// Decoded instruction within a block
+    struct Instruction {
+        /// Index into the CPU instruction table
+        u16 index;
+        /// Length in bytes, including prefix and operands
+        u8 length;
+    };
+
+    /// Straight-line run of instructions ending at a branch
+    struct Block {
+        u16 bank;
+        u16 address;
+        /// Size in bytes of all instructions in the block
+        u16 size;
+        /// Loop back to its own start polling an IO register, without side
+        /// effects, so every iteration leaves the same state until an event
+        /// changes the register
+        bool idle;
+        std::vector<Instruction> instructions;
+    };
+
+  public:
+    BlockCache() = default;
+
+    /// Find the block starting at address, nullptr if not cached
+    [[nodiscard]] auto find(u16 bank, u16 address) const -> const Block *;
+    /// Cache a decoded block
+    auto insert(Block block) -> const Block &;
+    /// Drop every block covering the page of a written address
+    auto invalidate(u16 address) -> void;
+    /// Drop every block
+    auto clear() -> void;
+    /// Note that a bank switch changed the memory blocks may run from
+    auto remap() -> void;
+
+    /// Incremented whenever blocks are dropped
+    [[nodiscard]] auto generation() const -> u64;
+    /// Incremented whenever blocks are dropped or memory is remapped, a
+    /// running block must stop once it changes
+    [[nodiscard]] auto epoch() const -> u64;
+
+    /// Key of the block starting at address in bank
+    [[nodiscard]] static auto key(u16 bank, u16 address) -> u32;
+
+  private:
+    auto invalidate_page(u8 page) -> void;
+
+  private:
+    std::unordered_map<u32, Block> blocks_;
+    /// Keys of the blocks covering each 256 byte page
+    std::array<std::vector<u32>, 256> page_blocks_;
+    u64 generation_ = 0;
+    u64 epoch_ = 0;
+};
+
+inline auto BlockCache::invalidate(u16 address) -> void
+{
+    const u8 page = address >> 8;
+    if (!page_blocks_[page].empty()) {
+        invalidate_page(page);
+    }
+}
+
+inline auto BlockCache::remap() -> void
+{
+    epoch_++;
+}
+
+inline auto BlockCache::generation() const -> u64
+{
+    return generation_;
+}
+
+inline auto BlockCache::epoch() const -> u64
+{
+    return epoch_;
+}
+} // namespace tomboy
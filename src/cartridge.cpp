@@ -0,0 +1,389 @@
+#include "cartridge.hpp"
+
+#include "save_file.hpp"
+#include "scheduler.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <print>
+#include <utility>
+
+namespace tomboy {
+
+/// RAM size in bytes of each header RAM size code
+constexpr std::array<size_t, 6> ram_sizes = {
+    0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000,
+};
+
+/// Masks of the seconds, minutes, hours, day low and day high registers
+constexpr std::array<u8, 5> rtc_masks = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+auto Cartridge::from_rom(std::shared_ptr<const Rom> rom)
+    -> std::optional<Cartridge>
+{
+    if (rom->file_size() < 0x150) {
+        std::println(std::cerr, "ROM is too small to contain a header.");
+        return std::nullopt;
+    }
+
+    const u8 type = rom->data()[0x147];
+    Mbc mbc = Mbc::None;
+    switch (type) {
+    case 0x00:
+    case 0x08:
+    case 0x09: mbc = Mbc::None; break;
+    case 0x01:
+    case 0x02:
+    case 0x03: mbc = Mbc::Mbc1; break;
+    case 0x0F:
+    case 0x10:
+    case 0x11:
+    case 0x12:
+    case 0x13: mbc = Mbc::Mbc3; break;
+    case 0x19:
+    case 0x1A:
+    case 0x1B:
+    case 0x1C:
+    case 0x1D:
+    case 0x1E: mbc = Mbc::Mbc5; break;
+    default:
+        std::println(std::cerr, "Unsupported cartridge type: 0x{:02x}", type);
+        return std::nullopt;
+    }
+
+    const u8 ram_code = rom->data()[0x149];
+    const size_t ram_size = ram_code < ram_sizes.size() ? ram_sizes[ram_code] : 0;
+
+    Cartridge cartridge(std::move(rom), mbc, ram_size);
+    switch (type) {
+    case 0x03:
+    case 0x09:
+    case 0x0F:
+    case 0x10:
+    case 0x13:
+    case 0x1B:
+    case 0x1E: cartridge.battery_ = true; break;
+    default: break;
+    }
+    cartridge.rtc_enabled_ = type == 0x0F || type == 0x10;
+    return cartridge;
+}
+
+Cartridge::Cartridge(std::shared_ptr<const Rom> rom, Mbc mbc, size_t ram_size)
+  : rom_(std::move(rom)),
+    ram_(),
+    ram_size_(0),
+    save_(),
+    ram_dirty_(false),
+    title_(),
+    mbc_(mbc),
+    battery_(false),
+    rtc_enabled_(false),
+    ram_enabled_(mbc == Mbc::None),
+    rom_bank_(1),
+    ram_bank_(0),
+    mode_(false),
+    rtc_(),
+    scheduler_(nullptr)
+{
+    const u8 *header = rom_->data();
+    for (size_t i = 0x134; i < 0x144 && header[i] != 0; i++) {
+        title_.push_back(static_cast<char>(header[i]));
+    }
+
+    // RAM smaller than a bank still backs all of 0xA000-0xBFFF
+    if (ram_size > 0) {
+        ram_size_ = std::max(ram_size, ram_bank_size);
+        ram_.resize(ram_size_);
+    }
+}
+
+Cartridge::Cartridge(const Cartridge &other)
+  : rom_(other.rom_),
+    ram_(other.ram_data(), other.ram_data() + other.ram_size_),
+    ram_size_(other.ram_size_),
+    save_(),
+    ram_dirty_(other.ram_dirty_),
+    title_(other.title_),
+    mbc_(other.mbc_),
+    battery_(other.battery_),
+    rtc_enabled_(other.rtc_enabled_),
+    ram_enabled_(other.ram_enabled_),
+    rom_bank_(other.rom_bank_),
+    ram_bank_(other.ram_bank_),
+    mode_(other.mode_),
+    rtc_(other.rtc_),
+    scheduler_(other.scheduler_)
+{
+}
+
+auto Cartridge::operator=(const Cartridge &other) -> Cartridge &
+{
+    if (this == &other) {
+        return *this;
+    }
+    if (save_ != nullptr && save_->size() == other.ram_size_) {
+        std::memcpy(save_->data(), other.ram_data(), other.ram_size_);
+    }
+    else {
+        save_.reset();
+        ram_.assign(other.ram_data(), other.ram_data() + other.ram_size_);
+    }
+    rom_ = other.rom_;
+    ram_size_ = other.ram_size_;
+    ram_dirty_ = other.ram_dirty_;
+    title_ = other.title_;
+    mbc_ = other.mbc_;
+    battery_ = other.battery_;
+    rtc_enabled_ = other.rtc_enabled_;
+    ram_enabled_ = other.ram_enabled_;
+    rom_bank_ = other.rom_bank_;
+    ram_bank_ = other.ram_bank_;
+    mode_ = other.mode_;
+    rtc_ = other.rtc_;
+    scheduler_ = other.scheduler_;
+    return *this;
+}
+
+auto Cartridge::title() const -> const std::string &
+{
+    return title_;
+}
+
+auto Cartridge::mbc() const -> Mbc
+{
+    return mbc_;
+}
+
+auto Cartridge::has_battery() const -> bool
+{
+    return battery_;
+}
+
+auto Cartridge::has_rtc() const -> bool
+{
+    return rtc_enabled_;
+}
+
+auto Cartridge::cgb() const -> bool
+{
+    return (rom_->data()[0x143] & 0x80) != 0;
+}
+
+auto Cartridge::load_save(std::string_view path) -> bool
+{
+    if (!battery_ || ram_size_ == 0) {
+        return false;
+    }
+    std::unique_ptr<SaveFile> save = SaveFile::open(path, ram_size_);
+    if (save == nullptr) {
+        return false;
+    }
+    save_ = std::move(save);
+    ram_dirty_ = false;
+    ram_.clear();
+    ram_.shrink_to_fit();
+    return true;
+}
+
+auto Cartridge::has_save() const -> bool
+{
+    return save_ != nullptr;
+}
+
+auto Cartridge::ram_dirty() const -> bool
+{
+    return ram_dirty_;
+}
+
+auto Cartridge::mark_ram_dirty() -> void
+{
+    ram_dirty_ = true;
+}
+
+auto Cartridge::flush_save() -> void
+{
+    if (save_ != nullptr && ram_dirty_) {
+        save_->flush();
+        ram_dirty_ = false;
+    }
+}
+
+auto Cartridge::ram_bank() -> u8 *
+{
+    if (!ram_enabled_ || ram_size_ == 0 ||
+        (mbc_ == Mbc::Mbc3 && ram_bank_ >= 0x08)) {
+        return nullptr;
+    }
+    return ram_data() + ram_bank_number() * ram_bank_size;
+}
+
+auto Cartridge::rom_bank0_number() const -> u16
+{
+    if (mbc_ == Mbc::Mbc1 && mode_) {
+        return ((ram_bank_ & 0x03) << 5) % rom_banks();
+    }
+    return 0;
+}
+
+auto Cartridge::rom_bank_number() const -> u16
+{
+    switch (mbc_) {
+    case Mbc::None: return 1;
+    case Mbc::Mbc1: return ((ram_bank_ & 0x03) << 5 | rom_bank_) % rom_banks();
+    case Mbc::Mbc3:
+    case Mbc::Mbc5: return rom_bank_ % rom_banks();
+    }
+    return 1;
+}
+
+auto Cartridge::ram_bank_number() const -> u16
+{
+    switch (mbc_) {
+    case Mbc::None: return 0;
+    case Mbc::Mbc1: return mode_ ? (ram_bank_ & 0x03) % ram_banks() : 0;
+    case Mbc::Mbc3:
+    case Mbc::Mbc5: return (ram_bank_ & 0x0F) % ram_banks();
+    }
+    return 0;
+}
+
+auto Cartridge::write(u16 address, u8 value) -> void
+{
+    switch (mbc_) {
+    case Mbc::None: break;
+    case Mbc::Mbc1: write_mbc1(address, value); break;
+    case Mbc::Mbc3: write_mbc3(address, value); break;
+    case Mbc::Mbc5: write_mbc5(address, value); break;
+    }
+}
+
+auto Cartridge::read_ram(u16 /*address*/) -> u8
+{
+    if (mbc_ == Mbc::Mbc3 && rtc_enabled_ && ram_enabled_ &&
+        ram_bank_ >= 0x08 && ram_bank_ <= 0x0C) {
+        return rtc_.latched[ram_bank_ - 0x08];
+    }
+    return 0xFF;
+}
+
+auto Cartridge::write_ram(u16 /*address*/, u8 value) -> void
+{
+    if (mbc_ == Mbc::Mbc3 && rtc_enabled_ && ram_enabled_ &&
+        ram_bank_ >= 0x08 && ram_bank_ <= 0x0C) {
+        update_rtc();
+        const u8 index = ram_bank_ - 0x08;
+        rtc_.registers[index] = value & rtc_masks[index];
+        // Writing the seconds restarts the current second
+        if (index == 0 && scheduler_ != nullptr) {
+            rtc_.cycle = scheduler_->now();
+        }
+    }
+}
+
+auto Cartridge::set_clock(const Scheduler *scheduler) -> void
+{
+    scheduler_ = scheduler;
+    rtc_.cycle = scheduler != nullptr ? scheduler->now() : 0;
+}
+
+auto Cartridge::rom_banks() const -> size_t
+{
+    return rom_->size() / rom_bank_size;
+}
+
+auto Cartridge::ram_banks() const -> size_t
+{
+    return std::max<size_t>(ram_size_ / ram_bank_size, 1);
+}
+
+auto Cartridge::ram_data() -> u8 *
+{
+    return save_ != nullptr ? save_->data() : ram_.data();
+}
+
+auto Cartridge::ram_data() const -> const u8 *
+{
+    return save_ != nullptr ? save_->data() : ram_.data();
+}
+
+auto Cartridge::write_mbc1(u16 address, u8 value) -> void
+{
+    switch (address >> 13) {
+    case 0: ram_enabled_ = (value & 0x0F) == 0x0A; break;
+    case 1: rom_bank_ = std::max(value & 0x1F, 1); break;
+    case 2: ram_bank_ = value & 0x03; break;
+    case 3: mode_ = (value & 0x01) != 0; break;
+    default: break;
+    }
+}
+
+auto Cartridge::write_mbc3(u16 address, u8 value) -> void
+{
+    switch (address >> 13) {
+    case 0: ram_enabled_ = (value & 0x0F) == 0x0A; break;
+    case 1: rom_bank_ = std::max(value & 0x7F, 1); break;
+    case 2: ram_bank_ = value & 0x0F; break;
+    case 3:
+        // Writing 0 then 1 latches the clock
+        if (rtc_enabled_ && rtc_.latch == 0x00 && value == 0x01) {
+            update_rtc();
+            rtc_.latched = rtc_.registers;
+        }
+        rtc_.latch = value;
+        break;
+    default: break;
+    }
+}
+
+auto Cartridge::write_mbc5(u16 address, u8 value) -> void
+{
+    switch (address >> 12) {
+    case 0:
+    case 1: ram_enabled_ = (value & 0x0F) == 0x0A; break;
+    case 2: rom_bank_ = (rom_bank_ & 0x100) | value; break;
+    case 3: rom_bank_ = (rom_bank_ & 0x0FF) | (value & 0x01) << 8; break;
+    case 4:
+    case 5: ram_bank_ = value & 0x0F; break;
+    default: break;
+    }
+}
+
+auto Cartridge::update_rtc() -> void
+{
+    if (scheduler_ == nullptr) {
+        return;
+    }
+
+    // The halt bit of the day high register stops the clock
+    auto &registers = rtc_.registers;
+    const u64 now = scheduler_->now();
+    if ((registers[4] & 0x40) != 0) {
+        rtc_.cycle = now;
+        return;
+    }
+
+    const u64 seconds = (now - rtc_.cycle) / Scheduler::cycles_per_second;
+    if (seconds == 0) {
+        return;
+    }
+    rtc_.cycle += seconds * Scheduler::cycles_per_second;
+
+    u64 total = registers[0] + registers[1] * 60 + registers[2] * 3600 + seconds;
+    registers[0] = total % 60;
+    total /= 60;
+    registers[1] = total % 60;
+    total /= 60;
+    registers[2] = total % 24;
+    u64 days = (registers[3] | (registers[4] & 0x01) << 8) + total / 24;
+    // Overflowing the 9-bit day counter sets the carry, which stays set
+    if (days > 0x1FF) {
+        registers[4] |= 0x80;
+        days &= 0x1FF;
+    }
+    registers[3] = days & 0xFF;
+    registers[4] = (registers[4] & 0xFE) | days >> 8;
+}
+} // namespace tomboy
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "rom.hpp"
+#include "save_file.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tomboy {
+class Scheduler;
+}
+
+namespace tomboy {
+/// Cartridge ROM and RAM behind a memory bank controller
+///
+/// Banks are exposed as pointers into the ROM and RAM images, Memory maps
+/// its cartridge pages onto them and repoints those pages after a write to
+/// the controller, so switching banks never copies. The ROM is shared by
+/// every cartridge built from it, battery RAM can be kept in a save file.
+class Cartridge {
+  public:
+    enum class Mbc : u8 {
+        None,
+        Mbc1,
+        Mbc3,
+        Mbc5,
+    };
+
+    static constexpr size_t rom_bank_size = Rom::bank_size;
+    static constexpr size_t ram_bank_size = 0x2000;
+
+  public:
+    /// Parse the header of a ROM image, nullopt if its controller is
+    /// unsupported
+    [[nodiscard]] static auto from_rom(std::shared_ptr<const Rom> rom)
+        -> std::optional<Cartridge>;
+
+    /// A copy keeps its RAM in memory, detached from any save file
+    Cartridge(const Cartridge &other);
+    /// Takes on the other's RAM contents, keeping this cartridge's save file
+    auto operator=(const Cartridge &other) -> Cartridge &;
+    Cartridge(Cartridge &&) = default;
+    auto operator=(Cartridge &&) -> Cartridge & = default;
+
+    [[nodiscard]] auto title() const -> const std::string &;
+    [[nodiscard]] auto mbc() const -> Mbc;
+    [[nodiscard]] auto has_battery() const -> bool;
+    [[nodiscard]] auto has_rtc() const -> bool;
+    /// Whether the header flags Game Boy Color support
+    [[nodiscard]] auto cgb() const -> bool;
+
+    /// Back battery RAM with the save file at path, loading its contents,
+    /// false if there is no battery RAM or the file cannot be opened
+    auto load_save(std::string_view path) -> bool;
+    /// Whether RAM is kept in a save file, writes must then mark it dirty
+    [[nodiscard]] auto has_save() const -> bool;
+    /// Whether RAM was written since the save file was last flushed
+    [[nodiscard]] auto ram_dirty() const -> bool;
+    auto mark_ram_dirty() -> void;
+    /// Start writing RAM back to the save file if it is dirty
+    auto flush_save() -> void;
+
+    /// ROM mapped at 0x0000-0x3FFF
+    [[nodiscard]] auto rom_bank0() const -> const u8 *;
+    /// ROM mapped at 0x4000-0x7FFF
+    [[nodiscard]] auto rom_bank() const -> const u8 *;
+    /// RAM mapped at 0xA000-0xBFFF, nullptr if RAM is disabled, absent or a
+    /// clock register is selected
+    [[nodiscard]] auto ram_bank() -> u8 *;
+
+    [[nodiscard]] auto rom_bank0_number() const -> u16;
+    [[nodiscard]] auto rom_bank_number() const -> u16;
+    [[nodiscard]] auto ram_bank_number() const -> u16;
+
+    /// Write to a controller register in 0x0000-0x7FFF
+    auto write(u16 address, u8 value) -> void;
+    /// Access 0xA000-0xBFFF while ram_bank is nullptr
+    [[nodiscard]] auto read_ram(u16 address) -> u8;
+    auto write_ram(u16 address, u8 value) -> void;
+
+    /// Advance the real time clock with the machine cycle counter, it stands
+    /// still without one
+    auto set_clock(const Scheduler *scheduler) -> void;
+
+  private:
+    /// MBC3 real time clock registers, selected as RAM banks 0x08-0x0C
+    struct Rtc {
+        std::array<u8, 5> registers;
+        std::array<u8, 5> latched;
+        /// Cycle the registers were last brought up to date at
+        u64 cycle;
+        /// Last value written to the latch register
+        u8 latch;
+    };
+
+  private:
+    Cartridge(std::shared_ptr<const Rom> rom, Mbc mbc, size_t ram_size);
+
+    [[nodiscard]] auto rom_banks() const -> size_t;
+    [[nodiscard]] auto ram_banks() const -> size_t;
+    /// RAM in memory or in the save file
+    [[nodiscard]] auto ram_data() -> u8 *;
+    [[nodiscard]] auto ram_data() const -> const u8 *;
+
+    auto write_mbc1(u16 address, u8 value) -> void;
+    auto write_mbc3(u16 address, u8 value) -> void;
+    auto write_mbc5(u16 address, u8 value) -> void;
+
+    /// Add the whole seconds elapsed since the clock was last updated
+    auto update_rtc() -> void;
+
+  private:
+    std::shared_ptr<const Rom> rom_;
+    /// RAM while there is no save file
+    std::vector<u8> ram_;
+    size_t ram_size_;
+    std::unique_ptr<SaveFile> save_;
+    bool ram_dirty_;
+    std::string title_;
+    Mbc mbc_;
+    bool battery_;
+    bool rtc_enabled_;
+
+    bool ram_enabled_;
+    /// Low bank register, 5 bits on MBC1, 7 on MBC3 and 9 on MBC5
+    u16 rom_bank_;
+    /// RAM bank, upper ROM bits on MBC1, or clock register on MBC3
+    u8 ram_bank_;
+    /// MBC1 banking mode, applies the upper bits to 0x0000 and RAM
+    bool mode_;
+
+    Rtc rtc_;
+    const Scheduler *scheduler_;
+};
+
+inline auto Cartridge::rom_bank0() const -> const u8 *
+{
+    return rom_->data() + rom_bank0_number() * rom_bank_size;
+}
+
+inline auto Cartridge::rom_bank() const -> const u8 *
+{
+    return rom_->data() + rom_bank_number() * rom_bank_size;
+}
+} // namespace tomboy
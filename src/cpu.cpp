@@ -1,10 +1,13 @@
 #include "cpu.hpp"
 
 #include "memory.hpp"
+#include "scheduler.hpp"
 #include "types.hpp"
 
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <bit>
 #include <iostream>
 #include <print>
 #include <type_traits>
@@ -16,38 +19,209 @@ constexpr auto lo_nibble(u8 byte) -> u8
     return byte & 0x0F;
 }
 
-Cpu::Cpu(Memory *memory)
-  : af_(),
-    bc_(),
-    de_(),
-    hl_(),
-    sp_(),
-    pc_(),
+/// Length in bytes of each unprefixed opcode, prefixed opcodes are 2 bytes
+constexpr std::array<u8, 256> instruction_lengths = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x00
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x10
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x20
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // 0xC0
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // 0xD0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xE0
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // 0xF0
+};
+
+/// Upper bound on the instructions decoded into one block
+constexpr size_t max_block_instructions = 64;
+
+/// Whether an instruction may leave straight-line execution
+constexpr auto ends_block(u16 index) -> bool
+{
+    switch (index) {
+    case 0x010: // stop
+    case 0x018: // jr s8
+    case 0x020:
+    case 0x028:
+    case 0x030:
+    case 0x038: // jr cc, s8
+    case 0x076: // halt
+    case 0x0C0:
+    case 0x0C8:
+    case 0x0D0:
+    case 0x0D8: // ret cc
+    case 0x0C9: // ret
+    case 0x0D9: // reti
+    case 0x0C2:
+    case 0x0CA:
+    case 0x0D2:
+    case 0x0DA: // jp cc, a16
+    case 0x0C3: // jp a16
+    case 0x0E9: // jp hl
+    case 0x0C4:
+    case 0x0CC:
+    case 0x0D4:
+    case 0x0DC: // call cc, a16
+    case 0x0CD: // call a16
+    case 0x0C7:
+    case 0x0CF:
+    case 0x0D7:
+    case 0x0DF:
+    case 0x0E7:
+    case 0x0EF:
+    case 0x0F7:
+    case 0x0FF: // rst
+    case 0x0F3: // di
+    case 0x0FB: // ei
+        return true;
+    default: return false;
+    }
+}
+
+Cpu::Cpu(Memory *memory, Scheduler *scheduler, Core core)
+  : af_(0x01B0),
+    bc_(0x0013),
+    de_(0x00D8),
+    hl_(0x014D),
+    sp_(0xFFFE),
+    pc_(0x0100),
+    flag_op_(FlagOp::None),
+    flag_lhs_(0),
+    flag_rhs_(0),
+    flag_result_(0),
+    flag_carry_(false),
+    flag_carry_in_(false),
     halted_(false),
+    locked_(false),
     ime_(true),
-    memory_(memory)
+    yield_(false),
+    instructions_(0),
+    halted_cycles_(0),
+    idle_cycles_(0),
+    core_(core),
+    memory_(memory),
+    scheduler_(scheduler),
+    block_cache_(),
+    jit_()
 {
+    memory_->set_block_cache(&block_cache_);
+    scheduler_->set_preempt(&yield_);
 }
 
 auto Cpu::step() -> u8
 {
-    u8 cycles = 0;
-    const auto [opcode, has_prefix] = fetch();
+    if (const u8 cycles_used = service_interrupts(); cycles_used > 0) {
+        scheduler_->advance(cycles_used);
+        return cycles_used;
+    }
+    if (halted_) {
+        halted_cycles_++;
+        scheduler_->advance(1);
+        return 1;
+    }
 
-    return cycles;
+    const auto [new_pc, cycles_used] = decode_execute(fetch());
+    pc_ = new_pc;
+    instructions_++;
+    scheduler_->advance(cycles_used);
+    return cycles_used;
 }
 
-auto Cpu::fetch() const -> FetchResult
+auto Cpu::run_for(u64 cycles) -> u64
 {
-    const u8 opcode = memory_->read(pc_);
-    const bool has_prefix = opcode == 0xCB;
-    return {
-        .opcode = has_prefix ? memory_->read(pc_ + 1) : opcode,
-        .has_prefix = has_prefix,
-    };
+    const u64 start = scheduler_->now();
+    const u64 end = start + cycles;
+    while (scheduler_->now() < end) {
+        scheduler_->advance(service_interrupts());
+        const u64 now = scheduler_->now();
+        const u64 deadline = std::min(end, scheduler_->next_deadline());
+        if (deadline <= now) {
+            continue;
+        }
+
+        // While halted only an event can raise an interrupt: the PPU's
+        // VBlank and STAT, timer overflow or a finished serial transfer.
+        // Buttons change between frames, outside of this loop. Skip
+        // straight to the next event and check again.
+        if (halted_) {
+            halted_cycles_ += deadline - now;
+            scheduler_->advance(deadline - now);
+            continue;
+        }
+
+        // The cores keep the counter current for the components they access,
+        // dispatch whatever came due once the slice is over
+        yield_ = false;
+        run_core(deadline - now);
+        scheduler_->advance(0);
+    }
+    return scheduler_->now() - start;
+}
+
+auto Cpu::run_until(u64 deadline) -> u64
+{
+    const u64 now = scheduler_->now();
+    return deadline > now ? run_for(deadline - now) : 0;
+}
+
+auto Cpu::pc() const -> u16
+{
+    return pc_;
+}
+
+auto Cpu::cycles() const -> u64
+{
+    return scheduler_->now();
+}
+
+auto Cpu::instructions() const -> u64
+{
+    return instructions_;
+}
+
+auto Cpu::halted_cycles() const -> u64
+{
+    return halted_cycles_;
+}
+
+auto Cpu::idle_cycles() const -> u64
+{
+    return idle_cycles_;
+}
+
+auto Cpu::core() const -> Core
+{
+    return core_;
+}
+
+auto Cpu::set_core(Core core) -> void
+{
+    core_ = core;
+}
+
+auto Cpu::jit() -> Jit &
+{
+    return jit_;
 }
 
-auto Cpu::decode_execute(u8 opcode, bool has_prefix) -> ExecuteResult
+auto Cpu::fetch() const -> u8
+{
+    return memory_->read(pc_);
+}
+
+auto Cpu::decode_execute(u8 opcode) -> ExecuteResult
+{
+    return (this->*instruction_table[opcode])();
+}
+
+auto Cpu::decode_execute_switch(u8 opcode, bool has_prefix) -> ExecuteResult
 {
     // 8-bit opcode
     if (!has_prefix) {
@@ -114,7 +288,7 @@ auto Cpu::decode_execute(u8 opcode, bool has_prefix) -> ExecuteResult
         case 0x3B: return dec_r16(sp_);
         case 0x3C: return inc_r8(af_.hi());
         case 0x3D: return dec_r8(af_.hi());
-        case 0x3E: return ld_r8_n8(af_.lo());
+        case 0x3E: return ld_r8_n8(af_.hi());
         case 0x3F: return ccf();
         case 0x40: return ld_r8_r8(bc_.hi(), bc_.hi());
         case 0x41: return ld_r8_r8(bc_.hi(), bc_.lo());
@@ -290,11 +464,11 @@ auto Cpu::decode_execute(u8 opcode, bool has_prefix) -> ExecuteResult
         case 0xEE: return xor_n8();
         case 0xEF: return rst(0x28);
         case 0xF0: return ldh_a_a8();
-        case 0xF1: return pop_r16(af_);
+        case 0xF1: return pop_af();
         case 0xF2: return ldh_a_c();
         case 0xF3: return di();
 
-        case 0xF5: return push_r16(af_);
+        case 0xF5: return push_af();
         case 0xF6: return or_n8();
         case 0xF7: return rst(0x30);
         case 0xF8: return ld_hl_sp_s8();
@@ -304,10 +478,7 @@ auto Cpu::decode_execute(u8 opcode, bool has_prefix) -> ExecuteResult
 
         case 0xFE: return cp_n8();
         case 0xFF: return rst(0x38);
-        default:
-            std::println(
-                std::cerr, "Decode failed. Invalid opcode: 0x{:x}", opcode);
-            return {.new_pc = pc_, .cycles_used = 0};
+        default: return invalid();
         }
     }
     // 16-bit opcode
@@ -570,12 +741,1012 @@ auto Cpu::decode_execute(u8 opcode, bool has_prefix) -> ExecuteResult
         case 0xFE: return set_hla(7);
         case 0xFF: return set_r8(7, af_.hi());
 
-        default:
-            std::println(
-                std::cerr, "Decode failed. Invalid opcode: 0xCB{:x}", opcode);
-            return {.new_pc = pc_, .cycles_used = 0};
+        default: return invalid();
+        }
+    }
+}
+
+template <Cpu::R8 reg>
+auto Cpu::r8() -> Register8 &
+{
+    if constexpr (reg == R8::A) {
+        return af_.hi();
+    }
+    else if constexpr (reg == R8::B) {
+        return bc_.hi();
+    }
+    else if constexpr (reg == R8::C) {
+        return bc_.lo();
+    }
+    else if constexpr (reg == R8::D) {
+        return de_.hi();
+    }
+    else if constexpr (reg == R8::E) {
+        return de_.lo();
+    }
+    else if constexpr (reg == R8::H) {
+        return hl_.hi();
+    }
+    else {
+        return hl_.lo();
+    }
+}
+
+template <Cpu::R16 reg>
+auto Cpu::r16() -> Register16 &
+{
+    if constexpr (reg == R16::AF) {
+        return af_;
+    }
+    else if constexpr (reg == R16::BC) {
+        return bc_;
+    }
+    else if constexpr (reg == R16::DE) {
+        return de_;
+    }
+    else if constexpr (reg == R16::HL) {
+        return hl_;
+    }
+    else {
+        return sp_;
+    }
+}
+
+template <auto operand>
+auto Cpu::resolve() -> decltype(auto)
+{
+    if constexpr (std::is_same_v<decltype(operand), R8>) {
+        return r8<operand>();
+    }
+    else if constexpr (std::is_same_v<decltype(operand), R16>) {
+        return r16<operand>();
+    }
+    else {
+        return operand;
+    }
+}
+
+template <auto handler, auto... operands>
+auto Cpu::execute() -> ExecuteResult
+{
+    return (this->*handler)(resolve<operands>()...);
+}
+
+constexpr auto Cpu::make_instruction_table() -> InstructionTable
+{
+    InstructionTable table{};
+    table.fill(&Cpu::invalid);
+
+    // 8-bit opcodes
+    table[0x000] = &Cpu::nop;
+    table[0x001] = &Cpu::execute<&Cpu::ld_r16_n16, R16::BC>;
+    table[0x002] = &Cpu::execute<&Cpu::ld_ra16_a, R16::BC>;
+    table[0x003] = &Cpu::execute<&Cpu::inc_r16, R16::BC>;
+    table[0x004] = &Cpu::execute<&Cpu::inc_r8, R8::B>;
+    table[0x005] = &Cpu::execute<&Cpu::dec_r8, R8::B>;
+    table[0x006] = &Cpu::execute<&Cpu::ld_r8_n8, R8::B>;
+    table[0x007] = &Cpu::rlc_a;
+    table[0x008] = &Cpu::ld_a16_sp;
+    table[0x009] = &Cpu::execute<&Cpu::add_hl_r16, R16::BC>;
+    table[0x00A] = &Cpu::execute<&Cpu::ld_a_ra16, R16::BC>;
+    table[0x00B] = &Cpu::execute<&Cpu::dec_r16, R16::BC>;
+    table[0x00C] = &Cpu::execute<&Cpu::inc_r8, R8::C>;
+    table[0x00D] = &Cpu::execute<&Cpu::dec_r8, R8::C>;
+    table[0x00E] = &Cpu::execute<&Cpu::ld_r8_n8, R8::C>;
+    table[0x00F] = &Cpu::rrc_a;
+    table[0x010] = &Cpu::stop;
+    table[0x011] = &Cpu::execute<&Cpu::ld_r16_n16, R16::DE>;
+    table[0x012] = &Cpu::execute<&Cpu::ld_ra16_a, R16::DE>;
+    table[0x013] = &Cpu::execute<&Cpu::inc_r16, R16::DE>;
+    table[0x014] = &Cpu::execute<&Cpu::inc_r8, R8::D>;
+    table[0x015] = &Cpu::execute<&Cpu::dec_r8, R8::D>;
+    table[0x016] = &Cpu::execute<&Cpu::ld_r8_n8, R8::D>;
+    table[0x017] = &Cpu::rl_a;
+    table[0x018] = &Cpu::jr_s8;
+    table[0x019] = &Cpu::execute<&Cpu::add_hl_r16, R16::DE>;
+    table[0x01A] = &Cpu::execute<&Cpu::ld_a_ra16, R16::DE>;
+    table[0x01B] = &Cpu::execute<&Cpu::dec_r16, R16::DE>;
+    table[0x01C] = &Cpu::execute<&Cpu::inc_r8, R8::E>;
+    table[0x01D] = &Cpu::execute<&Cpu::dec_r8, R8::E>;
+    table[0x01E] = &Cpu::execute<&Cpu::ld_r8_n8, R8::E>;
+    table[0x01F] = &Cpu::rr_a;
+    table[0x020] = &Cpu::execute<&Cpu::jr_cc_s8, Flag::Zero, false>;
+    table[0x021] = &Cpu::execute<&Cpu::ld_r16_n16, R16::HL>;
+    table[0x022] = &Cpu::ld_hlai_a;
+    table[0x023] = &Cpu::execute<&Cpu::inc_r16, R16::HL>;
+    table[0x024] = &Cpu::execute<&Cpu::inc_r8, R8::H>;
+    table[0x025] = &Cpu::execute<&Cpu::dec_r8, R8::H>;
+    table[0x026] = &Cpu::execute<&Cpu::ld_r8_n8, R8::H>;
+    table[0x027] = &Cpu::daa;
+    table[0x028] = &Cpu::execute<&Cpu::jr_cc_s8, Flag::Zero, true>;
+    table[0x029] = &Cpu::execute<&Cpu::add_hl_r16, R16::HL>;
+    table[0x02A] = &Cpu::ld_a_hlai;
+    table[0x02B] = &Cpu::execute<&Cpu::dec_r16, R16::HL>;
+    table[0x02C] = &Cpu::execute<&Cpu::inc_r8, R8::L>;
+    table[0x02D] = &Cpu::execute<&Cpu::dec_r8, R8::L>;
+    table[0x02E] = &Cpu::execute<&Cpu::ld_r8_n8, R8::L>;
+    table[0x02F] = &Cpu::cpl;
+    table[0x030] = &Cpu::execute<&Cpu::jr_cc_s8, Flag::Carry, false>;
+    table[0x031] = &Cpu::execute<&Cpu::ld_r16_n16, R16::SP>;
+    table[0x032] = &Cpu::ld_hlad_a;
+    table[0x033] = &Cpu::execute<&Cpu::inc_r16, R16::SP>;
+    table[0x034] = &Cpu::inc_hla;
+    table[0x035] = &Cpu::dec_hla;
+    table[0x036] = &Cpu::ld_hla_n8;
+    table[0x037] = &Cpu::scf;
+    table[0x038] = &Cpu::execute<&Cpu::jr_cc_s8, Flag::Carry, true>;
+    table[0x039] = &Cpu::execute<&Cpu::add_hl_r16, R16::SP>;
+    table[0x03A] = &Cpu::ld_a_hlad;
+    table[0x03B] = &Cpu::execute<&Cpu::dec_r16, R16::SP>;
+    table[0x03C] = &Cpu::execute<&Cpu::inc_r8, R8::A>;
+    table[0x03D] = &Cpu::execute<&Cpu::dec_r8, R8::A>;
+    table[0x03E] = &Cpu::execute<&Cpu::ld_r8_n8, R8::A>;
+    table[0x03F] = &Cpu::ccf;
+    table[0x040] = &Cpu::execute<&Cpu::ld_r8_r8, R8::B, R8::B>;
+    table[0x041] = &Cpu::execute<&Cpu::ld_r8_r8, R8::B, R8::C>;
+    table[0x042] = &Cpu::execute<&Cpu::ld_r8_r8, R8::B, R8::D>;
+    table[0x043] = &Cpu::execute<&Cpu::ld_r8_r8, R8::B, R8::E>;
+    table[0x044] = &Cpu::execute<&Cpu::ld_r8_r8, R8::B, R8::H>;
+    table[0x045] = &Cpu::execute<&Cpu::ld_r8_r8, R8::B, R8::L>;
+    table[0x046] = &Cpu::execute<&Cpu::ld_r8_hla, R8::B>;
+    table[0x047] = &Cpu::execute<&Cpu::ld_r8_r8, R8::B, R8::A>;
+    table[0x048] = &Cpu::execute<&Cpu::ld_r8_r8, R8::C, R8::B>;
+    table[0x049] = &Cpu::execute<&Cpu::ld_r8_r8, R8::C, R8::C>;
+    table[0x04A] = &Cpu::execute<&Cpu::ld_r8_r8, R8::C, R8::D>;
+    table[0x04B] = &Cpu::execute<&Cpu::ld_r8_r8, R8::C, R8::E>;
+    table[0x04C] = &Cpu::execute<&Cpu::ld_r8_r8, R8::C, R8::H>;
+    table[0x04D] = &Cpu::execute<&Cpu::ld_r8_r8, R8::C, R8::L>;
+    table[0x04E] = &Cpu::execute<&Cpu::ld_r8_hla, R8::C>;
+    table[0x04F] = &Cpu::execute<&Cpu::ld_r8_r8, R8::C, R8::A>;
+    table[0x050] = &Cpu::execute<&Cpu::ld_r8_r8, R8::D, R8::B>;
+    table[0x051] = &Cpu::execute<&Cpu::ld_r8_r8, R8::D, R8::C>;
+    table[0x052] = &Cpu::execute<&Cpu::ld_r8_r8, R8::D, R8::D>;
+    table[0x053] = &Cpu::execute<&Cpu::ld_r8_r8, R8::D, R8::E>;
+    table[0x054] = &Cpu::execute<&Cpu::ld_r8_r8, R8::D, R8::H>;
+    table[0x055] = &Cpu::execute<&Cpu::ld_r8_r8, R8::D, R8::L>;
+    table[0x056] = &Cpu::execute<&Cpu::ld_r8_hla, R8::D>;
+    table[0x057] = &Cpu::execute<&Cpu::ld_r8_r8, R8::D, R8::A>;
+    table[0x058] = &Cpu::execute<&Cpu::ld_r8_r8, R8::E, R8::B>;
+    table[0x059] = &Cpu::execute<&Cpu::ld_r8_r8, R8::E, R8::C>;
+    table[0x05A] = &Cpu::execute<&Cpu::ld_r8_r8, R8::E, R8::D>;
+    table[0x05B] = &Cpu::execute<&Cpu::ld_r8_r8, R8::E, R8::E>;
+    table[0x05C] = &Cpu::execute<&Cpu::ld_r8_r8, R8::E, R8::H>;
+    table[0x05D] = &Cpu::execute<&Cpu::ld_r8_r8, R8::E, R8::L>;
+    table[0x05E] = &Cpu::execute<&Cpu::ld_r8_hla, R8::E>;
+    table[0x05F] = &Cpu::execute<&Cpu::ld_r8_r8, R8::E, R8::A>;
+    table[0x060] = &Cpu::execute<&Cpu::ld_r8_r8, R8::H, R8::B>;
+    table[0x061] = &Cpu::execute<&Cpu::ld_r8_r8, R8::H, R8::C>;
+    table[0x062] = &Cpu::execute<&Cpu::ld_r8_r8, R8::H, R8::D>;
+    table[0x063] = &Cpu::execute<&Cpu::ld_r8_r8, R8::H, R8::E>;
+    table[0x064] = &Cpu::execute<&Cpu::ld_r8_r8, R8::H, R8::H>;
+    table[0x065] = &Cpu::execute<&Cpu::ld_r8_r8, R8::H, R8::L>;
+    table[0x066] = &Cpu::execute<&Cpu::ld_r8_hla, R8::H>;
+    table[0x067] = &Cpu::execute<&Cpu::ld_r8_r8, R8::H, R8::A>;
+    table[0x068] = &Cpu::execute<&Cpu::ld_r8_r8, R8::L, R8::B>;
+    table[0x069] = &Cpu::execute<&Cpu::ld_r8_r8, R8::L, R8::C>;
+    table[0x06A] = &Cpu::execute<&Cpu::ld_r8_r8, R8::L, R8::D>;
+    table[0x06B] = &Cpu::execute<&Cpu::ld_r8_r8, R8::L, R8::E>;
+    table[0x06C] = &Cpu::execute<&Cpu::ld_r8_r8, R8::L, R8::H>;
+    table[0x06D] = &Cpu::execute<&Cpu::ld_r8_r8, R8::L, R8::L>;
+    table[0x06E] = &Cpu::execute<&Cpu::ld_r8_hla, R8::L>;
+    table[0x06F] = &Cpu::execute<&Cpu::ld_r8_r8, R8::L, R8::A>;
+    table[0x070] = &Cpu::execute<&Cpu::ld_hla_r8, R8::B>;
+    table[0x071] = &Cpu::execute<&Cpu::ld_hla_r8, R8::C>;
+    table[0x072] = &Cpu::execute<&Cpu::ld_hla_r8, R8::D>;
+    table[0x073] = &Cpu::execute<&Cpu::ld_hla_r8, R8::E>;
+    table[0x074] = &Cpu::execute<&Cpu::ld_hla_r8, R8::H>;
+    table[0x075] = &Cpu::execute<&Cpu::ld_hla_r8, R8::L>;
+    table[0x076] = &Cpu::halt;
+    table[0x077] = &Cpu::execute<&Cpu::ld_hla_r8, R8::A>;
+    table[0x078] = &Cpu::execute<&Cpu::ld_r8_r8, R8::A, R8::B>;
+    table[0x079] = &Cpu::execute<&Cpu::ld_r8_r8, R8::A, R8::C>;
+    table[0x07A] = &Cpu::execute<&Cpu::ld_r8_r8, R8::A, R8::D>;
+    table[0x07B] = &Cpu::execute<&Cpu::ld_r8_r8, R8::A, R8::E>;
+    table[0x07C] = &Cpu::execute<&Cpu::ld_r8_r8, R8::A, R8::H>;
+    table[0x07D] = &Cpu::execute<&Cpu::ld_r8_r8, R8::A, R8::L>;
+    table[0x07E] = &Cpu::execute<&Cpu::ld_r8_hla, R8::A>;
+    table[0x07F] = &Cpu::execute<&Cpu::ld_r8_r8, R8::A, R8::A>;
+    table[0x080] = &Cpu::execute<&Cpu::add_r8, R8::B>;
+    table[0x081] = &Cpu::execute<&Cpu::add_r8, R8::C>;
+    table[0x082] = &Cpu::execute<&Cpu::add_r8, R8::D>;
+    table[0x083] = &Cpu::execute<&Cpu::add_r8, R8::E>;
+    table[0x084] = &Cpu::execute<&Cpu::add_r8, R8::H>;
+    table[0x085] = &Cpu::execute<&Cpu::add_r8, R8::L>;
+    table[0x086] = &Cpu::add_hla;
+    table[0x087] = &Cpu::execute<&Cpu::add_r8, R8::A>;
+    table[0x088] = &Cpu::execute<&Cpu::adc_r8, R8::B>;
+    table[0x089] = &Cpu::execute<&Cpu::adc_r8, R8::C>;
+    table[0x08A] = &Cpu::execute<&Cpu::adc_r8, R8::D>;
+    table[0x08B] = &Cpu::execute<&Cpu::adc_r8, R8::E>;
+    table[0x08C] = &Cpu::execute<&Cpu::adc_r8, R8::H>;
+    table[0x08D] = &Cpu::execute<&Cpu::adc_r8, R8::L>;
+    table[0x08E] = &Cpu::adc_hla;
+    table[0x08F] = &Cpu::execute<&Cpu::adc_r8, R8::A>;
+    table[0x090] = &Cpu::execute<&Cpu::sub_r8, R8::B>;
+    table[0x091] = &Cpu::execute<&Cpu::sub_r8, R8::C>;
+    table[0x092] = &Cpu::execute<&Cpu::sub_r8, R8::D>;
+    table[0x093] = &Cpu::execute<&Cpu::sub_r8, R8::E>;
+    table[0x094] = &Cpu::execute<&Cpu::sub_r8, R8::H>;
+    table[0x095] = &Cpu::execute<&Cpu::sub_r8, R8::L>;
+    table[0x096] = &Cpu::sub_hla;
+    table[0x097] = &Cpu::execute<&Cpu::sub_r8, R8::A>;
+    table[0x098] = &Cpu::execute<&Cpu::sbc_r8, R8::B>;
+    table[0x099] = &Cpu::execute<&Cpu::sbc_r8, R8::C>;
+    table[0x09A] = &Cpu::execute<&Cpu::sbc_r8, R8::D>;
+    table[0x09B] = &Cpu::execute<&Cpu::sbc_r8, R8::E>;
+    table[0x09C] = &Cpu::execute<&Cpu::sbc_r8, R8::H>;
+    table[0x09D] = &Cpu::execute<&Cpu::sbc_r8, R8::L>;
+    table[0x09E] = &Cpu::sbc_hla;
+    table[0x09F] = &Cpu::execute<&Cpu::sbc_r8, R8::A>;
+    table[0x0A0] = &Cpu::execute<&Cpu::and_r8, R8::B>;
+    table[0x0A1] = &Cpu::execute<&Cpu::and_r8, R8::C>;
+    table[0x0A2] = &Cpu::execute<&Cpu::and_r8, R8::D>;
+    table[0x0A3] = &Cpu::execute<&Cpu::and_r8, R8::E>;
+    table[0x0A4] = &Cpu::execute<&Cpu::and_r8, R8::H>;
+    table[0x0A5] = &Cpu::execute<&Cpu::and_r8, R8::L>;
+    table[0x0A6] = &Cpu::and_hla;
+    table[0x0A7] = &Cpu::execute<&Cpu::and_r8, R8::A>;
+    table[0x0A8] = &Cpu::execute<&Cpu::xor_r8, R8::B>;
+    table[0x0A9] = &Cpu::execute<&Cpu::xor_r8, R8::C>;
+    table[0x0AA] = &Cpu::execute<&Cpu::xor_r8, R8::D>;
+    table[0x0AB] = &Cpu::execute<&Cpu::xor_r8, R8::E>;
+    table[0x0AC] = &Cpu::execute<&Cpu::xor_r8, R8::H>;
+    table[0x0AD] = &Cpu::execute<&Cpu::xor_r8, R8::L>;
+    table[0x0AE] = &Cpu::xor_hla;
+    table[0x0AF] = &Cpu::execute<&Cpu::xor_r8, R8::A>;
+    table[0x0B0] = &Cpu::execute<&Cpu::or_r8, R8::B>;
+    table[0x0B1] = &Cpu::execute<&Cpu::or_r8, R8::C>;
+    table[0x0B2] = &Cpu::execute<&Cpu::or_r8, R8::D>;
+    table[0x0B3] = &Cpu::execute<&Cpu::or_r8, R8::E>;
+    table[0x0B4] = &Cpu::execute<&Cpu::or_r8, R8::H>;
+    table[0x0B5] = &Cpu::execute<&Cpu::or_r8, R8::L>;
+    table[0x0B6] = &Cpu::or_hla;
+    table[0x0B7] = &Cpu::execute<&Cpu::or_r8, R8::A>;
+    table[0x0B8] = &Cpu::execute<&Cpu::cp_r8, R8::B>;
+    table[0x0B9] = &Cpu::execute<&Cpu::cp_r8, R8::C>;
+    table[0x0BA] = &Cpu::execute<&Cpu::cp_r8, R8::D>;
+    table[0x0BB] = &Cpu::execute<&Cpu::cp_r8, R8::E>;
+    table[0x0BC] = &Cpu::execute<&Cpu::cp_r8, R8::H>;
+    table[0x0BD] = &Cpu::execute<&Cpu::cp_r8, R8::L>;
+    table[0x0BE] = &Cpu::cp_hla;
+    table[0x0BF] = &Cpu::execute<&Cpu::cp_r8, R8::A>;
+    table[0x0C0] = &Cpu::execute<&Cpu::ret_cc, Flag::Zero, false>;
+    table[0x0C1] = &Cpu::execute<&Cpu::pop_r16, R16::BC>;
+    table[0x0C2] = &Cpu::execute<&Cpu::jp_cc_a16, Flag::Zero, false>;
+    table[0x0C3] = &Cpu::jp_a16;
+    table[0x0C4] = &Cpu::execute<&Cpu::call_cc_a16, Flag::Zero, false>;
+    table[0x0C5] = &Cpu::execute<&Cpu::push_r16, R16::BC>;
+    table[0x0C6] = &Cpu::add_n8;
+    table[0x0C7] = &Cpu::execute<&Cpu::rst, 0x00>;
+    table[0x0C8] = &Cpu::execute<&Cpu::ret_cc, Flag::Zero, true>;
+    table[0x0C9] = &Cpu::ret;
+    table[0x0CA] = &Cpu::execute<&Cpu::jp_cc_a16, Flag::Zero, true>;
+    table[0x0CB] = &Cpu::prefix;
+    table[0x0CC] = &Cpu::execute<&Cpu::call_cc_a16, Flag::Zero, true>;
+    table[0x0CD] = &Cpu::call_a16;
+    table[0x0CE] = &Cpu::adc_n8;
+    table[0x0CF] = &Cpu::execute<&Cpu::rst, 0x08>;
+    table[0x0D0] = &Cpu::execute<&Cpu::ret_cc, Flag::Carry, false>;
+    table[0x0D1] = &Cpu::execute<&Cpu::pop_r16, R16::DE>;
+    table[0x0D2] = &Cpu::execute<&Cpu::jp_cc_a16, Flag::Carry, false>;
+    table[0x0D4] = &Cpu::execute<&Cpu::call_cc_a16, Flag::Carry, false>;
+    table[0x0D5] = &Cpu::execute<&Cpu::push_r16, R16::DE>;
+    table[0x0D6] = &Cpu::sub_n8;
+    table[0x0D7] = &Cpu::execute<&Cpu::rst, 0x10>;
+    table[0x0D8] = &Cpu::execute<&Cpu::ret_cc, Flag::Carry, true>;
+    table[0x0D9] = &Cpu::reti;
+    table[0x0DA] = &Cpu::execute<&Cpu::jp_cc_a16, Flag::Carry, true>;
+    table[0x0DC] = &Cpu::execute<&Cpu::call_cc_a16, Flag::Carry, true>;
+    table[0x0DE] = &Cpu::sbc_n8;
+    table[0x0DF] = &Cpu::execute<&Cpu::rst, 0x18>;
+    table[0x0E0] = &Cpu::ldh_a8_a;
+    table[0x0E1] = &Cpu::execute<&Cpu::pop_r16, R16::HL>;
+    table[0x0E2] = &Cpu::ldh_c_a;
+    table[0x0E5] = &Cpu::execute<&Cpu::push_r16, R16::HL>;
+    table[0x0E6] = &Cpu::and_n8;
+    table[0x0E7] = &Cpu::execute<&Cpu::rst, 0x20>;
+    table[0x0E8] = &Cpu::add_sp_s8;
+    table[0x0E9] = &Cpu::jp_hl;
+    table[0x0EA] = &Cpu::ldh_a16_a;
+    table[0x0EE] = &Cpu::xor_n8;
+    table[0x0EF] = &Cpu::execute<&Cpu::rst, 0x28>;
+    table[0x0F0] = &Cpu::ldh_a_a8;
+    table[0x0F1] = &Cpu::pop_af;
+    table[0x0F2] = &Cpu::ldh_a_c;
+    table[0x0F3] = &Cpu::di;
+    table[0x0F5] = &Cpu::push_af;
+    table[0x0F6] = &Cpu::or_n8;
+    table[0x0F7] = &Cpu::execute<&Cpu::rst, 0x30>;
+    table[0x0F8] = &Cpu::ld_hl_sp_s8;
+    table[0x0F9] = &Cpu::ld_sp_hl;
+    table[0x0FA] = &Cpu::ldh_a_a16;
+    table[0x0FB] = &Cpu::ei;
+    table[0x0FE] = &Cpu::cp_n8;
+    table[0x0FF] = &Cpu::execute<&Cpu::rst, 0x38>;
+
+    // 16-bit opcodes
+    table[0x100] = &Cpu::execute<&Cpu::rlc_r8, R8::B>;
+    table[0x101] = &Cpu::execute<&Cpu::rlc_r8, R8::C>;
+    table[0x102] = &Cpu::execute<&Cpu::rlc_r8, R8::D>;
+    table[0x103] = &Cpu::execute<&Cpu::rlc_r8, R8::E>;
+    table[0x104] = &Cpu::execute<&Cpu::rlc_r8, R8::H>;
+    table[0x105] = &Cpu::execute<&Cpu::rlc_r8, R8::L>;
+    table[0x106] = &Cpu::rlc_hla;
+    table[0x107] = &Cpu::execute<&Cpu::rlc_r8, R8::A>;
+    table[0x108] = &Cpu::execute<&Cpu::rrc_r8, R8::B>;
+    table[0x109] = &Cpu::execute<&Cpu::rrc_r8, R8::C>;
+    table[0x10A] = &Cpu::execute<&Cpu::rrc_r8, R8::D>;
+    table[0x10B] = &Cpu::execute<&Cpu::rrc_r8, R8::E>;
+    table[0x10C] = &Cpu::execute<&Cpu::rrc_r8, R8::H>;
+    table[0x10D] = &Cpu::execute<&Cpu::rrc_r8, R8::L>;
+    table[0x10E] = &Cpu::rrc_hla;
+    table[0x10F] = &Cpu::execute<&Cpu::rrc_r8, R8::A>;
+    table[0x110] = &Cpu::execute<&Cpu::rl_r8, R8::B>;
+    table[0x111] = &Cpu::execute<&Cpu::rl_r8, R8::C>;
+    table[0x112] = &Cpu::execute<&Cpu::rl_r8, R8::D>;
+    table[0x113] = &Cpu::execute<&Cpu::rl_r8, R8::E>;
+    table[0x114] = &Cpu::execute<&Cpu::rl_r8, R8::H>;
+    table[0x115] = &Cpu::execute<&Cpu::rl_r8, R8::L>;
+    table[0x116] = &Cpu::rl_hla;
+    table[0x117] = &Cpu::execute<&Cpu::rl_r8, R8::A>;
+    table[0x118] = &Cpu::execute<&Cpu::rr_r8, R8::B>;
+    table[0x119] = &Cpu::execute<&Cpu::rr_r8, R8::C>;
+    table[0x11A] = &Cpu::execute<&Cpu::rr_r8, R8::D>;
+    table[0x11B] = &Cpu::execute<&Cpu::rr_r8, R8::E>;
+    table[0x11C] = &Cpu::execute<&Cpu::rr_r8, R8::H>;
+    table[0x11D] = &Cpu::execute<&Cpu::rr_r8, R8::L>;
+    table[0x11E] = &Cpu::rr_hla;
+    table[0x11F] = &Cpu::execute<&Cpu::rr_r8, R8::A>;
+    table[0x120] = &Cpu::execute<&Cpu::sla_r8, R8::B>;
+    table[0x121] = &Cpu::execute<&Cpu::sla_r8, R8::C>;
+    table[0x122] = &Cpu::execute<&Cpu::sla_r8, R8::D>;
+    table[0x123] = &Cpu::execute<&Cpu::sla_r8, R8::E>;
+    table[0x124] = &Cpu::execute<&Cpu::sla_r8, R8::H>;
+    table[0x125] = &Cpu::execute<&Cpu::sla_r8, R8::L>;
+    table[0x126] = &Cpu::sla_hla;
+    table[0x127] = &Cpu::execute<&Cpu::sla_r8, R8::A>;
+    table[0x128] = &Cpu::execute<&Cpu::sra_r8, R8::B>;
+    table[0x129] = &Cpu::execute<&Cpu::sra_r8, R8::C>;
+    table[0x12A] = &Cpu::execute<&Cpu::sra_r8, R8::D>;
+    table[0x12B] = &Cpu::execute<&Cpu::sra_r8, R8::E>;
+    table[0x12C] = &Cpu::execute<&Cpu::sra_r8, R8::H>;
+    table[0x12D] = &Cpu::execute<&Cpu::sra_r8, R8::L>;
+    table[0x12E] = &Cpu::sra_hla;
+    table[0x12F] = &Cpu::execute<&Cpu::sra_r8, R8::A>;
+    table[0x130] = &Cpu::execute<&Cpu::swap_r8, R8::B>;
+    table[0x131] = &Cpu::execute<&Cpu::swap_r8, R8::C>;
+    table[0x132] = &Cpu::execute<&Cpu::swap_r8, R8::D>;
+    table[0x133] = &Cpu::execute<&Cpu::swap_r8, R8::E>;
+    table[0x134] = &Cpu::execute<&Cpu::swap_r8, R8::H>;
+    table[0x135] = &Cpu::execute<&Cpu::swap_r8, R8::L>;
+    table[0x136] = &Cpu::swap_hla;
+    table[0x137] = &Cpu::execute<&Cpu::swap_r8, R8::A>;
+    table[0x138] = &Cpu::execute<&Cpu::srl_r8, R8::B>;
+    table[0x139] = &Cpu::execute<&Cpu::srl_r8, R8::C>;
+    table[0x13A] = &Cpu::execute<&Cpu::srl_r8, R8::D>;
+    table[0x13B] = &Cpu::execute<&Cpu::srl_r8, R8::E>;
+    table[0x13C] = &Cpu::execute<&Cpu::srl_r8, R8::H>;
+    table[0x13D] = &Cpu::execute<&Cpu::srl_r8, R8::L>;
+    table[0x13E] = &Cpu::srl_hla;
+    table[0x13F] = &Cpu::execute<&Cpu::srl_r8, R8::A>;
+    table[0x140] = &Cpu::execute<&Cpu::bit_r8, 0, R8::B>;
+    table[0x141] = &Cpu::execute<&Cpu::bit_r8, 0, R8::C>;
+    table[0x142] = &Cpu::execute<&Cpu::bit_r8, 0, R8::D>;
+    table[0x143] = &Cpu::execute<&Cpu::bit_r8, 0, R8::E>;
+    table[0x144] = &Cpu::execute<&Cpu::bit_r8, 0, R8::H>;
+    table[0x145] = &Cpu::execute<&Cpu::bit_r8, 0, R8::L>;
+    table[0x146] = &Cpu::execute<&Cpu::bit_hla, 0>;
+    table[0x147] = &Cpu::execute<&Cpu::bit_r8, 0, R8::A>;
+    table[0x148] = &Cpu::execute<&Cpu::bit_r8, 1, R8::B>;
+    table[0x149] = &Cpu::execute<&Cpu::bit_r8, 1, R8::C>;
+    table[0x14A] = &Cpu::execute<&Cpu::bit_r8, 1, R8::D>;
+    table[0x14B] = &Cpu::execute<&Cpu::bit_r8, 1, R8::E>;
+    table[0x14C] = &Cpu::execute<&Cpu::bit_r8, 1, R8::H>;
+    table[0x14D] = &Cpu::execute<&Cpu::bit_r8, 1, R8::L>;
+    table[0x14E] = &Cpu::execute<&Cpu::bit_hla, 1>;
+    table[0x14F] = &Cpu::execute<&Cpu::bit_r8, 1, R8::A>;
+    table[0x150] = &Cpu::execute<&Cpu::bit_r8, 2, R8::B>;
+    table[0x151] = &Cpu::execute<&Cpu::bit_r8, 2, R8::C>;
+    table[0x152] = &Cpu::execute<&Cpu::bit_r8, 2, R8::D>;
+    table[0x153] = &Cpu::execute<&Cpu::bit_r8, 2, R8::E>;
+    table[0x154] = &Cpu::execute<&Cpu::bit_r8, 2, R8::H>;
+    table[0x155] = &Cpu::execute<&Cpu::bit_r8, 2, R8::L>;
+    table[0x156] = &Cpu::execute<&Cpu::bit_hla, 2>;
+    table[0x157] = &Cpu::execute<&Cpu::bit_r8, 2, R8::A>;
+    table[0x158] = &Cpu::execute<&Cpu::bit_r8, 3, R8::B>;
+    table[0x159] = &Cpu::execute<&Cpu::bit_r8, 3, R8::C>;
+    table[0x15A] = &Cpu::execute<&Cpu::bit_r8, 3, R8::D>;
+    table[0x15B] = &Cpu::execute<&Cpu::bit_r8, 3, R8::E>;
+    table[0x15C] = &Cpu::execute<&Cpu::bit_r8, 3, R8::H>;
+    table[0x15D] = &Cpu::execute<&Cpu::bit_r8, 3, R8::L>;
+    table[0x15E] = &Cpu::execute<&Cpu::bit_hla, 3>;
+    table[0x15F] = &Cpu::execute<&Cpu::bit_r8, 3, R8::A>;
+    table[0x160] = &Cpu::execute<&Cpu::bit_r8, 4, R8::B>;
+    table[0x161] = &Cpu::execute<&Cpu::bit_r8, 4, R8::C>;
+    table[0x162] = &Cpu::execute<&Cpu::bit_r8, 4, R8::D>;
+    table[0x163] = &Cpu::execute<&Cpu::bit_r8, 4, R8::E>;
+    table[0x164] = &Cpu::execute<&Cpu::bit_r8, 4, R8::H>;
+    table[0x165] = &Cpu::execute<&Cpu::bit_r8, 4, R8::L>;
+    table[0x166] = &Cpu::execute<&Cpu::bit_hla, 4>;
+    table[0x167] = &Cpu::execute<&Cpu::bit_r8, 4, R8::A>;
+    table[0x168] = &Cpu::execute<&Cpu::bit_r8, 5, R8::B>;
+    table[0x169] = &Cpu::execute<&Cpu::bit_r8, 5, R8::C>;
+    table[0x16A] = &Cpu::execute<&Cpu::bit_r8, 5, R8::D>;
+    table[0x16B] = &Cpu::execute<&Cpu::bit_r8, 5, R8::E>;
+    table[0x16C] = &Cpu::execute<&Cpu::bit_r8, 5, R8::H>;
+    table[0x16D] = &Cpu::execute<&Cpu::bit_r8, 5, R8::L>;
+    table[0x16E] = &Cpu::execute<&Cpu::bit_hla, 5>;
+    table[0x16F] = &Cpu::execute<&Cpu::bit_r8, 5, R8::A>;
+    table[0x170] = &Cpu::execute<&Cpu::bit_r8, 6, R8::B>;
+    table[0x171] = &Cpu::execute<&Cpu::bit_r8, 6, R8::C>;
+    table[0x172] = &Cpu::execute<&Cpu::bit_r8, 6, R8::D>;
+    table[0x173] = &Cpu::execute<&Cpu::bit_r8, 6, R8::E>;
+    table[0x174] = &Cpu::execute<&Cpu::bit_r8, 6, R8::H>;
+    table[0x175] = &Cpu::execute<&Cpu::bit_r8, 6, R8::L>;
+    table[0x176] = &Cpu::execute<&Cpu::bit_hla, 6>;
+    table[0x177] = &Cpu::execute<&Cpu::bit_r8, 6, R8::A>;
+    table[0x178] = &Cpu::execute<&Cpu::bit_r8, 7, R8::B>;
+    table[0x179] = &Cpu::execute<&Cpu::bit_r8, 7, R8::C>;
+    table[0x17A] = &Cpu::execute<&Cpu::bit_r8, 7, R8::D>;
+    table[0x17B] = &Cpu::execute<&Cpu::bit_r8, 7, R8::E>;
+    table[0x17C] = &Cpu::execute<&Cpu::bit_r8, 7, R8::H>;
+    table[0x17D] = &Cpu::execute<&Cpu::bit_r8, 7, R8::L>;
+    table[0x17E] = &Cpu::execute<&Cpu::bit_hla, 7>;
+    table[0x17F] = &Cpu::execute<&Cpu::bit_r8, 7, R8::A>;
+    table[0x180] = &Cpu::execute<&Cpu::res_r8, 0, R8::B>;
+    table[0x181] = &Cpu::execute<&Cpu::res_r8, 0, R8::C>;
+    table[0x182] = &Cpu::execute<&Cpu::res_r8, 0, R8::D>;
+    table[0x183] = &Cpu::execute<&Cpu::res_r8, 0, R8::E>;
+    table[0x184] = &Cpu::execute<&Cpu::res_r8, 0, R8::H>;
+    table[0x185] = &Cpu::execute<&Cpu::res_r8, 0, R8::L>;
+    table[0x186] = &Cpu::execute<&Cpu::res_hla, 0>;
+    table[0x187] = &Cpu::execute<&Cpu::res_r8, 0, R8::A>;
+    table[0x188] = &Cpu::execute<&Cpu::res_r8, 1, R8::B>;
+    table[0x189] = &Cpu::execute<&Cpu::res_r8, 1, R8::C>;
+    table[0x18A] = &Cpu::execute<&Cpu::res_r8, 1, R8::D>;
+    table[0x18B] = &Cpu::execute<&Cpu::res_r8, 1, R8::E>;
+    table[0x18C] = &Cpu::execute<&Cpu::res_r8, 1, R8::H>;
+    table[0x18D] = &Cpu::execute<&Cpu::res_r8, 1, R8::L>;
+    table[0x18E] = &Cpu::execute<&Cpu::res_hla, 1>;
+    table[0x18F] = &Cpu::execute<&Cpu::res_r8, 1, R8::A>;
+    table[0x190] = &Cpu::execute<&Cpu::res_r8, 2, R8::B>;
+    table[0x191] = &Cpu::execute<&Cpu::res_r8, 2, R8::C>;
+    table[0x192] = &Cpu::execute<&Cpu::res_r8, 2, R8::D>;
+    table[0x193] = &Cpu::execute<&Cpu::res_r8, 2, R8::E>;
+    table[0x194] = &Cpu::execute<&Cpu::res_r8, 2, R8::H>;
+    table[0x195] = &Cpu::execute<&Cpu::res_r8, 2, R8::L>;
+    table[0x196] = &Cpu::execute<&Cpu::res_hla, 2>;
+    table[0x197] = &Cpu::execute<&Cpu::res_r8, 2, R8::A>;
+    table[0x198] = &Cpu::execute<&Cpu::res_r8, 3, R8::B>;
+    table[0x199] = &Cpu::execute<&Cpu::res_r8, 3, R8::C>;
+    table[0x19A] = &Cpu::execute<&Cpu::res_r8, 3, R8::D>;
+    table[0x19B] = &Cpu::execute<&Cpu::res_r8, 3, R8::E>;
+    table[0x19C] = &Cpu::execute<&Cpu::res_r8, 3, R8::H>;
+    table[0x19D] = &Cpu::execute<&Cpu::res_r8, 3, R8::L>;
+    table[0x19E] = &Cpu::execute<&Cpu::res_hla, 3>;
+    table[0x19F] = &Cpu::execute<&Cpu::res_r8, 3, R8::A>;
+    table[0x1A0] = &Cpu::execute<&Cpu::res_r8, 4, R8::B>;
+    table[0x1A1] = &Cpu::execute<&Cpu::res_r8, 4, R8::C>;
+    table[0x1A2] = &Cpu::execute<&Cpu::res_r8, 4, R8::D>;
+    table[0x1A3] = &Cpu::execute<&Cpu::res_r8, 4, R8::E>;
+    table[0x1A4] = &Cpu::execute<&Cpu::res_r8, 4, R8::H>;
+    table[0x1A5] = &Cpu::execute<&Cpu::res_r8, 4, R8::L>;
+    table[0x1A6] = &Cpu::execute<&Cpu::res_hla, 4>;
+    table[0x1A7] = &Cpu::execute<&Cpu::res_r8, 4, R8::A>;
+    table[0x1A8] = &Cpu::execute<&Cpu::res_r8, 5, R8::B>;
+    table[0x1A9] = &Cpu::execute<&Cpu::res_r8, 5, R8::C>;
+    table[0x1AA] = &Cpu::execute<&Cpu::res_r8, 5, R8::D>;
+    table[0x1AB] = &Cpu::execute<&Cpu::res_r8, 5, R8::E>;
+    table[0x1AC] = &Cpu::execute<&Cpu::res_r8, 5, R8::H>;
+    table[0x1AD] = &Cpu::execute<&Cpu::res_r8, 5, R8::L>;
+    table[0x1AE] = &Cpu::execute<&Cpu::res_hla, 5>;
+    table[0x1AF] = &Cpu::execute<&Cpu::res_r8, 5, R8::A>;
+    table[0x1B0] = &Cpu::execute<&Cpu::res_r8, 6, R8::B>;
+    table[0x1B1] = &Cpu::execute<&Cpu::res_r8, 6, R8::C>;
+    table[0x1B2] = &Cpu::execute<&Cpu::res_r8, 6, R8::D>;
+    table[0x1B3] = &Cpu::execute<&Cpu::res_r8, 6, R8::E>;
+    table[0x1B4] = &Cpu::execute<&Cpu::res_r8, 6, R8::H>;
+    table[0x1B5] = &Cpu::execute<&Cpu::res_r8, 6, R8::L>;
+    table[0x1B6] = &Cpu::execute<&Cpu::res_hla, 6>;
+    table[0x1B7] = &Cpu::execute<&Cpu::res_r8, 6, R8::A>;
+    table[0x1B8] = &Cpu::execute<&Cpu::res_r8, 7, R8::B>;
+    table[0x1B9] = &Cpu::execute<&Cpu::res_r8, 7, R8::C>;
+    table[0x1BA] = &Cpu::execute<&Cpu::res_r8, 7, R8::D>;
+    table[0x1BB] = &Cpu::execute<&Cpu::res_r8, 7, R8::E>;
+    table[0x1BC] = &Cpu::execute<&Cpu::res_r8, 7, R8::H>;
+    table[0x1BD] = &Cpu::execute<&Cpu::res_r8, 7, R8::L>;
+    table[0x1BE] = &Cpu::execute<&Cpu::res_hla, 7>;
+    table[0x1BF] = &Cpu::execute<&Cpu::res_r8, 7, R8::A>;
+    table[0x1C0] = &Cpu::execute<&Cpu::set_r8, 0, R8::B>;
+    table[0x1C1] = &Cpu::execute<&Cpu::set_r8, 0, R8::C>;
+    table[0x1C2] = &Cpu::execute<&Cpu::set_r8, 0, R8::D>;
+    table[0x1C3] = &Cpu::execute<&Cpu::set_r8, 0, R8::E>;
+    table[0x1C4] = &Cpu::execute<&Cpu::set_r8, 0, R8::H>;
+    table[0x1C5] = &Cpu::execute<&Cpu::set_r8, 0, R8::L>;
+    table[0x1C6] = &Cpu::execute<&Cpu::set_hla, 0>;
+    table[0x1C7] = &Cpu::execute<&Cpu::set_r8, 0, R8::A>;
+    table[0x1C8] = &Cpu::execute<&Cpu::set_r8, 1, R8::B>;
+    table[0x1C9] = &Cpu::execute<&Cpu::set_r8, 1, R8::C>;
+    table[0x1CA] = &Cpu::execute<&Cpu::set_r8, 1, R8::D>;
+    table[0x1CB] = &Cpu::execute<&Cpu::set_r8, 1, R8::E>;
+    table[0x1CC] = &Cpu::execute<&Cpu::set_r8, 1, R8::H>;
+    table[0x1CD] = &Cpu::execute<&Cpu::set_r8, 1, R8::L>;
+    table[0x1CE] = &Cpu::execute<&Cpu::set_hla, 1>;
+    table[0x1CF] = &Cpu::execute<&Cpu::set_r8, 1, R8::A>;
+    table[0x1D0] = &Cpu::execute<&Cpu::set_r8, 2, R8::B>;
+    table[0x1D1] = &Cpu::execute<&Cpu::set_r8, 2, R8::C>;
+    table[0x1D2] = &Cpu::execute<&Cpu::set_r8, 2, R8::D>;
+    table[0x1D3] = &Cpu::execute<&Cpu::set_r8, 2, R8::E>;
+    table[0x1D4] = &Cpu::execute<&Cpu::set_r8, 2, R8::H>;
+    table[0x1D5] = &Cpu::execute<&Cpu::set_r8, 2, R8::L>;
+    table[0x1D6] = &Cpu::execute<&Cpu::set_hla, 2>;
+    table[0x1D7] = &Cpu::execute<&Cpu::set_r8, 2, R8::A>;
+    table[0x1D8] = &Cpu::execute<&Cpu::set_r8, 3, R8::B>;
+    table[0x1D9] = &Cpu::execute<&Cpu::set_r8, 3, R8::C>;
+    table[0x1DA] = &Cpu::execute<&Cpu::set_r8, 3, R8::D>;
+    table[0x1DB] = &Cpu::execute<&Cpu::set_r8, 3, R8::E>;
+    table[0x1DC] = &Cpu::execute<&Cpu::set_r8, 3, R8::H>;
+    table[0x1DD] = &Cpu::execute<&Cpu::set_r8, 3, R8::L>;
+    table[0x1DE] = &Cpu::execute<&Cpu::set_hla, 3>;
+    table[0x1DF] = &Cpu::execute<&Cpu::set_r8, 3, R8::A>;
+    table[0x1E0] = &Cpu::execute<&Cpu::set_r8, 4, R8::B>;
+    table[0x1E1] = &Cpu::execute<&Cpu::set_r8, 4, R8::C>;
+    table[0x1E2] = &Cpu::execute<&Cpu::set_r8, 4, R8::D>;
+    table[0x1E3] = &Cpu::execute<&Cpu::set_r8, 4, R8::E>;
+    table[0x1E4] = &Cpu::execute<&Cpu::set_r8, 4, R8::H>;
+    table[0x1E5] = &Cpu::execute<&Cpu::set_r8, 4, R8::L>;
+    table[0x1E6] = &Cpu::execute<&Cpu::set_hla, 4>;
+    table[0x1E7] = &Cpu::execute<&Cpu::set_r8, 4, R8::A>;
+    table[0x1E8] = &Cpu::execute<&Cpu::set_r8, 5, R8::B>;
+    table[0x1E9] = &Cpu::execute<&Cpu::set_r8, 5, R8::C>;
+    table[0x1EA] = &Cpu::execute<&Cpu::set_r8, 5, R8::D>;
+    table[0x1EB] = &Cpu::execute<&Cpu::set_r8, 5, R8::E>;
+    table[0x1EC] = &Cpu::execute<&Cpu::set_r8, 5, R8::H>;
+    table[0x1ED] = &Cpu::execute<&Cpu::set_r8, 5, R8::L>;
+    table[0x1EE] = &Cpu::execute<&Cpu::set_hla, 5>;
+    table[0x1EF] = &Cpu::execute<&Cpu::set_r8, 5, R8::A>;
+    table[0x1F0] = &Cpu::execute<&Cpu::set_r8, 6, R8::B>;
+    table[0x1F1] = &Cpu::execute<&Cpu::set_r8, 6, R8::C>;
+    table[0x1F2] = &Cpu::execute<&Cpu::set_r8, 6, R8::D>;
+    table[0x1F3] = &Cpu::execute<&Cpu::set_r8, 6, R8::E>;
+    table[0x1F4] = &Cpu::execute<&Cpu::set_r8, 6, R8::H>;
+    table[0x1F5] = &Cpu::execute<&Cpu::set_r8, 6, R8::L>;
+    table[0x1F6] = &Cpu::execute<&Cpu::set_hla, 6>;
+    table[0x1F7] = &Cpu::execute<&Cpu::set_r8, 6, R8::A>;
+    table[0x1F8] = &Cpu::execute<&Cpu::set_r8, 7, R8::B>;
+    table[0x1F9] = &Cpu::execute<&Cpu::set_r8, 7, R8::C>;
+    table[0x1FA] = &Cpu::execute<&Cpu::set_r8, 7, R8::D>;
+    table[0x1FB] = &Cpu::execute<&Cpu::set_r8, 7, R8::E>;
+    table[0x1FC] = &Cpu::execute<&Cpu::set_r8, 7, R8::H>;
+    table[0x1FD] = &Cpu::execute<&Cpu::set_r8, 7, R8::L>;
+    table[0x1FE] = &Cpu::execute<&Cpu::set_hla, 7>;
+    table[0x1FF] = &Cpu::execute<&Cpu::set_r8, 7, R8::A>;
+
+    return table;
+}
+
+constexpr Cpu::InstructionTable Cpu::instruction_table =
+    make_instruction_table();
+
+template <u16 index>
+auto Cpu::native_execute(Cpu *cpu) -> u64
+{
+    const u64 epoch = cpu->block_cache_.epoch();
+    const auto [new_pc, cycles_used] = (cpu->*instruction_table[index])();
+    cpu->pc_ = new_pc;
+    cpu->scheduler_->elapse(cycles_used);
+    cpu->materialize_flags();
+    const bool invalidated = cpu->block_cache_.epoch() != epoch;
+    return static_cast<u64>(invalidated) << 32 |
+           static_cast<u64>(new_pc) << 16 | cycles_used;
+}
+
+template <size_t... indices>
+constexpr auto Cpu::make_native_handlers(
+    std::index_sequence<indices...> /*sequence*/)
+    -> std::array<NativeHandler, 512>
+{
+    return {&Cpu::native_execute<indices>...};
+}
+
+constexpr std::array<Cpu::NativeHandler, 512> Cpu::native_handlers =
+    make_native_handlers(std::make_index_sequence<512>());
+
+auto Cpu::run_core(u64 budget) -> u64
+{
+    switch (core_) {
+    case Core::Table: return run_table(budget);
+    case Core::Switch: return run_switch(budget);
+    case Core::Threaded: return run_threaded(budget);
+    case Core::Cached: return run_cached(budget);
+    case Core::Jit: return jit_.run(*this, budget);
+    }
+    return 0;
+}
+
+auto Cpu::service_interrupts() -> u8
+{
+    if (locked_) {
+        return 0;
+    }
+    const u8 interrupt_flag = memory_->read_io(0x0F);
+    const u8 pending = memory_->read_io(0xFF) & interrupt_flag & 0x1F;
+    if (pending == 0) {
+        return 0;
+    }
+
+    // A pending interrupt wakes the CPU even when interrupts are disabled
+    halted_ = false;
+    if (!ime_) {
+        return 0;
+    }
+
+    // Lower bits take priority: VBlank, STAT, timer, serial, joypad
+    const int bit = std::countr_zero(pending);
+    memory_->write_io(0x0F, interrupt_flag & ~(1 << bit));
+    ime_ = false;
+
+    sp_ -= 2;
+    memory_->write(sp_ + 1, pc_.hi());
+    memory_->write(sp_, pc_.lo());
+    pc_ = static_cast<u16>(0x40 + bit * 8);
+    return 5;
+}
+
+auto Cpu::yields(u16 index) -> bool
+{
+    switch (index) {
+    case 0x010: // stop
+    case 0x076: // halt
+    case 0x0D9: // reti
+    case 0x0FB: // ei
+        return true;
+    default: return false;
+    }
+}
+
+auto Cpu::is_conditional_jump(u16 index) -> bool
+{
+    switch (index) {
+    case 0x020:
+    case 0x028:
+    case 0x030:
+    case 0x038: // jr cc, s8
+    case 0x0C2:
+    case 0x0CA:
+    case 0x0D2:
+    case 0x0DA: // jp cc, a16
+        return true;
+    default: return false;
+    }
+}
+
+auto Cpu::run_table(u64 budget) -> u64
+{
+    // Slices end on events, often inside the idle loop waiting for them
+    u64 cycles = 0;
+    skip_idle_block(budget, cycles);
+    u64 instructions = 0;
+    while (cycles < budget && !yield_) {
+        const u8 opcode = fetch();
+        const auto [new_pc, cycles_used] = decode_execute(opcode);
+        const bool back = new_pc < pc_ && is_conditional_jump(opcode);
+        pc_ = new_pc;
+        cycles += cycles_used;
+        scheduler_->elapse(cycles_used);
+        instructions++;
+        if (back) {
+            skip_idle_block(budget, cycles);
+        }
+    }
+    instructions_ += instructions;
+    return cycles;
+}
+
+// Expand X for every instruction table index, 0x000 to 0x1FF
+#define TOMBOY_OPCODES_16(X, prefix)                                           \
+    X(prefix##0) X(prefix##1) X(prefix##2) X(prefix##3) X(prefix##4)          \
+    X(prefix##5) X(prefix##6) X(prefix##7) X(prefix##8) X(prefix##9)          \
+    X(prefix##A) X(prefix##B) X(prefix##C) X(prefix##D) X(prefix##E)          \
+    X(prefix##F)
+#define TOMBOY_OPCODES_256(X, prefix)                                          \
+    TOMBOY_OPCODES_16(X, prefix##0) TOMBOY_OPCODES_16(X, prefix##1)            \
+    TOMBOY_OPCODES_16(X, prefix##2) TOMBOY_OPCODES_16(X, prefix##3)            \
+    TOMBOY_OPCODES_16(X, prefix##4) TOMBOY_OPCODES_16(X, prefix##5)            \
+    TOMBOY_OPCODES_16(X, prefix##6) TOMBOY_OPCODES_16(X, prefix##7)            \
+    TOMBOY_OPCODES_16(X, prefix##8) TOMBOY_OPCODES_16(X, prefix##9)            \
+    TOMBOY_OPCODES_16(X, prefix##A) TOMBOY_OPCODES_16(X, prefix##B)            \
+    TOMBOY_OPCODES_16(X, prefix##C) TOMBOY_OPCODES_16(X, prefix##D)            \
+    TOMBOY_OPCODES_16(X, prefix##E) TOMBOY_OPCODES_16(X, prefix##F)
+#define TOMBOY_OPCODES(X) TOMBOY_OPCODES_256(X, 0x0) TOMBOY_OPCODES_256(X, 0x1)
+
+#if defined(__GNUC__)
+auto Cpu::run_threaded(u64 budget) -> u64
+{
+#define TOMBOY_THREADED_LABEL(index) &&op_##index,
+    static const void *const labels[] = {TOMBOY_OPCODES(TOMBOY_THREADED_LABEL)};
+#undef TOMBOY_THREADED_LABEL
+
+    u64 cycles = 0;
+    skip_idle_block(budget, cycles);
+    u64 instructions = 0;
+    ExecuteResult result{};
+
+#define TOMBOY_THREADED_DISPATCH()                                             \
+    if (cycles >= budget || yield_) {                                          \
+        instructions_ += instructions;                                         \
+        return cycles;                                                         \
+    }                                                                          \
+    goto *labels[memory_->read(pc_)]
+
+    // The prefix label jumps straight into the prefixed half of the table, all
+    // other labels call their handler, whose table entry is known at compile
+    // time, then dispatch the next instruction themselves.
+#define TOMBOY_THREADED_HANDLER(index)                                         \
+    op_##index:                                                                \
+    if constexpr ((index) == 0x0CB) {                                          \
+        goto *labels[0x100 | memory_->read(pc_ + 1)];                          \
+    }                                                                          \
+    else {                                                                     \
+        result = (this->*instruction_table[index])();                          \
+        const bool back = is_conditional_jump(index) && result.new_pc < pc_;   \
+        pc_ = result.new_pc;                                                   \
+        cycles += result.cycles_used;                                          \
+        scheduler_->elapse(result.cycles_used);                                \
+        instructions++;                                                        \
+        if (back) {                                                            \
+            skip_idle_block(budget, cycles);                                   \
+        }                                                                      \
+        TOMBOY_THREADED_DISPATCH();                                            \
+    }
+
+    TOMBOY_THREADED_DISPATCH();
+    TOMBOY_OPCODES(TOMBOY_THREADED_HANDLER)
+
+#undef TOMBOY_THREADED_HANDLER
+#undef TOMBOY_THREADED_DISPATCH
+    return cycles;
+}
+#else
+auto Cpu::run_threaded(u64 budget) -> u64
+{
+    // Labels as values are unavailable, fall back to the table core
+    return run_table(budget);
+}
+#endif
+
+auto Cpu::run_switch(u64 budget) -> u64
+{
+    u64 cycles = 0;
+    skip_idle_block(budget, cycles);
+    u64 instructions = 0;
+    while (cycles < budget && !yield_) {
+        const u8 opcode = memory_->read(pc_);
+        const bool has_prefix = opcode == 0xCB;
+        const auto [new_pc, cycles_used] = decode_execute_switch(
+            has_prefix ? memory_->read(pc_ + 1) : opcode, has_prefix);
+        const bool back = new_pc < pc_ && is_conditional_jump(opcode);
+        pc_ = new_pc;
+        cycles += cycles_used;
+        scheduler_->elapse(cycles_used);
+        instructions++;
+        if (back) {
+            skip_idle_block(budget, cycles);
+        }
+    }
+    instructions_ += instructions;
+    return cycles;
+}
+
+#undef TOMBOY_OPCODES
+#undef TOMBOY_OPCODES_256
+#undef TOMBOY_OPCODES_16
+
+auto Cpu::run_cached(u64 budget) -> u64
+{
+    u64 cycles = 0;
+    while (cycles < budget && !yield_) {
+        // A write may drop the block, copy what is needed up front
+        const BlockCache::Block &block = find_block(pc_);
+        const u16 address = block.address;
+        const bool idle = block.idle;
+        const size_t count = block.instructions.size();
+
+        const u64 start = cycles;
+        const u64 executed = execute_block(block, budget, cycles);
+        instructions_ += executed;
+        if (idle && executed == count && pc_ == address) {
+            skip_idle_loop(cycles - start, executed, budget, cycles);
         }
     }
+    return cycles;
+}
+
+auto Cpu::find_block(u16 address) -> const BlockCache::Block &
+{
+    const BlockCache::Block *block =
+        block_cache_.find(memory_->bank(address), address);
+    return block != nullptr ? *block
+                            : block_cache_.insert(decode_block(address));
+}
+
+auto Cpu::execute_block(const BlockCache::Block &block, u64 budget,
+    u64 &cycles) -> u64
+{
+    // A write may drop the running block or switch the bank it runs from,
+    // stop touching it once the cache epoch changes
+    const u64 epoch = block_cache_.epoch();
+    const size_t count = block.instructions.size();
+    u64 executed = 0;
+    for (size_t i = 0; i < count && cycles < budget; i++) {
+        const auto [index, length] = block.instructions[i];
+        const auto next_pc = static_cast<u16>(pc_ + length);
+        const auto [new_pc, cycles_used] = (this->*instruction_table[index])();
+        pc_ = new_pc;
+        cycles += cycles_used;
+        scheduler_->elapse(cycles_used);
+        executed++;
+        if (new_pc != next_pc || block_cache_.epoch() != epoch) {
+            break;
+        }
+    }
+    return executed;
+}
+
+auto Cpu::decode_block(u16 address) const -> BlockCache::Block
+{
+    BlockCache::Block block{
+        .bank = memory_->bank(address),
+        .address = address,
+        .size = 0,
+        .idle = false,
+        .instructions = {},
+    };
+    while (block.instructions.size() < max_block_instructions) {
+        const u8 opcode = memory_->read(address);
+        const u16 index =
+            opcode == 0xCB ? 0x100 | memory_->read(address + 1) : opcode;
+        const u8 length = instruction_lengths[opcode];
+        block.instructions.push_back({.index = index, .length = length});
+        block.size += length;
+        address += length;
+        if (ends_block(index) || instruction_table[index] == &Cpu::invalid) {
+            break;
+        }
+    }
+    block.idle = is_idle_loop(block);
+    return block;
+}
+
+auto Cpu::is_idle_loop(const BlockCache::Block &block) const -> bool
+{
+    // Registers that only change on scheduled events or between frames
+    constexpr auto polled = [](u16 address) {
+        return address == 0xFF00 || address == 0xFF0F || address == 0xFF41 ||
+               address == 0xFF44;
+    };
+
+    // The first instruction loads the register into A, the rest only derive
+    // flags from A, and the last branches back to the start. Each iteration
+    // then overwrites everything it changes with values that depend only on
+    // the register.
+    u16 address = block.address;
+    for (size_t i = 0; i < block.instructions.size(); i++) {
+        const auto [index, length] = block.instructions[i];
+        const bool first = i == 0;
+        const bool last = i + 1 == block.instructions.size();
+        const u16 next = address + length;
+        switch (index) {
+        case 0x0F0: // ldh a, (a8)
+            if (!first || !polled(0xFF00 + memory_->read(address + 1))) {
+                return false;
+            }
+            break;
+        case 0x0FA: // ld a, (a16)
+            if (!first || !polled(memory_->read(address + 1) |
+                                  memory_->read(address + 2) << 8)) {
+                return false;
+            }
+            break;
+        case 0x0E6: // and n8
+        case 0x0EE: // xor n8
+        case 0x0F6: // or n8
+        case 0x0FE: // cp n8
+        case 0x0B8:
+        case 0x0B9:
+        case 0x0BA:
+        case 0x0BB:
+        case 0x0BC:
+        case 0x0BD:
+        case 0x0BF: // cp r8
+        case 0x147:
+        case 0x14F:
+        case 0x157:
+        case 0x15F:
+        case 0x167:
+        case 0x16F:
+        case 0x177:
+        case 0x17F: // bit b, a
+            if (first || last) {
+                return false;
+            }
+            break;
+        case 0x020:
+        case 0x028:
+        case 0x030:
+        case 0x038: // jr cc, s8
+            return last && !first &&
+                   static_cast<u16>(next + static_cast<i8>(
+                                        memory_->read(address + 1))) ==
+                       block.address;
+        case 0x0C2:
+        case 0x0CA:
+        case 0x0D2:
+        case 0x0DA: // jp cc, a16
+            return last && !first &&
+                   (memory_->read(address + 1) |
+                       memory_->read(address + 2) << 8) == block.address;
+        default: return false;
+        }
+        address = next;
+    }
+    return false;
+}
+
+auto Cpu::skip_idle_loop(u64 loop_cycles, u64 loop_instructions, u64 budget,
+    u64 &cycles) -> void
+{
+    // The polled register cannot change before the next event, which is at or
+    // after budget, so the iterations up to it are identical
+    if (cycles + loop_cycles >= budget) {
+        return;
+    }
+    const u64 iterations = (budget - cycles - 1) / loop_cycles;
+    cycles += iterations * loop_cycles;
+    scheduler_->elapse(iterations * loop_cycles);
+    instructions_ += iterations * loop_instructions;
+    idle_cycles_ += iterations * loop_cycles;
+}
+
+auto Cpu::skip_idle_block(u64 budget, u64 &cycles) -> void
+{
+    // Idle loops start by loading the polled register, most loops are ruled
+    // out on that without looking a block up
+    const u8 opcode = memory_->read(pc_);
+    if ((opcode != 0xF0 && opcode != 0xFA) || cycles >= budget) {
+        return;
+    }
+    const BlockCache::Block &block = find_block(pc_);
+    if (!block.idle) {
+        return;
+    }
+    const u16 address = block.address;
+    const size_t count = block.instructions.size();
+    const u64 start = cycles;
+    const u64 executed = execute_block(block, budget, cycles);
+    instructions_ += executed;
+    if (executed == count && pc_ == address) {
+        skip_idle_loop(cycles - start, executed, budget, cycles);
+    }
+}
+
+auto Cpu::prefix() -> ExecuteResult
+{
+    return (this->*instruction_table[0x100 | memory_->read(pc_ + 1)])();
+}
+
+auto Cpu::invalid() -> ExecuteResult
+{
+    // Lock up in place for good, only the first report is worth printing.
+    // The cores return so run_for skips the remaining time like a halt.
+    if (!locked_) {
+        std::println(std::cerr, "Decode failed. Invalid opcode: 0x{:x}",
+            memory_->read(pc_));
+    }
+    locked_ = true;
+    halted_ = true;
+    yield_ = true;
+    return {.new_pc = pc_, .cycles_used = 1};
 }
 
 auto Cpu::ld_r8_r8(Register8 &reg1, const Register8 &reg2) -> ExecuteResult
@@ -778,7 +1949,7 @@ auto Cpu::add_hl_r16(const Register16 &reg) -> ExecuteResult
 {
     hl_ = add(hl_, reg);
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 2,
     };
 }
@@ -796,7 +1967,7 @@ auto Cpu::adc_r8(const Register8 &reg) -> ExecuteResult
 {
     af_.hi() = adc(af_.hi(), reg);
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 1,
     };
 }
@@ -805,7 +1976,7 @@ auto Cpu::adc_hla() -> ExecuteResult
 {
     af_.hi() = adc(af_.hi(), memory_->read(hl_));
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 2,
     };
 }
@@ -823,7 +1994,7 @@ auto Cpu::sub_r8(const Register8 &reg) -> ExecuteResult
 {
     af_.hi() = sub(af_.hi(), reg);
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 1,
     };
 }
@@ -832,7 +2003,7 @@ auto Cpu::sub_hla() -> ExecuteResult
 {
     af_.hi() = sub(af_.hi(), memory_->read(hl_));
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 2,
     };
 }
@@ -850,7 +2021,7 @@ auto Cpu::sbc_r8(const Register8 &reg) -> ExecuteResult
 {
     af_.hi() = sbc(af_.hi(), reg);
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 1,
     };
 }
@@ -859,7 +2030,7 @@ auto Cpu::sbc_hla() -> ExecuteResult
 {
     af_.hi() = sbc(af_.hi(), memory_->read(hl_));
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 2,
     };
 }
@@ -868,7 +2039,7 @@ auto Cpu::cp_n8() -> ExecuteResult
 {
     cp(af_.hi(), memory_->read(pc_ + 1));
     return {
-        .new_pc = static_cast<u8>(pc_ + 2),
+        .new_pc = static_cast<u16>(pc_ + 2),
         .cycles_used = 2,
     };
 }
@@ -877,7 +2048,7 @@ auto Cpu::cp_r8(const Register8 &reg) -> ExecuteResult
 {
     cp(af_.hi(), reg);
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 1,
     };
 }
@@ -886,7 +2057,7 @@ auto Cpu::cp_hla() -> ExecuteResult
 {
     cp(af_.hi(), memory_->read(hl_));
     return {
-        .new_pc = static_cast<u8>(pc_ + 1),
+        .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 2,
     };
 }
@@ -1120,7 +2291,7 @@ auto Cpu::rrc_r8(Register8 &reg) -> ExecuteResult
 
 auto Cpu::rrc_a() -> ExecuteResult
 {
-    af_.hi() = rlc(af_.hi());
+    af_.hi() = rrc(af_.hi());
     set_flag(Flag::Zero, false);
     return {
         .new_pc = static_cast<u16>(pc_ + 1),
@@ -1387,6 +2558,7 @@ auto Cpu::ret_cc(Flag flag, bool value) -> ExecuteResult
 auto Cpu::reti() -> ExecuteResult
 {
     ime_ = true;
+    yield_ = true;
     return ret();
 }
 
@@ -1470,6 +2642,12 @@ auto Cpu::push_r16(const Register16 &reg) -> ExecuteResult
     };
 }
 
+auto Cpu::push_af() -> ExecuteResult
+{
+    materialize_flags();
+    return push_r16(af_);
+}
+
 auto Cpu::pop_r16(Register16 &reg) -> ExecuteResult
 {
     reg = memory_->read(sp_) | memory_->read(sp_ + 1) << 8;
@@ -1480,6 +2658,12 @@ auto Cpu::pop_r16(Register16 &reg) -> ExecuteResult
     };
 }
 
+auto Cpu::pop_af() -> ExecuteResult
+{
+    flag_op_ = FlagOp::None;
+    return pop_r16(af_);
+}
+
 auto Cpu::ccf() -> ExecuteResult
 {
     set_flag(Flag::Subtraction, false);
@@ -1505,6 +2689,7 @@ auto Cpu::scf() -> ExecuteResult
 auto Cpu::ei() -> ExecuteResult
 {
     ime_ = true;
+    yield_ = true;
     return {
         .new_pc = static_cast<u16>(pc_ + 1),
         .cycles_used = 1,
@@ -1523,9 +2708,10 @@ auto Cpu::di() -> ExecuteResult
 auto Cpu::halt() -> ExecuteResult
 {
     halted_ = true;
+    yield_ = true;
     return {
         .new_pc = static_cast<u16>(pc_ + 1),
-        .cycles_used = 0,
+        .cycles_used = 1,
     };
 }
 
@@ -1540,13 +2726,15 @@ auto Cpu::daa() -> ExecuteResult
         }
     }
     else {
-        if (get_flag(Flag::HalfCarry) || lo_nibble(af_.hi()) > 0x9) {
-            af_.hi() += 0x06;
-        }
-        if (get_flag(Flag::Carry) || af_.hi() > 0x99) {
+        // Both corrections are decided on the value before either is applied
+        const u8 value = af_.hi();
+        if (get_flag(Flag::Carry) || value > 0x99) {
             af_.hi() += 0x60;
             set_flag(Flag::Carry, true);
         }
+        if (get_flag(Flag::HalfCarry) || lo_nibble(value) > 0x9) {
+            af_.hi() += 0x06;
+        }
     }
     set_flag(Flag::Zero, af_.hi() == 0);
     set_flag(Flag::HalfCarry, false);
@@ -1567,6 +2755,7 @@ auto Cpu::nop() -> ExecuteResult
 auto Cpu::stop() -> ExecuteResult
 {
     halted_ = true;
+    yield_ = true;
     return {
         .new_pc = static_cast<u16>(pc_ + 2),
         .cycles_used = 1,
@@ -1575,23 +2764,88 @@ auto Cpu::stop() -> ExecuteResult
 
 auto Cpu::get_flag(Flag flag) const -> bool
 {
+    // Zero and carry are read by every conditional instruction, answer them
+    // without evaluating the other flags
+    if (flag_op_ != FlagOp::None) {
+        if (flag == Flag::Zero) {
+            return flag_result_ == 0;
+        }
+        if (flag == Flag::Carry) {
+            return flag_carry_;
+        }
+    }
     return static_cast<bool>(
-        af_.lo() & 1 << static_cast<std::underlying_type_t<Flag>>(flag));
+        flags() & 1 << static_cast<std::underlying_type_t<Flag>>(flag));
 }
 
 auto Cpu::set_flag(Flag flag, bool value) -> void
 {
+    materialize_flags();
     const auto offset = static_cast<std::underlying_type_t<Flag>>(flag);
-    af_.lo() = af_.lo() & ~(1 << offset) | static_cast<u8>(value) << offset;
+    af_.lo() =
+        (af_.lo() & ~(1 << offset)) | static_cast<u8>(value) << offset;
+}
+
+auto Cpu::set_lazy_flags(
+    FlagOp op, u8 lhs, u8 rhs, u8 result, bool carry, bool carry_in) -> void
+{
+    flag_op_ = op;
+    flag_lhs_ = lhs;
+    flag_rhs_ = rhs;
+    flag_result_ = result;
+    flag_carry_ = carry;
+    flag_carry_in_ = carry_in;
+    if constexpr (!lazy_flags) {
+        materialize_flags();
+    }
+}
+
+auto Cpu::flags() const -> u8
+{
+    const u8 lhs = flag_lhs_;
+    const u8 rhs = flag_rhs_;
+    bool subtraction = false;
+    bool half_carry = false;
+
+    switch (flag_op_) {
+    case FlagOp::None: return af_.lo();
+    case FlagOp::Add:
+        half_carry = lo_nibble(lhs) + lo_nibble(rhs) + flag_carry_in_ > 0xF;
+        break;
+    case FlagOp::Sub:
+        subtraction = true;
+        half_carry = lo_nibble(lhs) < lo_nibble(rhs);
+        break;
+    case FlagOp::Sbc:
+        subtraction = true;
+        half_carry = lo_nibble(lhs) < lo_nibble(rhs) + flag_carry_in_;
+        break;
+    case FlagOp::Inc: half_carry = lo_nibble(lhs) == 0xF; break;
+    case FlagOp::Dec:
+        subtraction = true;
+        half_carry = lo_nibble(lhs) == 0;
+        break;
+    case FlagOp::And: half_carry = true; break;
+    case FlagOp::Logic: break;
+    }
+
+    return static_cast<u8>(flag_result_ == 0) << 7 |
+           static_cast<u8>(subtraction) << 6 |
+           static_cast<u8>(half_carry) << 5 |
+           static_cast<u8>(flag_carry_) << 4 | lo_nibble(af_.lo());
+}
+
+auto Cpu::materialize_flags() -> void
+{
+    af_.lo() = flags();
+    flag_op_ = FlagOp::None;
 }
 
 auto Cpu::add(u8 lhs, u8 rhs) -> u8
 {
     const uint result = static_cast<uint>(lhs) + static_cast<uint>(rhs);
-    set_flag(Flag::Zero, (result & 0xFF) == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, lo_nibble(lhs) + lo_nibble(rhs) > 0xF);
-    set_flag(Flag::Carry, result > 0xFF);
+    set_lazy_flags(
+        FlagOp::Add, lhs, rhs, static_cast<u8>(result), result > 0xFF);
     return static_cast<u8>(result);
 }
 
@@ -1601,86 +2855,65 @@ auto Cpu::add(u16 lhs, u16 rhs) -> u16
     set_flag(Cpu::Flag::Subtraction, false);
     set_flag(Flag::HalfCarry, (lhs & 0xFFF) + (rhs & 0xFFF) > 0xFFF);
     set_flag(Cpu::Flag::Carry, result > 0xFFFF);
-    return static_cast<u8>(result);
+    return static_cast<u16>(result);
 }
 
 auto Cpu::adc(u8 lhs, u8 rhs) -> u8
 {
     const uint carry = static_cast<uint>(get_flag(Flag::Carry));
     const uint result = static_cast<uint>(lhs) + static_cast<uint>(rhs) + carry;
-    set_flag(Flag::Zero, (result & 0xFF) == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, lo_nibble(lhs) + lo_nibble(rhs) > 0xF);
-    set_flag(Flag::Carry, result > 0xFF);
+    set_lazy_flags(FlagOp::Add, lhs, rhs, static_cast<u8>(result),
+        result > 0xFF, carry != 0);
     return static_cast<u8>(result);
 }
 
 auto Cpu::sub(u8 lhs, u8 rhs) -> u8
 {
     const u8 result = lhs - rhs;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, true);
-    set_flag(Flag::HalfCarry, lo_nibble(lhs) < lo_nibble(rhs));
-    set_flag(Flag::Carry, lhs < rhs);
+    set_lazy_flags(FlagOp::Sub, lhs, rhs, result, lhs < rhs);
     return result;
 }
 
 auto Cpu::sbc(u8 lhs, u8 rhs) -> u8
 {
-    const u8 carry = static_cast<u8>(get_flag(Flag::Carry));
-    const u8 result = lhs - rhs - carry;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, true);
-    set_flag(Flag::HalfCarry, lo_nibble(lhs) < lo_nibble(rhs) + carry);
-    set_flag(Flag::Carry, lhs < rhs + carry);
+    const bool carry = get_flag(Flag::Carry);
+    const u8 result = lhs - rhs - static_cast<u8>(carry);
+    set_lazy_flags(FlagOp::Sbc, lhs, rhs, result, lhs < rhs + carry, carry);
     return result;
 }
 
 auto Cpu::inc(u8 lhs) -> u8
 {
     const u8 result = lhs + 1;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, lo_nibble(lhs) == 0xF);
+    set_lazy_flags(FlagOp::Inc, lhs, 1, result, get_flag(Flag::Carry));
     return result;
 }
 
 auto Cpu::dec(u8 lhs) -> u8
 {
     const u8 result = lhs - 1;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, true);
-    set_flag(Flag::HalfCarry, lo_nibble(lhs) == 0);
+    set_lazy_flags(FlagOp::Dec, lhs, 1, result, get_flag(Flag::Carry));
     return result;
 }
 
 auto Cpu::bitwise_and(u8 lhs, u8 rhs) -> u8
 {
     const u8 result = lhs & rhs;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, true);
-    set_flag(Flag::Carry, false);
+    set_lazy_flags(FlagOp::And, lhs, rhs, result, false);
     return result;
 }
 
 auto Cpu::bitwise_xor(u8 lhs, u8 rhs) -> u8
 {
     const u8 result = lhs ^ rhs;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, false);
+    set_lazy_flags(FlagOp::Logic, lhs, rhs, result, false);
     return result;
 }
 
 auto Cpu::bitwise_or(u8 lhs, u8 rhs) -> u8
 {
     const u8 result = lhs | rhs;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, false);
+    set_lazy_flags(FlagOp::Logic, lhs, rhs, result, false);
     return result;
 }
 
@@ -1704,40 +2937,31 @@ auto Cpu::set(u8 bit, u8 value) -> u8
 auto Cpu::swap(u8 lhs) -> u8
 {
     const u8 result = (lhs << 4 & 0xF0) | (lhs >> 4 & 0x0F);
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, false);
+    set_lazy_flags(FlagOp::Logic, lhs, 0, result, false);
     return result;
 }
 
 auto Cpu::sla(u8 lhs) -> u8
 {
     const u8 result = lhs << 1;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, static_cast<bool>(lhs & 0x80));
+    set_lazy_flags(
+        FlagOp::Logic, lhs, 0, result, static_cast<bool>(lhs & 0x80));
     return result;
 }
 
 auto Cpu::sra(u8 lhs) -> u8
 {
     const u8 result = lhs >> 1 | (lhs & 0x80);
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, static_cast<bool>(lhs & 1));
+    set_lazy_flags(
+        FlagOp::Logic, lhs, 0, result, static_cast<bool>(lhs & 1));
     return result;
 }
 
 auto Cpu::srl(u8 lhs) -> u8
 {
     const u8 result = lhs >> 1;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, static_cast<bool>(lhs & 1));
+    set_lazy_flags(
+        FlagOp::Logic, lhs, 0, result, static_cast<bool>(lhs & 1));
     return result;
 }
 
@@ -1745,20 +2969,16 @@ auto Cpu::rl(u8 lhs) -> u8
 {
     const u8 carry = static_cast<u8>(get_flag(Flag::Carry));
     const u8 result = lhs << 1 | carry;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, static_cast<bool>(lhs & 0x80));
+    set_lazy_flags(
+        FlagOp::Logic, lhs, 0, result, static_cast<bool>(lhs & 0x80));
     return result;
 }
 
 auto Cpu::rlc(u8 lhs) -> u8
 {
     const u8 result = lhs << 1 | (lhs & 0x80) >> 7;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, static_cast<bool>(result & 1));
+    set_lazy_flags(
+        FlagOp::Logic, lhs, 0, result, static_cast<bool>(result & 1));
     return result;
 }
 
@@ -1766,29 +2986,21 @@ auto Cpu::rr(u8 lhs) -> u8
 {
     const u8 carry = static_cast<u8>(get_flag(Flag::Carry));
     const u8 result = lhs >> 1 | carry << 7;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, static_cast<bool>(lhs & 1));
+    set_lazy_flags(
+        FlagOp::Logic, lhs, 0, result, static_cast<bool>(lhs & 1));
     return result;
 }
 
 auto Cpu::rrc(u8 lhs) -> u8
 {
     const u8 result = lhs >> 1 | (lhs & 1) << 7;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, false);
-    set_flag(Flag::HalfCarry, false);
-    set_flag(Flag::Carry, static_cast<bool>(result & 0x80));
+    set_lazy_flags(
+        FlagOp::Logic, lhs, 0, result, static_cast<bool>(result & 0x80));
     return result;
 }
 
 auto Cpu::cp(u8 lhs, u8 rhs) -> void
 {
-    const u8 result = lhs - rhs;
-    set_flag(Flag::Zero, result == 0);
-    set_flag(Flag::Subtraction, true);
-    set_flag(Flag::HalfCarry, lo_nibble(lhs) < lo_nibble(rhs));
-    set_flag(Flag::Carry, lhs < rhs);
+    set_lazy_flags(FlagOp::Sub, lhs, rhs, lhs - rhs, lhs < rhs);
 }
 } // namespace tomboy
@@ -1,20 +1,79 @@
-#pragma nce
+#pragma once
 
+#include "block_cache.hpp"
+#include "jit.hpp"
 #include "register.hpp"
 #include "types.hpp"
 
+#include <array>
 #include <cmath>
+#include <concepts>
+#include <utility>
 
 namespace tomboy {
 class Memory;
+class Scheduler;
 }
 
 namespace tomboy {
 class Cpu {
   public:
-    Cpu(Memory *memory);
+    /// Interpreter core used by run_for
+    enum class Core : u8 {
+        /// Loop over step, one table dispatch per instruction
+        Table,
+        /// Switch over every opcode, the dispatch the table replaced, kept to
+        /// measure the two against each other
+        Switch,
+        /// Computed goto, each handler jumps to the next opcode's handler
+        Threaded,
+        /// Execute pre-decoded basic blocks from the block cache
+        Cached,
+        /// Translate hot basic blocks into native code
+        Jit,
+    };
+
+#ifdef TOMBOY_THREADED_CORE
+    static constexpr Core default_core = Core::Threaded;
+#else
+    static constexpr Core default_core = Core::Table;
+#endif
+
+  public:
+    Cpu(Memory *memory, Scheduler *scheduler, Core core = default_core);
 
     auto step() -> u8;
+    /// Run until at least cycles have elapsed, returns the cycles used
+    ///
+    /// Execution stops at every scheduled event so it is dispatched on time.
+    auto run_for(u64 cycles) -> u64;
+    /// Run until the cycle counter reaches deadline, returns the cycles used
+    auto run_until(u64 deadline) -> u64;
+    /// Step until predicate holds, returns the cycles used
+    ///
+    /// The predicate is checked before every instruction, prefer run_until
+    /// a deadline outside of debugging.
+    template <class Predicate>
+        requires std::predicate<Predicate &, const Cpu &>
+    auto run_until(Predicate predicate) -> u64;
+
+    [[nodiscard]] auto pc() const -> u16;
+    /// Elapsed machine cycles, kept by the scheduler
+    [[nodiscard]] auto cycles() const -> u64;
+    /// Executed instructions
+    [[nodiscard]] auto instructions() const -> u64;
+    /// Cycles skipped over while halted or stopped
+    [[nodiscard]] auto halted_cycles() const -> u64;
+    /// Cycles skipped over in idle loops polling an IO register
+    [[nodiscard]] auto idle_cycles() const -> u64;
+
+    [[nodiscard]] auto core() const -> Core;
+    auto set_core(Core core) -> void;
+
+    [[nodiscard]] auto jit() -> Jit &;
+
+  private:
+    friend class Jit;
 
   private:
     enum class Flag : u8 {
@@ -24,21 +83,128 @@ class Cpu {
         Carry = 4,
     };
 
-    struct FetchResult {
-        u8 opcode;
-        bool has_prefix;
+    /// Operation whose subtraction and half carry flags are evaluated on
+    /// demand
+    enum class FlagOp : u8 {
+        /// Flags are up to date in register F
+        None,
+        /// Add and adc
+        Add,
+        Sub,
+        Sbc,
+        Inc,
+        Dec,
+        And,
+        /// Or, xor, swap, shifts and rotates
+        Logic,
     };
 
+#ifdef TOMBOY_EAGER_FLAGS
+    static constexpr bool lazy_flags = false;
+#else
+    static constexpr bool lazy_flags = true;
+#endif
+
+    /// 8-bit register operand
+    enum class R8 : u8 { A, B, C, D, E, H, L };
+
+    /// 16-bit register operand
+    enum class R16 : u8 { AF, BC, DE, HL, SP };
+
     struct ExecuteResult {
         u16 new_pc;
         u8 cycles_used;
     };
 
+    using Instruction = auto (Cpu::*)() -> ExecuteResult;
+
+    /// Instruction callable from native code, returns the cycles used, the
+    /// new PC shifted left by 16 and whether cached blocks were dropped
+    /// shifted left by 32
+    using NativeHandler = auto (*)(Cpu *cpu) -> u64;
+
+    /// 256 base opcodes followed by 256 0xCB-prefixed opcodes
+    using InstructionTable = std::array<Instruction, 512>;
+
   private:
-    [[nodiscard]] auto fetch() const -> FetchResult;
-    [[nodiscard]] auto decode_execute(u8 opcode, bool has_prefix)
+    [[nodiscard]] auto fetch() const -> u8;
+    [[nodiscard]] auto decode_execute(u8 opcode) -> ExecuteResult;
+    /// Dispatch through the switches the instruction table replaced, kept
+    /// for the switch core
+    [[nodiscard]] auto decode_execute_switch(u8 opcode, bool has_prefix)
         -> ExecuteResult;
 
+    // ===== Instruction dispatch =====
+
+    [[nodiscard]] static constexpr auto make_instruction_table()
+        -> InstructionTable;
+
+    /// Resolve 8-bit register operand
+    template <R8 reg>
+    auto r8() -> Register8 &;
+    /// Resolve 16-bit register operand
+    template <R16 reg>
+    auto r16() -> Register16 &;
+    /// Resolve register operands, pass through other operands
+    template <auto operand>
+    auto resolve() -> decltype(auto);
+    /// Execute handler with operands bound at compile time
+    template <auto handler, auto... operands>
+    auto execute() -> ExecuteResult;
+
+    /// Execute instruction table entry on behalf of native code, leaving the
+    /// flags in F where native code reads them
+    template <u16 index>
+    static auto native_execute(Cpu *cpu) -> u64;
+    template <size_t... indices>
+    static constexpr auto make_native_handlers(
+        std::index_sequence<indices...> sequence)
+        -> std::array<NativeHandler, 512>;
+
+    /// Run for at least budget cycles on the selected core, moving the
+    /// scheduler's counter along without dispatching events
+    auto run_core(u64 budget) -> u64;
+    /// Wake on a pending interrupt and jump to its vector if enabled,
+    /// returns the cycles used
+    auto service_interrupts() -> u8;
+    /// Whether an instruction makes the cores return to run_for, as it halts
+    /// or may enable a pending interrupt
+    [[nodiscard]] static auto yields(u16 index) -> bool;
+    /// Run for at least budget cycles on the table core
+    auto run_table(u64 budget) -> u64;
+    /// Run for at least budget cycles on the threaded core
+    auto run_threaded(u64 budget) -> u64;
+    /// Run for at least budget cycles on the switch core
+    auto run_switch(u64 budget) -> u64;
+    /// Run for at least budget cycles on the block cache core
+    auto run_cached(u64 budget) -> u64;
+    /// Decode the basic block starting at address
+    [[nodiscard]] auto decode_block(u16 address) const -> BlockCache::Block;
+    /// Whether a decoded block is an idle loop
+    [[nodiscard]] auto is_idle_loop(const BlockCache::Block &block) const
+        -> bool;
+    /// Skip whole iterations of an idle loop that just ran once, stopping
+    /// short of budget so the last iteration runs as usual
+    auto skip_idle_loop(u64 loop_cycles, u64 loop_instructions, u64 budget,
+        u64 &cycles) -> void;
+    /// Whether an instruction is a jr cc or jp cc, which close idle loops
+    [[nodiscard]] static auto is_conditional_jump(u16 index) -> bool;
+    /// For the cores stepping instructions, at the start of a slice and
+    /// after a conditional jump back: run the block at the PC once and skip
+    /// further iterations if it is an idle loop
+    auto skip_idle_block(u64 budget, u64 &cycles) -> void;
+    /// Find the cached block starting at address, decoding it if needed
+    auto find_block(u16 address) -> const BlockCache::Block &;
+    /// Execute a block until cycles reaches budget, returns the number of
+    /// instructions executed
+    auto execute_block(const BlockCache::Block &block, u64 budget,
+        u64 &cycles) -> u64;
+
+    /// Dispatch 0xCB-prefixed opcode
+    auto prefix() -> ExecuteResult;
+    /// Report an invalid opcode once and lock up
+    auto invalid() -> ExecuteResult;
+
     // ===== Load instructions =====
 
     /// Load 8-bit register into a 8-bit register
@@ -243,8 +409,12 @@ class Cpu {
     auto ld_hl_sp_s8() -> ExecuteResult;
     /// Push 16-bit register onto stack
     auto push_r16(const Register16 &reg) -> ExecuteResult;
+    /// Push AF onto stack
+    auto push_af() -> ExecuteResult;
     /// Pop stack into 16-bit register
     auto pop_r16(Register16 &reg) -> ExecuteResult;
+    /// Pop stack into AF
+    auto pop_af() -> ExecuteResult;
 
     // ===== Carry flag instructions =====
 
@@ -275,6 +445,14 @@ class Cpu {
 
     [[nodiscard]] auto get_flag(Flag flag) const -> bool;
     auto set_flag(Flag flag, bool value) -> void;
+    /// Record an operation and its carry out, the other flags are evaluated
+    /// when next read
+    auto set_lazy_flags(FlagOp op, u8 lhs, u8 rhs, u8 result, bool carry,
+        bool carry_in = false) -> void;
+    /// Evaluate flags of the recorded operation
+    [[nodiscard]] auto flags() const -> u8;
+    /// Store flags of the recorded operation in register F
+    auto materialize_flags() -> void;
 
     // ===== Shared operations =====
 
@@ -324,14 +502,48 @@ class Cpu {
     auto cp(u8 lhs, u8 rhs) -> void;
 
   private:
+    static const InstructionTable instruction_table;
+    static const std::array<NativeHandler, 512> native_handlers;
+
     Register16 af_;
     Register16 bc_;
     Register16 de_;
     Register16 hl_;
     Register16 sp_;
     Register16 pc_;
+    FlagOp flag_op_;
+    u8 flag_lhs_;
+    u8 flag_rhs_;
+    u8 flag_result_;
+    bool flag_carry_;
+    /// Carry in of adc and sbc, needed for their half carry
+    bool flag_carry_in_;
     bool halted_;
+    /// Set by an invalid opcode, the CPU stays halted and ignores
+    /// interrupts
+    bool locked_;
     bool ime_;
+    /// Set by instructions the cores must return after, and by the scheduler
+    /// when an event is scheduled inside the running slice
+    bool yield_;
+    u64 instructions_;
+    u64 halted_cycles_;
+    u64 idle_cycles_;
+    Core core_;
     Memory *memory_;
+    Scheduler *scheduler_;
+    BlockCache block_cache_;
+    Jit jit_;
 };
+
+template <class Predicate>
+    requires std::predicate<Predicate &, const Cpu &>
+auto Cpu::run_until(Predicate predicate) -> u64
+{
+    u64 cycles = 0;
+    while (!predicate(static_cast<const Cpu &>(*this))) {
+        cycles += step();
+    }
+    return cycles;
+}
 } // namespace tomboy
@@ -0,0 +1,69 @@
+#include "display.hpp"
+
+#include "ppu.hpp"
+#include "types.hpp"
+
+#include <SDL3/SDL.h>
+
+#include <cstddef>
+
+namespace tomboy {
+
+auto Display::create(int scale, FrameConverter::Filter filter, bool vsync)
+    -> std::unique_ptr<Display>
+{
+    std::unique_ptr<Display> display(new Display());
+    display->scale_ = scale;
+    display->filter_ = filter;
+    display->window_ = SDL_CreateWindow(
+        "Tom Boy", Ppu::width * scale, Ppu::height * scale, 0);
+    if (display->window_ == nullptr) {
+        return nullptr;
+    }
+
+    display->renderer_ = SDL_CreateRenderer(display->window_, nullptr);
+    if (display->renderer_ == nullptr) {
+        return nullptr;
+    }
+    // Without vsync the caller paces frames itself
+    SDL_SetRenderVSync(display->renderer_, vsync ? 1 : 0);
+
+    display->texture_ = SDL_CreateTexture(display->renderer_,
+        SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+        Ppu::width * scale, Ppu::height * scale);
+    if (display->texture_ == nullptr) {
+        return nullptr;
+    }
+    return display;
+}
+
+Display::~Display()
+{
+    if (texture_ != nullptr) {
+        SDL_DestroyTexture(texture_);
+    }
+    if (renderer_ != nullptr) {
+        SDL_DestroyRenderer(renderer_);
+    }
+    if (window_ != nullptr) {
+        SDL_DestroyWindow(window_);
+    }
+}
+
+auto Display::present(std::span<const u32> framebuffer) -> bool
+{
+    void *pixels = nullptr;
+    int pitch = 0;
+    if (!SDL_LockTexture(texture_, nullptr, &pixels, &pitch)) {
+        return false;
+    }
+    converter_.scale(framebuffer.data(), Ppu::width, Ppu::height, scale_,
+        filter_, static_cast<u32 *>(pixels),
+        static_cast<size_t>(pitch) / sizeof(u32));
+    SDL_UnlockTexture(texture_);
+
+    SDL_RenderClear(renderer_);
+    SDL_RenderTexture(renderer_, texture_, nullptr, nullptr);
+    return SDL_RenderPresent(renderer_);
+}
+} // namespace tomboy
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "frame_converter.hpp"
+#include "types.hpp"
+
+#include <memory>
+#include <span>
+
+struct SDL_Renderer;
+struct SDL_Texture;
+struct SDL_Window;
+
+namespace tomboy {
+/// Window showing the framebuffer
+///
+/// Each frame is scaled straight into a streaming texture the size of the
+/// window, so it is written once per frame and the renderer draws it 1:1.
+class Display {
+  public:
+    /// Open a window scale times the size of the screen, 1 to 4, nullptr on
+    /// failure with the reason left in SDL_GetError. SDL video must be
+    /// initialised.
+    [[nodiscard]] static auto create(int scale, FrameConverter::Filter filter,
+        bool vsync) -> std::unique_ptr<Display>;
+
+    ~Display();
+
+    Display(const Display &) = delete;
+    auto operator=(const Display &) -> Display & = delete;
+
+    /// Show a 160x144 frame of 0xRRGGBBAA pixels, false on failure with the
+    /// reason left in SDL_GetError
+    auto present(std::span<const u32> framebuffer) -> bool;
+
+  private:
+    Display() = default;
+
+  private:
+    SDL_Window *window_ = nullptr;
+    SDL_Renderer *renderer_ = nullptr;
+    SDL_Texture *texture_ = nullptr;
+    FrameConverter converter_;
+    int scale_ = 1;
+    FrameConverter::Filter filter_ = FrameConverter::Filter::Nearest;
+};
+} // namespace tomboy
@@ -0,0 +1,351 @@
+#include "frame_converter.hpp"
+
+#include "types.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TOMBOY_CONVERTER_X86_64
+#endif
+
+#include <cstddef>
+#include <cstring>
+
+namespace tomboy {
+
+namespace {
+/// Widen a 5-bit channel to 8 bits, repeating its top bits below
+constexpr auto expand5(u32 value) -> u32
+{
+    return value << 3 | value >> 2;
+}
+
+auto dmg_scalar(const u8 *shades, size_t count,
+    const FrameConverter::Palette &palette, u32 *rgba) -> void
+{
+    for (size_t i = 0; i < count; i++) {
+        rgba[i] = palette[shades[i] & 0x03];
+    }
+}
+
+auto cgb_scalar(const u16 *colors, size_t count, u32 *rgba) -> void
+{
+    for (size_t i = 0; i < count; i++) {
+        const u32 color = colors[i];
+        rgba[i] = expand5(color & 0x1F) << 24 |
+                  expand5(color >> 5 & 0x1F) << 16 |
+                  expand5(color >> 10 & 0x1F) << 8 | 0xFF;
+    }
+}
+
+auto widen_scalar(const u32 *row, int width, int factor, u32 *output) -> void
+{
+    for (int x = 0; x < width; x++) {
+        for (int i = 0; i < factor; i++) {
+            output[x * factor + i] = row[x];
+        }
+    }
+}
+
+/// Scale2x the pixels of a row from first to last
+auto scale2x_pixels(const u32 *above, const u32 *row, const u32 *below,
+    int width, int first, int last, u32 *top, u32 *bottom) -> void
+{
+    for (int x = first; x < last; x++) {
+        const u32 p = row[x];
+        const u32 a = above[x];
+        const u32 b = row[x + 1 < width ? x + 1 : x];
+        const u32 c = row[x > 0 ? x - 1 : x];
+        const u32 d = below[x];
+        top[x * 2] = c == a && c != d && a != b ? a : p;
+        top[x * 2 + 1] = a == b && a != c && b != d ? b : p;
+        bottom[x * 2] = d == c && d != b && c != a ? c : p;
+        bottom[x * 2 + 1] = b == d && b != a && d != c ? d : p;
+    }
+}
+
+auto scale2x_scalar(const u32 *above, const u32 *row, const u32 *below,
+    int width, u32 *top, u32 *bottom) -> void
+{
+    scale2x_pixels(above, row, below, width, 0, width, top, bottom);
+}
+
+#ifdef TOMBOY_CONVERTER_X86_64
+auto cgb_sse2(const u16 *colors, size_t count, u32 *rgba) -> void
+{
+    const __m128i channel = _mm_set1_epi32(0x1F);
+    const __m128i alpha = _mm_set1_epi32(0xFF);
+    const auto expand = [&](__m128i color) -> __m128i {
+        const __m128i red = _mm_and_si128(color, channel);
+        const __m128i green = _mm_and_si128(_mm_srli_epi32(color, 5), channel);
+        const __m128i blue = _mm_and_si128(_mm_srli_epi32(color, 10), channel);
+        const auto widen = [](__m128i value) -> __m128i {
+            return _mm_or_si128(
+                _mm_slli_epi32(value, 3), _mm_srli_epi32(value, 2));
+        };
+        return _mm_or_si128(
+            _mm_or_si128(_mm_slli_epi32(widen(red), 24),
+                _mm_slli_epi32(widen(green), 16)),
+            _mm_or_si128(_mm_slli_epi32(widen(blue), 8), alpha));
+    };
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i packed =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(colors + i));
+        const __m128i zero = _mm_setzero_si128();
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + i),
+            expand(_mm_unpacklo_epi16(packed, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + i + 4),
+            expand(_mm_unpackhi_epi16(packed, zero)));
+    }
+    cgb_scalar(colors + i, count - i, rgba + i);
+}
+
+__attribute__((target("ssse3"))) auto dmg_ssse3(const u8 *shades,
+    size_t count, const FrameConverter::Palette &palette, u32 *rgba) -> void
+{
+    // The four colours fill one vector, so each output byte is a shuffle of
+    // it indexed by shade * 4 plus its byte within the pixel
+    const __m128i table =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(palette.data()));
+    const __m128i mask = _mm_set1_epi8(0x03);
+    const __m128i bytes = _mm_set1_epi32(0x03020100);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i indices = _mm_and_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(shades + i)),
+            mask);
+        for (int group = 0; group < 4; group++) {
+            const char first = static_cast<char>(group * 4);
+            const __m128i spread = _mm_setr_epi8(first, first, first, first,
+                first + 1, first + 1, first + 1, first + 1, first + 2,
+                first + 2, first + 2, first + 2, first + 3, first + 3,
+                first + 3, first + 3);
+            // Shades are below 4, so shifting 16-bit lanes cannot carry
+            // between bytes
+            const __m128i offsets = _mm_add_epi8(
+                _mm_slli_epi16(_mm_shuffle_epi8(indices, spread), 2), bytes);
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i *>(rgba + i + group * 4),
+                _mm_shuffle_epi8(table, offsets));
+        }
+    }
+    dmg_scalar(shades + i, count - i, palette, rgba + i);
+}
+
+__attribute__((target("avx2"))) auto dmg_avx2(const u8 *shades,
+    size_t count, const FrameConverter::Palette &palette, u32 *rgba) -> void
+{
+    // Shuffles stay within 128-bit lanes, so both lanes hold the palette and
+    // the eight shades, and each picks out four of them
+    const __m256i table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(palette.data())));
+    const __m256i mask = _mm256_set1_epi8(0x03);
+    const __m256i bytes = _mm256_set1_epi32(0x03020100);
+    const __m256i spread = _mm256_setr_epi8( //
+        0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, //
+        4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        i64 packed;
+        std::memcpy(&packed, shades + i, sizeof(packed));
+        const __m256i indices =
+            _mm256_and_si256(_mm256_set1_epi64x(packed), mask);
+        const __m256i offsets = _mm256_add_epi8(
+            _mm256_slli_epi16(_mm256_shuffle_epi8(indices, spread), 2), bytes);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(rgba + i),
+            _mm256_shuffle_epi8(table, offsets));
+    }
+    dmg_scalar(shades + i, count - i, palette, rgba + i);
+}
+
+auto widen_sse2(const u32 *row, int width, int factor, u32 *output) -> void
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        auto *out = reinterpret_cast<__m128i *>(output + x * factor);
+        switch (factor) {
+        case 2:
+            _mm_storeu_si128(out, _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(v, v));
+            break;
+        case 3:
+            _mm_storeu_si128(out, _mm_shuffle_epi32(v, 0x40));
+            _mm_storeu_si128(out + 1, _mm_shuffle_epi32(v, 0xA5));
+            _mm_storeu_si128(out + 2, _mm_shuffle_epi32(v, 0xFE));
+            break;
+        case 4:
+            _mm_storeu_si128(out, _mm_shuffle_epi32(v, 0x00));
+            _mm_storeu_si128(out + 1, _mm_shuffle_epi32(v, 0x55));
+            _mm_storeu_si128(out + 2, _mm_shuffle_epi32(v, 0xAA));
+            _mm_storeu_si128(out + 3, _mm_shuffle_epi32(v, 0xFF));
+            break;
+        default: _mm_storeu_si128(out, v); break;
+        }
+    }
+    widen_scalar(row + x, width - x, factor, output + x * factor);
+}
+
+auto scale2x_sse2(const u32 *above, const u32 *row, const u32 *below,
+    int width, u32 *top, u32 *bottom) -> void
+{
+    const auto load = [](const u32 *pixels) -> __m128i {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+    };
+    // Choose when for lanes set in mask, otherwise p
+    const auto select = [](__m128i mask, __m128i when, __m128i p) -> __m128i {
+        return _mm_or_si128(
+            _mm_and_si128(mask, when), _mm_andnot_si128(mask, p));
+    };
+
+    // The edge pixels repeat themselves as neighbours, leave them to the
+    // scalar code so vector loads stay inside the row
+    scale2x_pixels(above, row, below, width, 0, 1, top, bottom);
+    int x = 1;
+    for (; x + 5 <= width; x += 4) {
+        const __m128i p = load(row + x);
+        const __m128i a = load(above + x);
+        const __m128i b = load(row + x + 1);
+        const __m128i c = load(row + x - 1);
+        const __m128i d = load(below + x);
+
+        const __m128i ca = _mm_cmpeq_epi32(c, a);
+        const __m128i cd = _mm_cmpeq_epi32(c, d);
+        const __m128i ab = _mm_cmpeq_epi32(a, b);
+        const __m128i bd = _mm_cmpeq_epi32(b, d);
+        const __m128i e0 =
+            select(_mm_andnot_si128(ab, _mm_andnot_si128(cd, ca)), a, p);
+        const __m128i e1 =
+            select(_mm_andnot_si128(bd, _mm_andnot_si128(ca, ab)), b, p);
+        const __m128i e2 =
+            select(_mm_andnot_si128(ca, _mm_andnot_si128(bd, cd)), c, p);
+        const __m128i e3 =
+            select(_mm_andnot_si128(cd, _mm_andnot_si128(ab, bd)), d, p);
+
+        auto *upper = reinterpret_cast<__m128i *>(top + x * 2);
+        auto *lower = reinterpret_cast<__m128i *>(bottom + x * 2);
+        _mm_storeu_si128(upper, _mm_unpacklo_epi32(e0, e1));
+        _mm_storeu_si128(upper + 1, _mm_unpackhi_epi32(e0, e1));
+        _mm_storeu_si128(lower, _mm_unpacklo_epi32(e2, e3));
+        _mm_storeu_si128(lower + 1, _mm_unpackhi_epi32(e2, e3));
+    }
+    scale2x_pixels(above, row, below, width, x, width, top, bottom);
+}
+#endif
+
+} // namespace
+
+FrameConverter::FrameConverter()
+  : FrameConverter(best())
+{
+}
+
+FrameConverter::FrameConverter(Kernel kernel)
+  : kernel_(supported(kernel) ? kernel : Kernel::Scalar),
+    functions_(functions(kernel_)),
+    scratch_()
+{
+}
+
+auto FrameConverter::scale(const u32 *frame, int width, int height,
+    int factor, Filter filter, u32 *output, size_t pitch) -> void
+{
+    if (filter == Filter::Scale2x && factor == 2) {
+        scale2x(frame, width, height, output, pitch);
+    }
+    else if (filter == Filter::Scale2x && factor == 4) {
+        const size_t scratch_pitch = static_cast<size_t>(width) * 2;
+        scratch_.resize(scratch_pitch * static_cast<size_t>(height) * 2);
+        scale2x(frame, width, height, scratch_.data(), scratch_pitch);
+        scale2x(scratch_.data(), width * 2, height * 2, output, pitch);
+    }
+    else {
+        nearest(frame, width, height, factor, output, pitch);
+    }
+}
+
+auto FrameConverter::nearest(const u32 *frame, int width, int height,
+    int factor, u32 *output, size_t pitch) const -> void
+{
+    const size_t row_size = static_cast<size_t>(width * factor) * sizeof(u32);
+    for (int y = 0; y < height; y++) {
+        u32 *first = output + static_cast<size_t>(y * factor) * pitch;
+        functions_.widen(frame + static_cast<size_t>(y * width), width,
+            factor, first);
+        for (int i = 1; i < factor; i++) {
+            std::memcpy(first + i * pitch, first, row_size);
+        }
+    }
+}
+
+auto FrameConverter::scale2x(const u32 *frame, int width, int height,
+    u32 *output, size_t pitch) const -> void
+{
+    for (int y = 0; y < height; y++) {
+        const u32 *row = frame + static_cast<size_t>(y * width);
+        const u32 *above = y > 0 ? row - width : row;
+        const u32 *below = y + 1 < height ? row + width : row;
+        u32 *top = output + static_cast<size_t>(y * 2) * pitch;
+        functions_.scale2x(above, row, below, width, top, top + pitch);
+    }
+}
+
+auto FrameConverter::functions(Kernel kernel) -> Functions
+{
+    constexpr Functions scalar = {
+        .dmg = &dmg_scalar,
+        .cgb = &cgb_scalar,
+        .widen = &widen_scalar,
+        .scale2x = &scale2x_scalar,
+    };
+    switch (kernel) {
+    case Kernel::Scalar: return scalar;
+#ifdef TOMBOY_CONVERTER_X86_64
+    case Kernel::Ssse3:
+        return {
+            .dmg = &dmg_ssse3,
+            .cgb = &cgb_sse2,
+            .widen = &widen_sse2,
+            .scale2x = &scale2x_sse2,
+        };
+    case Kernel::Avx2:
+        return {
+            .dmg = &dmg_avx2,
+            .cgb = &cgb_sse2,
+            .widen = &widen_sse2,
+            .scale2x = &scale2x_sse2,
+        };
+#else
+    default: break;
+#endif
+    }
+    return scalar;
+}
+
+auto FrameConverter::supported(Kernel kernel) -> bool
+{
+    switch (kernel) {
+    case Kernel::Scalar: return true;
+#ifdef TOMBOY_CONVERTER_X86_64
+    case Kernel::Ssse3: return __builtin_cpu_supports("ssse3") != 0;
+    case Kernel::Avx2: return __builtin_cpu_supports("avx2") != 0;
+#else
+    default: return false;
+#endif
+    }
+    return false;
+}
+
+auto FrameConverter::best() -> Kernel
+{
+    if (supported(Kernel::Avx2)) {
+        return Kernel::Avx2;
+    }
+    if (supported(Kernel::Ssse3)) {
+        return Kernel::Ssse3;
+    }
+    return Kernel::Scalar;
+}
+} // namespace tomboy
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace tomboy {
+/// Turns colour numbers into RGBA pixels and scales frames up
+///
+/// Pixels are 0xRRGGBBAA. Nothing here depends on SDL, so recorders and other
+/// headless consumers can produce the same output as the window.
+class FrameConverter {
+  public:
+    enum class Kernel : u8 {
+        /// Portable pixel by pixel code
+        Scalar,
+        /// 128-bit vectors, shuffling palettes with SSSE3
+        Ssse3,
+        /// 256-bit palette lookups, 128-bit vectors elsewhere
+        Avx2,
+    };
+
+    enum class Filter : u8 {
+        /// Repeat each pixel
+        Nearest,
+        /// Scale2x, also known as EPX, smoothing diagonal edges. Applied
+        /// twice for a factor of 4, factors of 3 fall back to Nearest.
+        Scale2x,
+    };
+
+    /// Four RGBA colours indexed by DMG shade, lightest first
+    using Palette = std::array<u32, 4>;
+
+  public:
+    /// Use the fastest kernel the running CPU supports
+    FrameConverter();
+    /// Use kernel, falling back to Scalar if the CPU does not support it
+    explicit FrameConverter(Kernel kernel);
+
+    [[nodiscard]] auto kernel() const -> Kernel;
+
+    /// Look up count shades, 0 to 3, in palette
+    auto convert_dmg(const u8 *shades, size_t count, const Palette &palette,
+        u32 *rgba) const -> void;
+    /// Expand count CGB colours, 5 bits each of red, green and blue from the
+    /// lowest bits up
+    auto convert_cgb(const u16 *colors, size_t count, u32 *rgba) const
+        -> void;
+
+    /// Scale a frame by factor, 1 to 4, into output whose rows start pitch
+    /// pixels apart
+    auto scale(const u32 *frame, int width, int height, int factor,
+        Filter filter, u32 *output, size_t pitch) -> void;
+
+    /// Whether the running CPU can execute kernel
+    [[nodiscard]] static auto supported(Kernel kernel) -> bool;
+    /// Fastest supported kernel
+    [[nodiscard]] static auto best() -> Kernel;
+
+  private:
+    struct Functions {
+        auto (*dmg)(const u8 *shades, size_t count, const Palette &palette,
+            u32 *rgba) -> void;
+        auto (*cgb)(const u16 *colors, size_t count, u32 *rgba) -> void;
+        /// Repeat each pixel of a row factor times
+        auto (*widen)(const u32 *row, int width, int factor, u32 *output)
+            -> void;
+        /// Scale2x one row into two, given the rows above and below
+        auto (*scale2x)(const u32 *above, const u32 *row, const u32 *below,
+            int width, u32 *top, u32 *bottom) -> void;
+    };
+
+  private:
+    [[nodiscard]] static auto functions(Kernel kernel) -> Functions;
+
+    auto nearest(const u32 *frame, int width, int height, int factor,
+        u32 *output, size_t pitch) const -> void;
+    auto scale2x(const u32 *frame, int width, int height, u32 *output,
+        size_t pitch) const -> void;
+
+  private:
+    Kernel kernel_;
+    Functions functions_;
+    /// Intermediate frame of a factor 4 Scale2x
+    std::vector<u32> scratch_;
+};
+
+inline auto FrameConverter::kernel() const -> Kernel
+{
+    return kernel_;
+}
+
+inline auto FrameConverter::convert_dmg(const u8 *shades, size_t count,
+    const Palette &palette, u32 *rgba) const -> void
+{
+    functions_.dmg(shades, count, palette, rgba);
+}
+
+inline auto FrameConverter::convert_cgb(
+    const u16 *colors, size_t count, u32 *rgba) const -> void
+{
+    functions_.cgb(colors, count, rgba);
+}
+} // namespace tomboy
@@ -0,0 +1,99 @@
+#include "frame_pacer.hpp"
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace tomboy {
+
+/// Requested length of one sleep
+constexpr std::chrono::milliseconds slice(1);
+
+FramePacer::FramePacer(Clock::duration period)
+  : period_(period),
+    next_(Clock::now() + period),
+    estimate_(0.002),
+    mean_(0.002),
+    m2_(0.0),
+    count_(1)
+{
+}
+
+auto FramePacer::wait() -> void
+{
+    const Clock::time_point now = Clock::now();
+    if (now > next_ + period_) {
+        next_ = now + period_;
+        return;
+    }
+
+    while (std::chrono::duration<double>(next_ - Clock::now()).count() >
+           estimate_) {
+        sleep();
+    }
+    while (Clock::now() < next_) {
+    }
+    next_ += period_;
+}
+
+auto FramePacer::sleep() -> void
+{
+    const Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(slice);
+    const double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Welford's algorithm, so the estimate follows the scheduler's actual
+    // wake-up latency
+    count_++;
+    const double delta = elapsed - mean_;
+    mean_ += delta / static_cast<double>(count_);
+    m2_ += delta * (elapsed - mean_);
+    estimate_ = mean_ + std::sqrt(m2_ / static_cast<double>(count_ - 1));
+}
+
+FrameTimes::FrameTimes()
+  : last_(FramePacer::Clock::now()),
+    count_(0),
+    mean_(0.0),
+    m2_(0.0),
+    worst_(0.0)
+{
+}
+
+auto FrameTimes::record() -> void
+{
+    const FramePacer::Clock::time_point now = FramePacer::Clock::now();
+    const double elapsed = std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+
+    count_++;
+    const double delta = elapsed - mean_;
+    mean_ += delta / static_cast<double>(count_);
+    m2_ += delta * (elapsed - mean_);
+    worst_ = std::max(worst_, elapsed);
+}
+
+auto FrameTimes::frames() const -> u64
+{
+    return count_;
+}
+
+auto FrameTimes::mean() const -> double
+{
+    return mean_;
+}
+
+auto FrameTimes::jitter() const -> double
+{
+    return count_ > 1 ? std::sqrt(m2_ / static_cast<double>(count_ - 1)) : 0.0;
+}
+
+auto FrameTimes::worst() const -> double
+{
+    return worst_;
+}
+} // namespace tomboy
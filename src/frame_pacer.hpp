@@ -0,0 +1,62 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <chrono>
+
+namespace tomboy {
+/// Holds a loop to a fixed frame rate without spinning a core
+///
+/// Waits sleep in short slices while the time left is comfortably more than
+/// a slice has been seen to take, then spin for the remainder. The estimate
+/// of a slice is the mean plus one standard deviation of those measured.
+class FramePacer {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+  public:
+    explicit FramePacer(Clock::duration period);
+
+    /// Wait until the next frame is due. A loop that fell more than a frame
+    /// behind starts again from now rather than rushing to catch up.
+    auto wait() -> void;
+
+  private:
+    /// Sleep for one slice, updating the estimate of its length
+    auto sleep() -> void;
+
+  private:
+    Clock::duration period_;
+    Clock::time_point next_;
+
+    /// Running statistics of slice lengths in seconds
+    double estimate_;
+    double mean_;
+    double m2_;
+    u64 count_;
+};
+
+/// Statistics of the time between frames of a loop
+class FrameTimes {
+  public:
+    FrameTimes();
+
+    /// Note that a frame ended now
+    auto record() -> void;
+
+    [[nodiscard]] auto frames() const -> u64;
+    /// Mean time between frames in seconds
+    [[nodiscard]] auto mean() const -> double;
+    /// Standard deviation of the time between frames in seconds
+    [[nodiscard]] auto jitter() const -> double;
+    /// Longest time between frames in seconds
+    [[nodiscard]] auto worst() const -> double;
+
+  private:
+    FramePacer::Clock::time_point last_;
+    u64 count_;
+    double mean_;
+    double m2_;
+    double worst_;
+};
+} // namespace tomboy
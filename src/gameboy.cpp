@@ -0,0 +1,110 @@
+#include "gameboy.hpp"
+
+#include "apu.hpp"
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "ppu.hpp"
+#include "scheduler.hpp"
+#include "types.hpp"
+
+#include <string_view>
+#include <utility>
+
+namespace tomboy {
+
+GameBoy::GameBoy(Cpu::Core core)
+  : scheduler_(),
+    memory_(),
+    ppu_(&memory_, &scheduler_),
+    apu_(&memory_, &scheduler_),
+    cpu_(&memory_, &scheduler_, core),
+    cartridge_(),
+    save_interval_(0)
+{
+    memory_.set_scheduler(&scheduler_);
+    memory_.set_ppu(&ppu_);
+    memory_.set_apu(&apu_);
+    scheduler_.set_callback(Scheduler::Event::Save,
+        Scheduler::bind<&GameBoy::on_save>(this));
+}
+
+auto GameBoy::insert(Cartridge cartridge) -> void
+{
+    memory_.set_cartridge(nullptr);
+    cartridge_ = std::move(cartridge);
+    cartridge_->set_clock(&scheduler_);
+    memory_.set_cgb(cartridge_->cgb());
+    memory_.set_cartridge(&*cartridge_);
+}
+
+auto GameBoy::run_frame() -> u64
+{
+    return cpu_.run_for(cycles_per_frame);
+}
+
+auto GameBoy::load_save(std::string_view path) -> bool
+{
+    if (!cartridge_ || !cartridge_->load_save(path)) {
+        return false;
+    }
+    memory_.map_cartridge();
+    return true;
+}
+
+auto GameBoy::set_save_interval(u64 cycles) -> void
+{
+    save_interval_ = cycles;
+    if (cycles > 0) {
+        scheduler_.schedule_in(Scheduler::Event::Save, cycles);
+    }
+    else {
+        scheduler_.cancel(Scheduler::Event::Save);
+    }
+}
+
+auto GameBoy::flush_save() -> void
+{
+    if (cartridge_ && cartridge_->ram_dirty()) {
+        cartridge_->flush_save();
+        // Catch the next write to mark the RAM dirty again
+        memory_.map_cartridge();
+    }
+}
+
+auto GameBoy::on_save(u64 deadline) -> void
+{
+    flush_save();
+    scheduler_.schedule(Scheduler::Event::Save, deadline + save_interval_);
+}
+
+auto GameBoy::cpu() -> Cpu &
+{
+    return cpu_;
+}
+
+auto GameBoy::memory() -> Memory &
+{
+    return memory_;
+}
+
+auto GameBoy::ppu() -> Ppu &
+{
+    return ppu_;
+}
+
+auto GameBoy::apu() -> Apu &
+{
+    return apu_;
+}
+
+auto GameBoy::scheduler() -> Scheduler &
+{
+    return scheduler_;
+}
+
+auto GameBoy::cartridge() -> Cartridge *
+{
+    return cartridge_ ? &*cartridge_ : nullptr;
+}
+} // namespace tomboy
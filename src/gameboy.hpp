@@ -0,0 +1,61 @@
+#pragma once
+
+#include "apu.hpp"
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "ppu.hpp"
+#include "scheduler.hpp"
+#include "types.hpp"
+
+#include <optional>
+#include <string_view>
+
+namespace tomboy {
+/// One console, its components wired to a shared scheduler and address space
+class GameBoy {
+  public:
+    /// Machine cycles per frame, 154 lines of 114 cycles
+    static constexpr u64 cycles_per_frame = 17556;
+
+  public:
+    explicit GameBoy(Cpu::Core core = Cpu::default_core);
+
+    GameBoy(const GameBoy &) = delete;
+    auto operator=(const GameBoy &) -> GameBoy & = delete;
+
+    /// Insert a cartridge, replacing the current one
+    auto insert(Cartridge cartridge) -> void;
+    /// Run for one frame, returns the cycles used
+    auto run_frame() -> u64;
+
+    /// Keep battery RAM in the save file at path, false if the cartridge has
+    /// none or the file cannot be opened
+    auto load_save(std::string_view path) -> bool;
+    /// Flush battery RAM written to its save file every interval cycles, 0
+    /// to only flush when the cartridge is destroyed
+    auto set_save_interval(u64 cycles) -> void;
+    /// Start writing battery RAM back to its save file if it was written
+    auto flush_save() -> void;
+
+    [[nodiscard]] auto cpu() -> Cpu &;
+    [[nodiscard]] auto memory() -> Memory &;
+    [[nodiscard]] auto ppu() -> Ppu &;
+    [[nodiscard]] auto apu() -> Apu &;
+    [[nodiscard]] auto scheduler() -> Scheduler &;
+    /// Inserted cartridge, nullptr if there is none
+    [[nodiscard]] auto cartridge() -> Cartridge *;
+
+  private:
+    auto on_save(u64 deadline) -> void;
+
+  private:
+    Scheduler scheduler_;
+    Memory memory_;
+    Ppu ppu_;
+    Apu apu_;
+    Cpu cpu_;
+    std::optional<Cartridge> cartridge_;
+    u64 save_interval_;
+};
+} // namespace tomboy
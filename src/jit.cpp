@@ -0,0 +1,1249 @@
+#include "jit.hpp"
+
+#include "block_cache.hpp"
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "scheduler.hpp"
+#include "types.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define TOMBOY_JIT_X86_64
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <optional>
+#include <print>
+#include <vector>
+
+namespace tomboy {
+
+/// Size of the code buffer, flushed when full
+constexpr size_t code_buffer_size = 4 * 1024 * 1024;
+/// Executions on the interpreter before a block is translated
+constexpr u32 hot_threshold = 16;
+/// Upper bound on the native code size of one block
+constexpr size_t max_native_block_size = 512 + 320 * 64;
+
+namespace {
+/// Host registers, numbered as in instruction encodings
+enum class Host : u8 {
+    Rax,
+    Rcx,
+    Rdx,
+    Rbx,
+    Rsp,
+    Rbp,
+    Rsi,
+    Rdi,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+};
+
+/// Guest register fields of an opcode, (hl) is 6
+constexpr u8 field_b = 0;
+constexpr u8 field_c = 1;
+constexpr u8 field_d = 2;
+constexpr u8 field_e = 3;
+constexpr u8 field_h = 4;
+constexpr u8 field_l = 5;
+constexpr u8 field_a = 7;
+constexpr std::array<u8, 7> fields = {
+    field_a, field_b, field_c, field_d, field_e, field_h, field_l};
+
+/// Host register each guest register is pinned in while native code runs,
+/// by opcode register field. The CPU is kept in rbx and the state in rbp.
+constexpr std::array<Host, 8> pinned = {Host::R9, Host::R10, Host::R11,
+    Host::R12, Host::R13, Host::R14, Host::Rax, Host::R8};
+constexpr Host pinned_f = Host::R15;
+
+/// Offsets of the native state members, checked against the struct
+constexpr u8 state_budget = 0;
+constexpr u8 state_exit_block = 8;
+constexpr u8 state_exit_jump = 16;
+constexpr u8 state_instructions = 24;
+constexpr u8 state_now = 32;
+
+/// Offsets from the CPU of the state native code touches
+struct Layout {
+    /// Guest registers by opcode register field
+    std::array<i32, 8> registers;
+    i32 f;
+    i32 pc_hi;
+    i32 pc_lo;
+    i32 yield;
+};
+
+using Handler = auto (*)(Cpu *cpu) -> u64;
+using Read = auto (*)(Cpu *cpu, u16 address) -> u8;
+
+constexpr auto code(Host reg) -> u8
+{
+    return static_cast<u8>(reg);
+}
+
+/// Appends x86-64 machine code to a buffer
+class Emitter {
+  public:
+    explicit Emitter(u8 *code);
+
+    auto bytes(std::initializer_list<u8> values) -> void;
+    auto imm32(u32 value) -> void;
+    auto imm64(u64 value) -> void;
+    /// Emit a jump opcode, returns its unpatched 32-bit displacement
+    auto jump(std::initializer_list<u8> opcode) -> u8 *;
+
+    /// Byte operation between registers, opcode r/m8, r8
+    auto op8(u8 opcode, Host rm, Host reg) -> void;
+    /// Byte operation with an immediate, 0x80 /digit ib
+    auto op8_imm(u8 digit, Host rm, u8 value) -> void;
+    /// Byte operation on one register, opcode /digit
+    auto unary8(u8 opcode, u8 digit, Host rm) -> void;
+    /// mov r8, imm8
+    auto mov8_imm(Host reg, u8 value) -> void;
+    /// mov r8, [rbx + offset]
+    auto load8(Host reg, i32 offset) -> void;
+    /// mov [rbx + offset], r8
+    auto store8(i32 offset, Host reg) -> void;
+    /// movzx r32, r8
+    auto movzx8(Host reg, Host rm) -> void;
+
+    [[nodiscard]] auto position() const -> u8 *;
+
+    /// Point a 32-bit displacement at target
+    static auto patch(u8 *displacement, const u8 *target) -> void;
+
+  private:
+    /// Always emitted on byte operations, so encodings 4 to 7 select spl to
+    /// dil rather than ah to bh
+    static auto rex(u8 reg, Host rm) -> u8;
+    static auto modrm(u8 mode, u8 reg, Host rm) -> u8;
+
+  private:
+    u8 *code_;
+    size_t size_;
+};
+
+Emitter::Emitter(u8 *code)
+  : code_(code),
+    size_(0)
+{
+}
+
+auto Emitter::bytes(std::initializer_list<u8> values) -> void
+{
+    for (const u8 value : values) {
+        code_[size_++] = value;
+    }
+}
+
+auto Emitter::imm32(u32 value) -> void
+{
+    std::memcpy(code_ + size_, &value, sizeof(value));
+    size_ += sizeof(value);
+}
+
+auto Emitter::imm64(u64 value) -> void
+{
+    std::memcpy(code_ + size_, &value, sizeof(value));
+    size_ += sizeof(value);
+}
+
+auto Emitter::jump(std::initializer_list<u8> opcode) -> u8 *
+{
+    bytes(opcode);
+    u8 *displacement = position();
+    imm32(0);
+    return displacement;
+}
+
+auto Emitter::op8(u8 opcode, Host rm, Host reg) -> void
+{
+    bytes({rex(code(reg), rm), opcode, modrm(3, code(reg), rm)});
+}
+
+auto Emitter::op8_imm(u8 digit, Host rm, u8 value) -> void
+{
+    bytes({rex(0, rm), 0x80, modrm(3, digit, rm), value});
+}
+
+auto Emitter::unary8(u8 opcode, u8 digit, Host rm) -> void
+{
+    bytes({rex(0, rm), opcode, modrm(3, digit, rm)});
+}
+
+auto Emitter::mov8_imm(Host reg, u8 value) -> void
+{
+    bytes({rex(0, reg), static_cast<u8>(0xB0 + (code(reg) & 7)), value});
+}
+
+auto Emitter::load8(Host reg, i32 offset) -> void
+{
+    bytes({rex(code(reg), Host::Rbx), 0x8A, modrm(2, code(reg), Host::Rbx)});
+    imm32(static_cast<u32>(offset));
+}
+
+auto Emitter::store8(i32 offset, Host reg) -> void
+{
+    bytes({rex(code(reg), Host::Rbx), 0x88, modrm(2, code(reg), Host::Rbx)});
+    imm32(static_cast<u32>(offset));
+}
+
+auto Emitter::movzx8(Host reg, Host rm) -> void
+{
+    bytes({rex(code(reg), rm), 0x0F, 0xB6, modrm(3, code(reg), rm)});
+}
+
+auto Emitter::position() const -> u8 *
+{
+    return code_ + size_;
+}
+
+auto Emitter::patch(u8 *displacement, const u8 *target) -> void
+{
+    const auto offset = static_cast<i32>(target - (displacement + 4));
+    std::memcpy(displacement, &offset, sizeof(offset));
+}
+
+auto Emitter::rex(u8 reg, Host rm) -> u8
+{
+    return static_cast<u8>(0x40 | (reg & 8) >> 1 | (code(rm) & 8) >> 3);
+}
+
+auto Emitter::modrm(u8 mode, u8 reg, Host rm) -> u8
+{
+    return static_cast<u8>(mode << 6 | (reg & 7) << 3 | (code(rm) & 7));
+}
+
+/// Translates the instructions of one block
+///
+/// Cycles and instructions of translated instructions are known when
+/// translating, so they are added up and only written to the state and the
+/// scheduler on the way out of native code or into a handler.
+class Translator {
+  public:
+    /// Cycles and instructions not yet written to the state
+    struct Pending {
+        u32 cycles;
+        u32 instructions;
+    };
+
+  public:
+    /// Code resuming a block at the instruction at pc
+    struct Resume {
+        u16 pc;
+        const u8 *code;
+    };
+
+  public:
+    Translator(u8 *code, const Layout &layout, const Memory &memory,
+        Read read, bool linkable, const u8 *epilogue);
+
+    /// Emit the code shared by all blocks, returns the epilogue. The entry
+    /// at the start saves host registers, loads the guest registers and
+    /// jumps to the code passed in rdx. The epilogue reverses this.
+    auto trampoline() -> const u8 *;
+    /// Leave before the first instruction if the budget is spent or the CPU
+    /// must yield, linked blocks enter here
+    auto enter(u16 pc) -> void;
+    /// Leave before the instruction at pc if the budget is spent, and note
+    /// where to resume at it
+    auto check_budget(u16 pc) -> void;
+    /// Translate an instruction, false if it must call its handler
+    auto translate(u16 index, u16 pc, u16 next) -> bool;
+    /// Call the handler of the instruction at pc, leaving the returned new PC
+    /// in rdx
+    auto call(Handler handler, u16 pc) -> void;
+    /// Leave unless the handler called went on to pc
+    auto leave_unless(u16 pc) -> void;
+    /// Leave towards the computed PC in rdx through link slots
+    auto exit_computed(std::array<u8 *, 2> &links, const void *block) -> void;
+    /// Leave towards a fixed PC through a patchable jump
+    auto exit_to(u16 pc) -> void;
+    /// Emit the deferred exits and resumes, returns the end of the code
+    auto finish() -> u8 *;
+
+    [[nodiscard]] auto position() const -> u8 *;
+    /// Whether the block already left on every path
+    [[nodiscard]] auto closed() const -> bool;
+    [[nodiscard]] auto resumes() const -> const std::vector<Resume> &;
+
+  private:
+    struct Deferred {
+        u8 *jump;
+        Pending pending;
+        u16 pc;
+    };
+
+    /// Instruction the dispatcher may resume at, with what was pending before
+    /// it
+    struct Instruction {
+        u8 *code;
+        Pending pending;
+        u16 pc;
+    };
+
+  private:
+    auto retire(u8 cycles) -> void;
+    auto store_pc(u16 pc) -> void;
+    /// Write pending cycles and instructions to the state and the scheduler
+    auto flush(Pending pending) -> void;
+    /// Store the guest registers, only those in caller-saved host registers
+    /// if caller_saved
+    auto spill(bool caller_saved) -> void;
+    auto reload(bool caller_saved) -> void;
+    /// Read the byte at the guest register pair into eax
+    auto read(u8 hi, u8 lo) -> void;
+    /// Compute F after a byte operation from the host flags. Bits in keep
+    /// are left, bits in computed come from the operation, bits in set are
+    /// set and the others cleared.
+    auto flags(u8 keep, u8 computed, u8 set) -> void;
+    auto alu(u8 operation, Host source) -> void;
+    auto alu_imm(u8 operation, u8 value) -> void;
+    /// Jump taken when condition 0 to 3, nz z nc c, holds
+    auto branch(u8 condition) -> u8 *;
+    auto conditional(u8 condition, u16 next, u16 target, u8 not_taken_cycles,
+        u8 taken_cycles) -> void;
+
+  private:
+    Emitter emitter_;
+    Layout layout_;
+    const Memory *memory_;
+    Read read_;
+    bool linkable_;
+    bool closed_;
+    const u8 *epilogue_;
+    Pending pending_;
+    std::vector<Deferred> deferred_;
+    std::vector<Instruction> instructions_;
+    std::vector<Resume> resumes_;
+    std::vector<u8 *> epilogue_jumps_;
+};
+
+/// x86 opcodes of add, adc, sub, sbc, and, xor, or and cp on r/m8, r8
+constexpr std::array<u8, 8> alu_opcodes = {
+    0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+/// x86 /digit of the same operations on r/m8, imm8
+constexpr std::array<u8, 8> alu_digits = {0, 2, 5, 3, 4, 6, 1, 7};
+
+Translator::Translator(u8 *code, const Layout &layout, const Memory &memory,
+    Read read, bool linkable, const u8 *epilogue)
+  : emitter_(code),
+    layout_(layout),
+    memory_(&memory),
+    read_(read),
+    linkable_(linkable),
+    closed_(false),
+    epilogue_(epilogue),
+    pending_(),
+    deferred_(),
+    instructions_(),
+    resumes_(),
+    epilogue_jumps_()
+{
+}
+
+auto Translator::trampoline() -> const u8 *
+{
+    // Six pushes and eight bytes keep the stack aligned for calls
+    emitter_.bytes({0x53});                   // push rbx
+    emitter_.bytes({0x55});                   // push rbp
+    emitter_.bytes({0x41, 0x54});             // push r12
+    emitter_.bytes({0x41, 0x55});             // push r13
+    emitter_.bytes({0x41, 0x56});             // push r14
+    emitter_.bytes({0x41, 0x57});             // push r15
+    emitter_.bytes({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+    emitter_.bytes({0x48, 0x89, 0xFB});       // mov rbx, rdi
+    emitter_.bytes({0x48, 0x89, 0xF5});       // mov rbp, rsi
+    reload(false);
+    emitter_.bytes({0xFF, 0xE2}); // jmp rdx
+
+    const u8 *epilogue = emitter_.position();
+    spill(false);
+    emitter_.bytes({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+    emitter_.bytes({0x41, 0x5F});             // pop r15
+    emitter_.bytes({0x41, 0x5E});             // pop r14
+    emitter_.bytes({0x41, 0x5D});             // pop r13
+    emitter_.bytes({0x41, 0x5C});             // pop r12
+    emitter_.bytes({0x5D});                   // pop rbp
+    emitter_.bytes({0x5B});                   // pop rbx
+    emitter_.bytes({0xC3});                   // ret
+    return epilogue;
+}
+
+auto Translator::enter(u16 pc) -> void
+{
+    emitter_.bytes({0x48, 0x83, 0x7D, state_budget, 0x00}); // cmp [rbp], 0
+    deferred_.push_back({
+        .jump = emitter_.jump({0x0F, 0x8E}), // jle
+        .pending = {},
+        .pc = pc,
+    });
+    emitter_.bytes({0x80, 0xBB}); // cmp byte [rbx + yield], 0
+    emitter_.imm32(static_cast<u32>(layout_.yield));
+    emitter_.bytes({0x00});
+    deferred_.push_back({
+        .jump = emitter_.jump({0x0F, 0x85}), // jne
+        .pending = {},
+        .pc = pc,
+    });
+}
+
+auto Translator::check_budget(u16 pc) -> void
+{
+    instructions_.push_back({
+        .code = emitter_.position(),
+        .pending = pending_,
+        .pc = pc,
+    });
+    emitter_.bytes({0x48, 0x81, 0x7D, state_budget}); // cmp [rbp], imm32
+    emitter_.imm32(pending_.cycles);
+    deferred_.push_back({
+        .jump = emitter_.jump({0x0F, 0x8E}), // jle
+        .pending = pending_,
+        .pc = pc,
+    });
+}
+
+auto Translator::translate(u16 index, u16 pc, u16 next) -> bool
+{
+    if (index >= 0x100) {
+        return false;
+    }
+    const auto opcode = static_cast<u8>(index);
+    const u8 operand = memory_->read(pc + 1);
+    const u8 dst = opcode >> 3 & 7;
+    const u8 src = opcode & 7;
+    const Host a = pinned[field_a];
+
+    // ld r8, r8 and ld r8, (hl)
+    if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76 && dst != 6) {
+        if (src == 6) {
+            read(field_h, field_l);
+            emitter_.op8(0x88, pinned[dst], Host::Rax);
+            retire(2);
+        }
+        else {
+            if (dst != src) {
+                emitter_.op8(0x88, pinned[dst], pinned[src]);
+            }
+            retire(1);
+        }
+        return true;
+    }
+    // add, adc, sub, sbc, and, xor, or and cp on r8 and (hl)
+    if (opcode >= 0x80 && opcode < 0xC0) {
+        if (src == 6) {
+            read(field_h, field_l);
+            alu(dst, Host::Rax);
+            retire(2);
+        }
+        else {
+            alu(dst, pinned[src]);
+            retire(1);
+        }
+        return true;
+    }
+    // The same on n8
+    if ((opcode & 0xC7) == 0xC6) {
+        alu_imm(dst, operand);
+        retire(2);
+        return true;
+    }
+    // ld r8, n8
+    if ((opcode & 0xC7) == 0x06 && dst != 6) {
+        emitter_.mov8_imm(pinned[dst], operand);
+        retire(2);
+        return true;
+    }
+    // inc r8 and dec r8 leave the carry
+    if ((opcode & 0xC6) == 0x04 && dst != 6) {
+        const bool decrement = (opcode & 1) != 0;
+        emitter_.unary8(0xFE, decrement ? 1 : 0, pinned[dst]);
+        flags(0x1F, 0xA0, decrement ? 0x40 : 0x00);
+        retire(1);
+        return true;
+    }
+
+    const u16 absolute = static_cast<u16>(operand | memory_->read(pc + 2) << 8);
+    const auto relative = static_cast<u16>(next + static_cast<i8>(operand));
+    // Pairs bc, de and hl of the 16-bit increments
+    const u8 pair_hi = opcode >> 4 << 1;
+    const u8 pair_lo = pair_hi + 1;
+    switch (opcode) {
+    case 0x00: // nop
+        retire(1);
+        return true;
+    case 0x03:
+    case 0x13:
+    case 0x23: // inc r16, flags untouched
+        emitter_.op8_imm(0, pinned[pair_lo], 1); // add lo, 1
+        emitter_.op8_imm(2, pinned[pair_hi], 0); // adc hi, 0
+        retire(2);
+        return true;
+    case 0x0B:
+    case 0x1B:
+    case 0x2B:                                   // dec r16
+        emitter_.op8_imm(5, pinned[pair_lo], 1); // sub lo, 1
+        emitter_.op8_imm(3, pinned[pair_hi], 0); // sbb hi, 0
+        retire(2);
+        return true;
+    case 0x0A: // ld a, (bc)
+        read(field_b, field_c);
+        emitter_.op8(0x88, a, Host::Rax);
+        retire(2);
+        return true;
+    case 0x1A: // ld a, (de)
+        read(field_d, field_e);
+        emitter_.op8(0x88, a, Host::Rax);
+        retire(2);
+        return true;
+    case 0x07: // rlca
+    case 0x0F: // rrca
+    case 0x17: // rla
+    case 0x1F: // rra
+        if (opcode >= 0x17) {
+            emitter_.bytes({0x41, 0x0F, 0xBA, 0xE7, 0x04}); // bt r15d, 4
+        }
+        emitter_.unary8(0xD0, opcode >> 3, a);
+        flags(0x0F, 0x10, 0x00);
+        retire(1);
+        return true;
+    case 0x2F:                                    // cpl
+        emitter_.unary8(0xF6, 2, a);              // not a
+        emitter_.bytes({0x41, 0x83, 0xCF, 0x60}); // or r15d, 0x60
+        retire(1);
+        return true;
+    case 0x37:                                    // scf
+        emitter_.bytes({0x41, 0x83, 0xE7, 0x8F}); // and r15d, 0x8F
+        emitter_.bytes({0x41, 0x83, 0xCF, 0x10}); // or r15d, 0x10
+        retire(1);
+        return true;
+    case 0x3F:                                    // ccf
+        emitter_.bytes({0x41, 0x83, 0xE7, 0x9F}); // and r15d, 0x9F
+        emitter_.bytes({0x41, 0x83, 0xF7, 0x10}); // xor r15d, 0x10
+        retire(1);
+        return true;
+    case 0x18: // jr s8
+        retire(3);
+        exit_to(relative);
+        return true;
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38: // jr cc, s8
+        conditional(dst & 3, next, relative, 2, 3);
+        return true;
+    case 0xC3: // jp a16
+        retire(4);
+        exit_to(absolute);
+        return true;
+    case 0xC2:
+    case 0xCA:
+    case 0xD2:
+    case 0xDA: // jp cc, a16
+        conditional(dst & 3, next, absolute, 3, 4);
+        return true;
+    default: return false;
+    }
+}
+
+auto Translator::call(Handler handler, u16 pc) -> void
+{
+    // Translated instructions do not move the PC, and the handler decodes
+    // its operands from it
+    flush(pending_);
+    pending_ = {};
+    store_pc(pc);
+    spill(false);
+    emitter_.bytes({0x48, 0x89, 0xDF}); // mov rdi, rbx
+    emitter_.bytes({0x48, 0xB8});       // mov rax, imm64
+    emitter_.imm64(reinterpret_cast<u64>(handler));
+    emitter_.bytes({0xFF, 0xD0});       // call rax
+
+    // The handler returns cycles | new PC << 16 | invalidated << 32 and has
+    // already moved the scheduler's counter
+    emitter_.bytes({0x0F, 0xB6, 0xC8});                     // movzx ecx, al
+    emitter_.bytes({0x48, 0x29, 0x4D, state_budget});       // sub [rbp], rcx
+    emitter_.bytes({0x48, 0x83, 0x45, state_instructions}); // add [rbp + 24],
+    emitter_.bytes({0x01});                                 //     1
+    emitter_.bytes({0x48, 0x89, 0xC2});                     // mov rdx, rax
+    emitter_.bytes({0x48, 0xC1, 0xEA, 0x10});               // shr rdx, 16
+    reload(false);
+}
+
+auto Translator::leave_unless(u16 pc) -> void
+{
+    emitter_.bytes({0x48, 0x81, 0xFA}); // cmp rdx, imm32
+    emitter_.imm32(pc);
+    epilogue_jumps_.push_back(emitter_.jump({0x0F, 0x85})); // jne
+}
+
+auto Translator::exit_computed(std::array<u8 *, 2> &links, const void *block)
+    -> void
+{
+    // Unlinked slots compare against -1, which no PC matches, and jump to
+    // the exit that follows them
+    std::vector<u8 *> unlinked;
+    if (linkable_) {
+        for (u8 *&slot : links) {
+            slot = emitter_.position();
+            emitter_.bytes({0x48, 0x81, 0xFA}); // cmp rdx, imm32
+            emitter_.imm32(0xFFFF'FFFF);
+            unlinked.push_back(emitter_.jump({0x0F, 0x84})); // je
+        }
+    }
+    for (u8 *jump : unlinked) {
+        Emitter::patch(jump, emitter_.position());
+    }
+    if (linkable_) {
+        emitter_.bytes({0x48, 0xB8}); // mov rax, imm64
+        emitter_.imm64(reinterpret_cast<u64>(block));
+        emitter_.bytes({0x48, 0x89, 0x45, state_exit_block}); // mov [rbp + 8],
+                                                              //     rax
+    }
+    epilogue_jumps_.push_back(emitter_.jump({0xE9})); // jmp
+    closed_ = true;
+}
+
+auto Translator::exit_to(u16 pc) -> void
+{
+    // Linking points the jump at the target's body instead of the code
+    // following it, which stores the PC and hands the jump to the dispatcher
+    flush(pending_);
+    u8 *jump = emitter_.jump({0xE9}); // jmp
+    Emitter::patch(jump, emitter_.position());
+    store_pc(pc);
+    if (linkable_) {
+        emitter_.bytes({0x48, 0xB8}); // mov rax, imm64
+        emitter_.imm64(reinterpret_cast<u64>(jump));
+        emitter_.bytes({0x48, 0x89, 0x45, state_exit_jump}); // mov [rbp + 16],
+                                                             //     rax
+    }
+    epilogue_jumps_.push_back(emitter_.jump({0xE9})); // jmp
+    closed_ = true;
+}
+
+auto Translator::finish() -> u8 *
+{
+    for (const auto &[jump, pending, pc] : deferred_) {
+        Emitter::patch(jump, emitter_.position());
+        flush(pending);
+        store_pc(pc);
+        epilogue_jumps_.push_back(emitter_.jump({0xE9})); // jmp
+    }
+
+    // Resuming inside the block, the cycles and instructions pending there
+    // are taken back first, as they will be written out again on the way out
+    for (const auto &[code, pending, pc] : instructions_) {
+        if (pending.cycles == 0 && pending.instructions == 0) {
+            resumes_.push_back({.pc = pc, .code = code});
+            continue;
+        }
+        resumes_.push_back({.pc = pc, .code = emitter_.position()});
+        emitter_.bytes({0x48, 0x81, 0x45, state_budget}); // add [rbp], imm32
+        emitter_.imm32(pending.cycles);
+        emitter_.bytes({0x48, 0x81, 0x6D, state_instructions}); // sub [rbp +
+        emitter_.imm32(pending.instructions);                   // 24], imm32
+        emitter_.bytes({0x48, 0x8B, 0x45, state_now}); // mov rax, [rbp + 32]
+        emitter_.bytes({0x48, 0x81, 0x28});            // sub [rax], imm32
+        emitter_.imm32(pending.cycles);
+        Emitter::patch(emitter_.jump({0xE9}), code); // jmp
+    }
+
+    for (u8 *jump : epilogue_jumps_) {
+        Emitter::patch(jump, epilogue_);
+    }
+    return emitter_.position();
+}
+
+auto Translator::position() const -> u8 *
+{
+    return emitter_.position();
+}
+
+auto Translator::closed() const -> bool
+{
+    return closed_;
+}
+
+auto Translator::resumes() const -> const std::vector<Resume> &
+{
+    return resumes_;
+}
+
+auto Translator::retire(u8 cycles) -> void
+{
+    pending_.cycles += cycles;
+    pending_.instructions++;
+}
+
+auto Translator::store_pc(u16 pc) -> void
+{
+    emitter_.bytes({0xC6, 0x83}); // mov byte [rbx + pc hi], imm8
+    emitter_.imm32(static_cast<u32>(layout_.pc_hi));
+    emitter_.bytes({static_cast<u8>(pc >> 8)});
+    emitter_.bytes({0xC6, 0x83}); // mov byte [rbx + pc lo], imm8
+    emitter_.imm32(static_cast<u32>(layout_.pc_lo));
+    emitter_.bytes({static_cast<u8>(pc)});
+}
+
+auto Translator::flush(Pending pending) -> void
+{
+    if (pending.cycles != 0) {
+        emitter_.bytes({0x48, 0x81, 0x6D, state_budget}); // sub [rbp], imm32
+        emitter_.imm32(pending.cycles);
+        emitter_.bytes({0x48, 0x8B, 0x45, state_now}); // mov rax, [rbp + 32]
+        emitter_.bytes({0x48, 0x81, 0x00});            // add [rax], imm32
+        emitter_.imm32(pending.cycles);
+    }
+    if (pending.instructions != 0) {
+        emitter_.bytes({0x48, 0x81, 0x45, state_instructions}); // add [rbp +
+        emitter_.imm32(pending.instructions);                   // 24], imm32
+    }
+}
+
+auto Translator::spill(bool caller_saved) -> void
+{
+    for (const u8 field : fields) {
+        if (!caller_saved || pinned[field] <= Host::R11) {
+            emitter_.store8(layout_.registers[field], pinned[field]);
+        }
+    }
+    if (!caller_saved) {
+        emitter_.store8(layout_.f, pinned_f);
+    }
+}
+
+auto Translator::reload(bool caller_saved) -> void
+{
+    for (const u8 field : fields) {
+        if (!caller_saved || pinned[field] <= Host::R11) {
+            emitter_.load8(pinned[field], layout_.registers[field]);
+        }
+    }
+    if (!caller_saved) {
+        emitter_.load8(pinned_f, layout_.f);
+    }
+}
+
+auto Translator::read(u8 hi, u8 lo) -> void
+{
+    // Pages with a host pointer are read in place, the others through the
+    // memory's handlers with the scheduler's counter brought up to date
+    emitter_.movzx8(Host::Rcx, pinned[hi]);
+    emitter_.bytes({0xC1, 0xE1, 0x08}); // shl ecx, 8
+    emitter_.movzx8(Host::Rdx, pinned[lo]);
+    emitter_.bytes({0x09, 0xD1});       // or ecx, edx
+    emitter_.bytes({0x89, 0xC8});       // mov eax, ecx
+    emitter_.bytes({0xC1, 0xE8, 0x08}); // shr eax, 8
+    emitter_.bytes({0x48, 0xBA});       // mov rdx, imm64
+    emitter_.imm64(reinterpret_cast<u64>(memory_->read_pages().data()));
+    emitter_.bytes({0x48, 0x8B, 0x04, 0xC2}); // mov rax, [rdx + rax * 8]
+    emitter_.bytes({0x48, 0x85, 0xC0});       // test rax, rax
+    u8 *slow = emitter_.jump({0x0F, 0x84});   // jz
+    emitter_.bytes({0x0F, 0xB6, 0xC9});       // movzx ecx, cl
+    emitter_.bytes({0x0F, 0xB6, 0x04, 0x08}); // movzx eax, byte [rax + rcx]
+    u8 *done = emitter_.jump({0xE9});         // jmp
+
+    Emitter::patch(slow, emitter_.position());
+    if (pending_.cycles != 0) {
+        emitter_.bytes({0x48, 0x8B, 0x55, state_now}); // mov rdx, [rbp + 32]
+        emitter_.bytes({0x48, 0x81, 0x02});            // add [rdx], imm32
+        emitter_.imm32(pending_.cycles);
+    }
+    spill(true);
+    emitter_.bytes({0x48, 0x89, 0xDF}); // mov rdi, rbx
+    emitter_.bytes({0x89, 0xCE});       // mov esi, ecx
+    emitter_.bytes({0x48, 0xB8});       // mov rax, imm64
+    emitter_.imm64(reinterpret_cast<u64>(read_));
+    emitter_.bytes({0xFF, 0xD0});       // call rax
+    emitter_.bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+    reload(true);
+    if (pending_.cycles != 0) {
+        emitter_.bytes({0x48, 0x8B, 0x55, state_now}); // mov rdx, [rbp + 32]
+        emitter_.bytes({0x48, 0x81, 0x2A});            // sub [rdx], imm32
+        emitter_.imm32(pending_.cycles);
+    }
+    Emitter::patch(done, emitter_.position());
+}
+
+auto Translator::flags(u8 keep, u8 computed, u8 set) -> void
+{
+    // lahf gives ZF in bit 6, AF in bit 4 and CF in bit 0. On byte
+    // operations these are exactly Z, H and C of the Game Boy.
+    emitter_.bytes({0x9F});                   // lahf
+    emitter_.bytes({0x0F, 0xB6, 0xCC});       // movzx ecx, ah
+    emitter_.bytes({0x89, 0xC8});             // mov eax, ecx
+    emitter_.bytes({0x83, 0xE1, 0x50});       // and ecx, 0x50
+    emitter_.bytes({0x01, 0xC9});             // add ecx, ecx
+    emitter_.bytes({0x83, 0xE0, 0x01});       // and eax, 1
+    emitter_.bytes({0xC1, 0xE0, 0x04});       // shl eax, 4
+    emitter_.bytes({0x09, 0xC1});             // or ecx, eax
+    emitter_.bytes({0x81, 0xE1});             // and ecx, imm32
+    emitter_.imm32(computed);
+    emitter_.bytes({0x41, 0x83, 0xE7, keep}); // and r15d, imm8
+    emitter_.bytes({0x41, 0x09, 0xCF});       // or r15d, ecx
+    if (set != 0) {
+        emitter_.bytes({0x41, 0x83, 0xCF, set}); // or r15d, imm8
+    }
+}
+
+auto Translator::alu(u8 operation, Host source) -> void
+{
+    const Host a = pinned[field_a];
+    if (operation == 1 || operation == 3) {
+        emitter_.bytes({0x41, 0x0F, 0xBA, 0xE7, 0x04}); // bt r15d, 4
+    }
+    emitter_.op8(alu_opcodes[operation], a, source);
+    switch (operation) {
+    case 0:
+    case 1: flags(0x0F, 0xB0, 0x00); break;
+    case 4: flags(0x0F, 0x80, 0x20); break;
+    case 5:
+    case 6: flags(0x0F, 0x80, 0x00); break;
+    default: flags(0x0F, 0xB0, 0x40); break;
+    }
+}
+
+auto Translator::alu_imm(u8 operation, u8 value) -> void
+{
+    const Host a = pinned[field_a];
+    if (operation == 1 || operation == 3) {
+        emitter_.bytes({0x41, 0x0F, 0xBA, 0xE7, 0x04}); // bt r15d, 4
+    }
+    emitter_.op8_imm(alu_digits[operation], a, value);
+    switch (operation) {
+    case 0:
+    case 1: flags(0x0F, 0xB0, 0x00); break;
+    case 4: flags(0x0F, 0x80, 0x20); break;
+    case 5:
+    case 6: flags(0x0F, 0x80, 0x00); break;
+    default: flags(0x0F, 0xB0, 0x40); break;
+    }
+}
+
+auto Translator::branch(u8 condition) -> u8 *
+{
+    const u8 mask = condition < 2 ? 0x80 : 0x10;
+    emitter_.bytes({0x41, 0xF6, 0xC7, mask}); // test r15b, imm8
+    // Odd conditions are taken when the flag is set
+    return emitter_.jump({0x0F, (condition & 1) != 0 ? u8{0x85} : u8{0x84}});
+}
+
+auto Translator::conditional(u8 condition, u16 next, u16 target,
+    u8 not_taken_cycles, u8 taken_cycles) -> void
+{
+    u8 *taken = branch(condition);
+    const Pending pending = pending_;
+    retire(not_taken_cycles);
+    exit_to(next);
+    Emitter::patch(taken, emitter_.position());
+    pending_ = pending;
+    retire(taken_cycles);
+    exit_to(target);
+}
+} // namespace
+
+Jit::Jit()
+  : code_(nullptr),
+    code_used_(0),
+    unavailable_(false),
+    trampoline_(nullptr),
+    epilogue_(nullptr),
+    entries_(),
+    blocks_(),
+    generation_(0),
+    differential_(false),
+    mismatches_(0)
+{
+}
+
+Jit::~Jit()
+{
+    release();
+}
+
+auto Jit::run(Cpu &cpu, u64 budget) -> u64
+{
+    if (code_ == nullptr && !allocate()) {
+        return cpu.run_cached(budget);
+    }
+
+    u64 cycles = 0;
+    NativeState previous{};
+    while (cycles < budget && !cpu.yield_) {
+        if (cpu.block_cache_.generation() != generation_ ||
+            code_used_ + max_native_block_size > code_buffer_size) {
+            flush();
+            generation_ = cpu.block_cache_.generation();
+            previous = {};
+        }
+
+        const u16 address = cpu.pc_;
+        const u32 key = BlockCache::key(cpu.memory_->bank(address), address);
+        Entry *entry = &entries_[key];
+        NativeState state{
+            .budget = static_cast<i64>(budget - cycles),
+            .exit_block = nullptr,
+            .exit_jump = nullptr,
+            .instructions = 0,
+            .now = &cpu.scheduler_->now_,
+        };
+        const i64 start_budget = state.budget;
+
+        // A slice usually stops inside a block, resume its native code there
+        // rather than decode a new block. Exits to an address get a block of
+        // their own, which they can be linked to.
+        const bool exited =
+            previous.exit_block != nullptr || previous.exit_jump != nullptr;
+        if (entry->native == nullptr && entry->resume != nullptr && !exited &&
+            !differential_) {
+            cpu.materialize_flags();
+            trampoline_(&cpu, &state, entry->resume);
+            cycles += static_cast<u64>(start_budget - state.budget);
+            cpu.instructions_ += state.instructions;
+            previous = state;
+            continue;
+        }
+
+        if (entry->native == nullptr) {
+            const BlockCache::Block &block = cpu.find_block(address);
+            if (++entry->executions >= hot_threshold) {
+                NativeBlock *native = compile(cpu, block);
+                if (code_ == nullptr) {
+                    return cycles + cpu.run_cached(budget - cycles);
+                }
+                // Compiling adds resumes, which may move the entry
+                entry = &entries_[key];
+                entry->native = native;
+            }
+            else {
+                const u64 start = cycles;
+                const u64 executed = cpu.execute_block(block, budget, cycles);
+                cpu.instructions_ += executed;
+                if (block.idle && executed == block.instructions.size() &&
+                    cpu.pc_ == address) {
+                    cpu.skip_idle_loop(
+                        cycles - start, executed, budget, cycles);
+                }
+                previous = {};
+                continue;
+            }
+        }
+        NativeBlock &native = *entry->native;
+
+        // Links bypass the bank lookup, so never link into a region whose
+        // bank may be switched. Differential mode runs one block at a time.
+        if (!differential_ && !cpu.memory_->switchable(address)) {
+            link(previous, native, address);
+        }
+
+        execute(cpu, native, state);
+        const auto used = static_cast<u64>(start_budget - state.budget);
+        cycles += used;
+        cpu.instructions_ += state.instructions;
+        previous = state;
+        if (native.idle && state.instructions == native.count &&
+            cpu.pc_ == address) {
+            cpu.skip_idle_loop(used, state.instructions, budget, cycles);
+        }
+    }
+    return cycles;
+}
+
+auto Jit::allocate() -> bool
+{
+    if (unavailable_) {
+        return false;
+    }
+#ifdef TOMBOY_JIT_X86_64
+    // Mapped writable only, pages are made executable once translated
+    void *code = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+        code_ = static_cast<u8 *>(code);
+        return true;
+    }
+    std::println(std::cerr, "JIT unavailable, executable memory was refused.");
+#endif
+    unavailable_ = true;
+    return false;
+}
+
+auto Jit::release() -> void
+{
+#ifdef TOMBOY_JIT_X86_64
+    if (code_ != nullptr) {
+        munmap(code_, code_buffer_size);
+    }
+#endif
+    code_ = nullptr;
+    flush();
+}
+
+auto Jit::protect(u8 *code, size_t size, bool writable) const -> bool
+{
+#ifdef TOMBOY_JIT_X86_64
+    const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto first = reinterpret_cast<uintptr_t>(code) & ~(page - 1);
+    const auto last = std::min(reinterpret_cast<uintptr_t>(code + size),
+        reinterpret_cast<uintptr_t>(code_ + code_buffer_size));
+    const int protection =
+        writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+    return mprotect(reinterpret_cast<void *>(first), last - first,
+               protection) == 0;
+#else
+    return false;
+#endif
+}
+
+auto Jit::compile(Cpu &cpu, const BlockCache::Block &block)
+    -> NativeBlock *
+{
+    static_assert(offsetof(NativeState, budget) == state_budget);
+    static_assert(offsetof(NativeState, exit_block) == state_exit_block);
+    static_assert(offsetof(NativeState, exit_jump) == state_exit_jump);
+    static_assert(offsetof(NativeState, instructions) == state_instructions);
+    static_assert(offsetof(NativeState, now) == state_now);
+
+    const auto offset = [&cpu](const void *member) {
+        return static_cast<i32>(static_cast<const u8 *>(member) -
+                                reinterpret_cast<const u8 *>(&cpu));
+    };
+    Layout layout{};
+    layout.registers[field_a] = offset(&cpu.af_.hi());
+    layout.registers[field_b] = offset(&cpu.bc_.hi());
+    layout.registers[field_c] = offset(&cpu.bc_.lo());
+    layout.registers[field_d] = offset(&cpu.de_.hi());
+    layout.registers[field_e] = offset(&cpu.de_.lo());
+    layout.registers[field_h] = offset(&cpu.hl_.hi());
+    layout.registers[field_l] = offset(&cpu.hl_.lo());
+    layout.f = offset(&cpu.af_.lo());
+    layout.pc_hi = offset(&cpu.pc_.hi());
+    layout.pc_lo = offset(&cpu.pc_.lo());
+    layout.yield = offset(&cpu.yield_);
+
+    u8 *const first = code_ + code_used_;
+    if (!protect(first, max_native_block_size, true)) {
+        std::println(std::cerr, "JIT unavailable, code could not be written.");
+        unavailable_ = true;
+        release();
+        return nullptr;
+    }
+    u8 *code = first;
+    if (code_used_ == 0) {
+        Translator shared(
+            code, layout, *cpu.memory_, &Jit::read, false, nullptr);
+        trampoline_ = reinterpret_cast<NativeEntry>(code);
+        epilogue_ = shared.trampoline();
+        code = shared.position();
+    }
+
+    // Blocks ending in an instruction that yields to run_for must return,
+    // so they are never linked, and neither are idle loops so the
+    // dispatcher can skip their iterations
+    NativeBlock &native = blocks_.emplace_back();
+    const bool linkable =
+        !block.idle && !Cpu::yields(block.instructions.back().index);
+    native.link_count = linkable ? 0 : native.links.size();
+    native.idle = block.idle;
+    native.count = block.instructions.size();
+
+    Translator translator(
+        code, layout, *cpu.memory_, &Jit::read, linkable, epilogue_);
+    native.body = translator.position();
+    translator.enter(block.address);
+
+    u16 address = block.address;
+    for (size_t i = 0; i < block.instructions.size(); i++) {
+        const auto [index, length] = block.instructions[i];
+        const auto next = static_cast<u16>(address + length);
+        if (i != 0) {
+            translator.check_budget(address);
+        }
+        if (!translator.translate(index, address, next)) {
+            translator.call(Cpu::native_handlers[index], address);
+            if (i + 1 < block.instructions.size()) {
+                translator.leave_unless(next);
+            }
+            else {
+                translator.exit_computed(native.links, &native);
+            }
+        }
+        address = next;
+    }
+    if (!translator.closed()) {
+        translator.exit_to(address);
+    }
+
+    code_used_ = static_cast<size_t>(translator.finish() - code_);
+    for (const auto &[pc, resume] : translator.resumes()) {
+        Entry &entry = entries_[BlockCache::key(block.bank, pc)];
+        if (entry.resume == nullptr) {
+            entry.resume = resume;
+        }
+    }
+    if (!protect(first, max_native_block_size, false)) {
+        std::println(std::cerr, "JIT unavailable, code could not be run.");
+        unavailable_ = true;
+        release();
+        return nullptr;
+    }
+    return &native;
+}
+
+auto Jit::link(const NativeState &exit, const NativeBlock &to, u16 address)
+    -> void
+{
+    if (exit.exit_jump != nullptr) {
+        if (protect(exit.exit_jump, 4, true)) {
+            Emitter::patch(exit.exit_jump, to.body);
+            protect(exit.exit_jump, 4, false);
+        }
+        return;
+    }
+    NativeBlock *from = exit.exit_block;
+    if (from == nullptr || from->link_count >= from->links.size()) {
+        return;
+    }
+    u8 *slot = from->links.at(from->link_count++);
+    if (protect(slot, 13, true)) {
+        const u32 pc = address;
+        std::memcpy(slot + 3, &pc, sizeof(pc));
+        Emitter::patch(slot + 9, to.body);
+        protect(slot, 13, false);
+    }
+}
+
+auto Jit::flush() -> void
+{
+    code_used_ = 0;
+    entries_.clear();
+    blocks_.clear();
+}
+
+auto Jit::execute(Cpu &cpu, const NativeBlock &native, NativeState &state)
+    -> void
+{
+    // Native code reads F directly
+    cpu.materialize_flags();
+    if (!differential_) {
+        trampoline_(&cpu, &state, native.body);
+        return;
+    }
+
+    // Run natively, then rewind the registers and interpret the block on
+    // copies of memory, the cartridge and the scheduler taken beforehand.
+    // The copies report to no PPU, APU or save file, so writes reach those
+    // once. The block is copied too, native code may drop it.
+    const u16 address = cpu.pc_;
+    BlockCache::Block block = cpu.find_block(address);
+    const Registers before = registers(cpu);
+    const bool yield = cpu.yield_;
+    Scheduler scheduler = *cpu.scheduler_;
+    Memory memory = *cpu.memory_;
+    std::optional<Cartridge> cartridge;
+    if (cpu.memory_->cartridge() != nullptr) {
+        cartridge.emplace(*cpu.memory_->cartridge());
+        cartridge->set_clock(&scheduler);
+    }
+    memory.set_block_cache(nullptr);
+    memory.set_tile_cache(nullptr);
+    memory.set_ppu(nullptr);
+    memory.set_apu(nullptr);
+    memory.set_scheduler(&scheduler);
+    memory.set_cartridge(cartridge ? &*cartridge : nullptr);
+    const u64 epoch = cpu.block_cache_.epoch();
+    const i64 budget = state.budget;
+
+    trampoline_(&cpu, &state, native.body);
+    const auto cycles = static_cast<u64>(budget - state.budget);
+    const Registers actual = registers(cpu);
+    const bool actual_yield = cpu.yield_;
+
+    // The copies have no block cache, so stop the interpreter where a write
+    // dropping blocks or switching banks stopped native code
+    if (cpu.block_cache_.epoch() != epoch &&
+        state.instructions < block.instructions.size()) {
+        block.instructions.resize(state.instructions);
+    }
+    Memory *const real_memory = cpu.memory_;
+    Scheduler *const real_scheduler = cpu.scheduler_;
+    set_registers(cpu, before);
+    cpu.yield_ = yield;
+    cpu.memory_ = &memory;
+    cpu.scheduler_ = &scheduler;
+    u64 expected_cycles = 0;
+    const u64 expected_instructions =
+        cpu.execute_block(block, static_cast<u64>(budget), expected_cycles);
+    const Registers expected = registers(cpu);
+    cpu.memory_ = real_memory;
+    cpu.scheduler_ = real_scheduler;
+    set_registers(cpu, actual);
+    cpu.yield_ = actual_yield;
+
+    const bool same_memory = memory.vram() == real_memory->vram() &&
+                             memory.wram() == real_memory->wram() &&
+                             memory.oam() == real_memory->oam();
+    if (actual != expected || cycles != expected_cycles ||
+        state.instructions != expected_instructions || !same_memory) {
+        mismatches_++;
+        std::println(std::cerr,
+            "JIT mismatch in block 0x{:04x}: expected pc=0x{:04x} "
+            "af=0x{:04x} bc=0x{:04x} de=0x{:04x} hl=0x{:04x} sp=0x{:04x} "
+            "cycles={}, got pc=0x{:04x} af=0x{:04x} bc=0x{:04x} de=0x{:04x} "
+            "hl=0x{:04x} sp=0x{:04x} cycles={}{}",
+            address, expected.pc, expected.af, expected.bc, expected.de,
+            expected.hl, expected.sp, expected_cycles, actual.pc, actual.af,
+            actual.bc, actual.de, actual.hl, actual.sp, cycles,
+            same_memory ? "" : ", memory differs");
+    }
+}
+
+auto Jit::read(Cpu *cpu, u16 address) -> u8
+{
+    return cpu->memory_->read(address);
+}
+
+auto Jit::registers(const Cpu &cpu) -> Registers
+{
+    return {
+        .af = static_cast<u16>(cpu.af_.hi() << 8 | cpu.flags()),
+        .bc = cpu.bc_,
+        .de = cpu.de_,
+        .hl = cpu.hl_,
+        .sp = cpu.sp_,
+        .pc = cpu.pc_,
+        .halted = cpu.halted_,
+        .ime = cpu.ime_,
+    };
+}
+
+auto Jit::set_registers(Cpu &cpu, const Registers &registers) -> void
+{
+    cpu.af_ = registers.af;
+    cpu.flag_op_ = Cpu::FlagOp::None;
+    cpu.bc_ = registers.bc;
+    cpu.de_ = registers.de;
+    cpu.hl_ = registers.hl;
+    cpu.sp_ = registers.sp;
+    cpu.pc_ = registers.pc;
+    cpu.halted_ = registers.halted;
+    cpu.ime_ = registers.ime;
+}
+} // namespace tomboy
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "block_cache.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstddef>
+#include <deque>
+#include <unordered_map>
+
+namespace tomboy {
+class Cpu;
+}
+
+namespace tomboy {
+/// x86-64 backend translating hot basic blocks into native code
+///
+/// Loads, 8-bit arithmetic, increments, rotates of A and branches become host
+/// instructions on the guest registers, which stay pinned in host registers
+/// while native code runs. Other instructions call their handler, with the
+/// registers written back around the call. Exits towards another translated
+/// block are linked so control passes between them without returning to the
+/// dispatcher. Blocks run on the interpreter until they become hot, and
+/// whenever native code is unavailable.
+class Jit {
+  public:
+    Jit();
+    ~Jit();
+
+    Jit(const Jit &) = delete;
+    auto operator=(const Jit &) -> Jit & = delete;
+
+    /// Run until at least budget cycles have elapsed, returns the cycles used
+    auto run(Cpu &cpu, u64 budget) -> u64;
+
+    /// Interpret each native block again from the state it started in,
+    /// comparing registers and memory
+    auto set_differential(bool differential) -> void;
+    /// Number of blocks whose native and interpreted results differed
+    [[nodiscard]] auto mismatches() const -> u64;
+
+  private:
+    struct NativeBlock;
+
+    /// State shared between the dispatcher and native code
+    struct NativeState {
+        /// Cycles left to run, negative once overshot
+        i64 budget;
+        /// Block whose exit to a computed address was taken
+        NativeBlock *exit_block;
+        /// Jump of the exit to a fixed address taken
+        u8 *exit_jump;
+        /// Instructions executed
+        u64 instructions;
+        /// Scheduler's counter, kept current for the handlers called
+        u64 *now;
+    };
+
+    /// Loads the registers and jumps to code
+    using NativeEntry = auto (*)(Cpu *cpu, NativeState *state, const u8 *code)
+        -> void;
+
+    struct NativeBlock {
+        /// Entered from the dispatcher and jumped to from linked blocks
+        u8 *body;
+        /// Patchable compare and jump to a linked block, for exits to a
+        /// computed address
+        std::array<u8 *, 2> links;
+        u8 link_count;
+        /// Idle loop, see BlockCache::Block
+        bool idle;
+        /// Instructions in the block
+        size_t count;
+    };
+
+    struct Entry {
+        u32 executions;
+        /// Block starting at the address
+        NativeBlock *native;
+        /// Code resuming a block at an instruction within it
+        const u8 *resume;
+    };
+
+    struct Registers {
+        u16 af;
+        u16 bc;
+        u16 de;
+        u16 hl;
+        u16 sp;
+        u16 pc;
+        bool halted;
+        bool ime;
+
+        auto operator==(const Registers &) const -> bool = default;
+    };
+
+  private:
+    /// Map the code buffer, returns false if native code is unavailable
+    auto allocate() -> bool;
+    /// Unmap the code buffer and stay on the interpreter
+    auto release() -> void;
+    /// Make part of the code buffer writable or executable
+    auto protect(u8 *code, size_t size, bool writable) const -> bool;
+    /// Translate a decoded block, nullptr if the code cannot be made
+    /// executable
+    auto compile(Cpu &cpu, const BlockCache::Block &block) -> NativeBlock *;
+    /// Patch the exit taken to jump to a block starting at address
+    auto link(const NativeState &exit, const NativeBlock &to, u16 address)
+        -> void;
+    /// Drop all native code
+    auto flush() -> void;
+
+    /// Run a native block, comparing with the interpreter if differential
+    auto execute(Cpu &cpu, const NativeBlock &native, NativeState &state)
+        -> void;
+
+    /// Memory read called from native code on pages read through a handler
+    static auto read(Cpu *cpu, u16 address) -> u8;
+
+    [[nodiscard]] static auto registers(const Cpu &cpu) -> Registers;
+    static auto set_registers(Cpu &cpu, const Registers &registers) -> void;
+
+  private:
+    u8 *code_;
+    size_t code_used_;
+    bool unavailable_;
+    /// Shared entry and exit of native code, at the start of the buffer
+    NativeEntry trampoline_;
+    const u8 *epilogue_;
+    std::unordered_map<u32, Entry> entries_;
+    std::deque<NativeBlock> blocks_;
+    u64 generation_;
+    bool differential_;
+    u64 mismatches_;
+};
+
+inline auto Jit::set_differential(bool differential) -> void
+{
+    differential_ = differential;
+}
+
+inline auto Jit::mismatches() const -> u64
+{
+    return mismatches_;
+}
+} // namespace tomboy
@@ -1,51 +1,685 @@
+#include "apu.hpp"
+#include "audio.hpp"
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "display.hpp"
+#include "frame_converter.hpp"
+#include "frame_pacer.hpp"
+#include "gameboy.hpp"
+#include "memory.hpp"
+#include "ppu.hpp"
+#include "rom.hpp"
+#include "scheduler.hpp"
+#include "tile_decoder.hpp"
+#include "triple_buffer.hpp"
+
 #include <SDL3/SDL.h>
 
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
-constexpr int screen_width = 160;
-constexpr int screen_height = 144;
 constexpr int screen_multiplier = 4;
 
+using Frame = std::array<tomboy::u32, tomboy::Ppu::width * tomboy::Ppu::height>;
+
+struct Options {
+    std::string_view rom_path;
+    tomboy::Cpu::Core core = tomboy::Cpu::default_core;
+    tomboy::Ppu::Accuracy ppu_accuracy = tomboy::Ppu::Accuracy::Scanline;
+    /// Skip drawing this many of every frame_period frames
+    tomboy::u32 frame_skip = 0;
+    tomboy::u32 frame_period = 1;
+    tomboy::FrameConverter::Filter filter =
+        tomboy::FrameConverter::Filter::Nearest;
+    /// Pace frames by the display's refresh instead of the emulated rate
+    bool vsync = false;
+    /// Audio output rate, 0 to play nothing
+    tomboy::u32 sample_rate = 48000;
+    /// Compare JIT blocks against the interpreter
+    bool differential = false;
+    /// Run headless for this many frames and report the throughput
+    tomboy::u64 benchmark_frames = 0;
+    /// Decode this many tiles with each kernel and report the throughput
+    tomboy::u64 benchmark_tiles = 0;
+    /// Run this many instructions of a generated mix on each kind of
+    /// dispatch and report the throughput
+    tomboy::u64 benchmark_dispatch = 0;
+    /// Start this many consoles sharing the ROM and report their footprint
+    tomboy::u64 instances = 0;
+    /// Emulated seconds between flushes of battery RAM, 0 to flush on exit
+    tomboy::u64 save_interval = 1;
+};
+
+/// Whole number spanning all of text, reported if it is not one
+template <class T>
+auto parse_number(std::string_view text) -> std::optional<T>
+{
+    T value = 0;
+    const char *end = text.data() + text.size();
+    const auto [last, error] = std::from_chars(text.data(), end, value);
+    if (error != std::errc() || last != end) {
+        std::println(std::cerr, "Invalid number: {}", text);
+        return std::nullopt;
+    }
+    return value;
+}
+
+auto parse_options(std::span<char *> args) -> std::optional<Options>
+{
+    Options options;
+    for (size_t i = 1; i < args.size(); i++) {
+        const std::string_view arg = args[i];
+        if (arg == "--core" && i + 1 < args.size()) {
+            const std::string_view core = args[++i];
+            if (core == "table") {
+                options.core = tomboy::Cpu::Core::Table;
+            }
+            else if (core == "switch") {
+                options.core = tomboy::Cpu::Core::Switch;
+            }
+            else if (core == "threaded") {
+                options.core = tomboy::Cpu::Core::Threaded;
+            }
+            else if (core == "cached") {
+                options.core = tomboy::Cpu::Core::Cached;
+            }
+            else if (core == "jit") {
+                options.core = tomboy::Cpu::Core::Jit;
+            }
+            else {
+                std::println(std::cerr, "Unknown core: {}", core);
+                return std::nullopt;
+            }
+        }
+        else if (arg == "--ppu" && i + 1 < args.size()) {
+            const std::string_view accuracy = args[++i];
+            if (accuracy == "scanline") {
+                options.ppu_accuracy = tomboy::Ppu::Accuracy::Scanline;
+            }
+            else if (accuracy == "timing") {
+                options.ppu_accuracy = tomboy::Ppu::Accuracy::Timing;
+            }
+            else {
+                std::println(std::cerr, "Unknown PPU accuracy: {}", accuracy);
+                return std::nullopt;
+            }
+        }
+        else if (arg == "--frame-skip" && i + 1 < args.size()) {
+            // Given as skipped/period, such as 3/4 to draw every fourth frame
+            const std::string_view ratio = args[++i];
+            const size_t slash = ratio.find('/');
+            if (slash == std::string_view::npos) {
+                std::println(std::cerr, "Frame skip must be skipped/period");
+                return std::nullopt;
+            }
+            const std::optional<tomboy::u32> skip =
+                parse_number<tomboy::u32>(ratio.substr(0, slash));
+            const std::optional<tomboy::u32> period =
+                parse_number<tomboy::u32>(ratio.substr(slash + 1));
+            if (!skip || !period) {
+                return std::nullopt;
+            }
+            options.frame_skip = *skip;
+            options.frame_period = *period;
+            if (options.frame_period == 0 ||
+                options.frame_skip > options.frame_period) {
+                std::println(std::cerr, "Invalid frame skip: {}", ratio);
+                return std::nullopt;
+            }
+        }
+        else if (arg == "--filter" && i + 1 < args.size()) {
+            const std::string_view filter = args[++i];
+            if (filter == "nearest") {
+                options.filter = tomboy::FrameConverter::Filter::Nearest;
+            }
+            else if (filter == "scale2x") {
+                options.filter = tomboy::FrameConverter::Filter::Scale2x;
+            }
+            else {
+                std::println(std::cerr, "Unknown filter: {}", filter);
+                return std::nullopt;
+            }
+        }
+        else if (arg == "--vsync") {
+            options.vsync = true;
+        }
+        else if (arg == "--sample-rate" && i + 1 < args.size()) {
+            const std::optional<tomboy::u32> rate =
+                parse_number<tomboy::u32>(args[++i]);
+            if (!rate) {
+                return std::nullopt;
+            }
+            options.sample_rate = *rate;
+        }
+        else if (arg == "--differential") {
+            options.differential = true;
+        }
+        else if (arg == "--benchmark" && i + 1 < args.size()) {
+            const std::optional<tomboy::u64> frames =
+                parse_number<tomboy::u64>(args[++i]);
+            if (!frames) {
+                return std::nullopt;
+            }
+            options.benchmark_frames = *frames;
+        }
+        else if (arg == "--benchmark-tiles" && i + 1 < args.size()) {
+            const std::optional<tomboy::u64> tiles =
+                parse_number<tomboy::u64>(args[++i]);
+            if (!tiles) {
+                return std::nullopt;
+            }
+            options.benchmark_tiles = *tiles;
+        }
+        else if (arg == "--benchmark-dispatch" && i + 1 < args.size()) {
+            const std::optional<tomboy::u64> instructions =
+                parse_number<tomboy::u64>(args[++i]);
+            if (!instructions) {
+                return std::nullopt;
+            }
+            options.benchmark_dispatch = *instructions;
+        }
+        else if (arg == "--instances" && i + 1 < args.size()) {
+            const std::optional<tomboy::u64> instances =
+                parse_number<tomboy::u64>(args[++i]);
+            if (!instances) {
+                return std::nullopt;
+            }
+            options.instances = *instances;
+        }
+        else if (arg == "--save-interval" && i + 1 < args.size()) {
+            const std::optional<tomboy::u64> interval =
+                parse_number<tomboy::u64>(args[++i]);
+            if (!interval) {
+                return std::nullopt;
+            }
+            options.save_interval = *interval;
+        }
+        else if (options.rom_path.empty()) {
+            options.rom_path = arg;
+        }
+        else {
+            std::println(std::cerr, "Unexpected argument: {}", arg);
+            return std::nullopt;
+        }
+    }
+    return options;
+}
+
+auto load_cartridge(const std::shared_ptr<const tomboy::Rom> &rom,
+    tomboy::GameBoy &gameboy) -> bool
+{
+    std::optional<tomboy::Cartridge> cartridge =
+        tomboy::Cartridge::from_rom(rom);
+    if (!cartridge) {
+        return false;
+    }
+    gameboy.insert(std::move(*cartridge));
+    return true;
+}
+
+/// Resident set size of the process in bytes, if the platform reports it
+auto resident_bytes() -> std::optional<tomboy::u64>
+{
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    tomboy::u64 size = 0;
+    tomboy::u64 resident = 0;
+    if (statm >> size >> resident) {
+        return resident * static_cast<tomboy::u64>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return std::nullopt;
+}
+
+auto core_name(tomboy::Cpu::Core core) -> std::string_view
+{
+    switch (core) {
+    case tomboy::Cpu::Core::Table: return "Table";
+    case tomboy::Cpu::Core::Switch: return "Switch";
+    case tomboy::Cpu::Core::Threaded: return "Threaded";
+    case tomboy::Cpu::Core::Cached: return "Cached";
+    case tomboy::Cpu::Core::Jit: return "JIT";
+    }
+    return "Unknown";
+}
+
+auto benchmark(std::span<const std::unique_ptr<tomboy::GameBoy>> gameboys,
+    tomboy::u64 frames) -> void
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (tomboy::u64 frame = 0; frame < frames; frame++) {
+        for (const auto &gameboy : gameboys) {
+            gameboy->run_frame();
+        }
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    tomboy::u64 instructions = 0;
+    tomboy::u64 cycles = 0;
+    tomboy::u64 halted_cycles = 0;
+    tomboy::u64 idle_cycles = 0;
+    tomboy::u64 mismatches = 0;
+    for (const auto &gameboy : gameboys) {
+        tomboy::Cpu &cpu = gameboy->cpu();
+        instructions += cpu.instructions();
+        cycles += cpu.cycles();
+        halted_cycles += cpu.halted_cycles();
+        idle_cycles += cpu.idle_cycles();
+        mismatches += cpu.jit().mismatches();
+    }
+
+    const tomboy::Cpu::Core core = gameboys.front()->cpu().core();
+    std::println("{} core: {} frames, {} instructions, {} cycles in {:.3f} s",
+        core_name(core), frames * gameboys.size(), instructions, cycles,
+        elapsed.count());
+    std::println("{:.0f} instructions per second, {:.1f}x real time",
+        static_cast<double>(instructions) / elapsed.count(),
+        static_cast<double>(cycles) /
+            static_cast<double>(tomboy::Scheduler::cycles_per_second) /
+            elapsed.count());
+    std::println("{} cycles skipped while halted, {} in idle loops",
+        halted_cycles, idle_cycles);
+    if (core == tomboy::Cpu::Core::Jit) {
+        std::println("{} JIT mismatches", mismatches);
+    }
+}
+
+auto kernel_name(tomboy::TileDecoder::Kernel kernel) -> std::string_view
+{
+    switch (kernel) {
+    case tomboy::TileDecoder::Kernel::Scalar: return "Scalar";
+    case tomboy::TileDecoder::Kernel::Sse2: return "SSE2";
+    case tomboy::TileDecoder::Kernel::Avx2: return "AVX2";
+    case tomboy::TileDecoder::Kernel::Bmi2: return "BMI2";
+    }
+    return "Unknown";
+}
+
+/// Decode a bank of tile data over and over with each kernel
+auto benchmark_tiles(tomboy::u64 tiles) -> void
+{
+    constexpr size_t bank_tiles = 384;
+    std::vector<tomboy::u8> data(bank_tiles * 16);
+    tomboy::u32 seed = 1;
+    for (tomboy::u8 &byte : data) {
+        seed = seed * 1664525 + 1013904223;
+        byte = static_cast<tomboy::u8>(seed >> 24);
+    }
+    std::vector<tomboy::u8> pixels(bank_tiles * 64);
+
+    const tomboy::TileDecoder::Kernel best = tomboy::TileDecoder::best();
+    for (const tomboy::TileDecoder::Kernel kernel :
+        {tomboy::TileDecoder::Kernel::Scalar,
+            tomboy::TileDecoder::Kernel::Sse2,
+            tomboy::TileDecoder::Kernel::Avx2,
+            tomboy::TileDecoder::Kernel::Bmi2}) {
+        if (!tomboy::TileDecoder::supported(kernel)) {
+            std::println("{} kernel: unsupported", kernel_name(kernel));
+            continue;
+        }
+        const tomboy::TileDecoder decoder(kernel);
+        const auto start = std::chrono::steady_clock::now();
+        tomboy::u64 decoded = 0;
+        while (decoded < tiles) {
+            decoder.decode(data.data(), bank_tiles * 8, pixels.data());
+            decoded += bank_tiles;
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::println("{} kernel: {} tiles in {:.3f} s, {:.0f} tiles per "
+                     "second{}",
+            kernel_name(kernel), decoded, elapsed.count(),
+            static_cast<double>(decoded) / elapsed.count(),
+            kernel == best ? " (default)" : "");
+    }
+}
+
+/// ROM looping over a random mix of loads, ALU ops, rotates, shifts, bit
+/// operations, stack pairs and branches to the next instruction. H and L
+/// are never written, so every access through HL stays in WRAM.
+auto dispatch_rom() -> std::shared_ptr<const tomboy::Rom>
+{
+    // B, C, D, E and A in operand order, (HL) is 6
+    constexpr std::array<tomboy::u8, 5> registers = {0, 1, 2, 3, 7};
+    constexpr std::array<tomboy::u8, 16> immediates = {0x06, 0x0E, 0x16,
+        0x1E, 0x3E, 0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE, 0x20,
+        0x28, 0x30};
+    constexpr std::array<tomboy::u8, 18> singles = {0x00, 0x03, 0x0B, 0x13,
+        0x1B, 0x04, 0x0C, 0x14, 0x1C, 0x3C, 0x05, 0x3D, 0x07, 0x0F, 0x17,
+        0x1F, 0x27, 0x2F};
+
+    constexpr tomboy::u16 entry = 0x0150;
+    constexpr tomboy::u16 loop = 0x0157;
+    constexpr tomboy::u16 end = 0x3FF0;
+    std::vector<tomboy::u8> bytes(0x8000);
+    tomboy::u16 address = 0x0100;
+    const auto emit = [&](std::initializer_list<tomboy::u8> code) {
+        for (const tomboy::u8 byte : code) {
+            bytes[address++] = byte;
+        }
+    };
+
+    emit({0x00, 0xC3, entry & 0xFF, entry >> 8}); // nop; jp entry
+    address = entry;
+    emit({0x31, 0xF0, 0xDF}); // ld sp, 0xDFF0
+    emit({0x21, 0x00, 0xC0}); // ld hl, 0xC000
+    emit({0xF3});             // di
+
+    tomboy::u32 seed = 1;
+    const auto random = [&seed](size_t count) {
+        seed = seed * 1664525 + 1013904223;
+        return static_cast<tomboy::u8>((seed >> 16) % count);
+    };
+    while (address < end) {
+        const tomboy::u8 target = registers[random(registers.size())];
+        const tomboy::u8 source =
+            random(6) == 0 ? 6 : registers[random(registers.size())];
+        switch (random(8)) {
+        case 0: // ld r, r and ld r, (hl)
+            emit({static_cast<tomboy::u8>(0x40 | target << 3 | source)});
+            break;
+        case 1: // ld (hl), r
+            emit({static_cast<tomboy::u8>(0x70 | target)});
+            break;
+        case 2:
+        case 3: // ALU op on A with any operand
+            emit({static_cast<tomboy::u8>(0x80 | random(0x40))});
+            break;
+        case 4: { // Immediate loads and ALU ops, or jr cc to the next
+            const tomboy::u8 opcode = immediates[random(immediates.size())];
+            const bool branch = (opcode & 0xE7) == 0x20;
+            emit({opcode, branch ? tomboy::u8{0} : random(0x100)});
+            break;
+        }
+        case 5: emit({singles[random(singles.size())]}); break;
+        case 6: // Prefixed op on a register or (hl)
+            emit({0xCB,
+                static_cast<tomboy::u8>((random(0x100) & 0xF8) | source)});
+            break;
+        case 7: emit({0xC5, 0xD1}); break; // push bc; pop de
+        }
+    }
+    emit({0xC3, loop & 0xFF, loop >> 8}); // jp loop
+    return tomboy::Rom::from_bytes(std::move(bytes));
+}
+
+/// Run the generated mix on the switch, table and threaded cores
+auto benchmark_dispatch(tomboy::u64 instructions) -> void
+{
+    const std::shared_ptr<const tomboy::Rom> rom = dispatch_rom();
+    for (const tomboy::Cpu::Core core :
+        {tomboy::Cpu::Core::Switch, tomboy::Cpu::Core::Table,
+            tomboy::Cpu::Core::Threaded}) {
+        tomboy::GameBoy gameboy(core);
+        if (!load_cartridge(rom, gameboy)) {
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        while (gameboy.cpu().instructions() < instructions) {
+            gameboy.run_frame();
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        const tomboy::u64 executed = gameboy.cpu().instructions();
+        std::println("{} dispatch: {} instructions in {:.3f} s, {:.0f} "
+                     "instructions per second",
+            core_name(core), executed, elapsed.count(),
+            static_cast<double>(executed) / elapsed.count());
+    }
+}
+
+/// Time between frames on real hardware, 59.73 frames per second
+auto frame_period() -> tomboy::FramePacer::Clock::duration
+{
+    return std::chrono::duration_cast<tomboy::FramePacer::Clock::duration>(
+        std::chrono::duration<double>(
+            static_cast<double>(tomboy::GameBoy::cycles_per_frame) /
+            static_cast<double>(tomboy::Scheduler::cycles_per_second)));
+}
+
+auto key_button(SDL_Keycode key) -> std::optional<tomboy::Memory::Button>
+{
+    switch (key) {
+    case SDLK_RIGHT: return tomboy::Memory::Button::Right;
+    case SDLK_LEFT: return tomboy::Memory::Button::Left;
+    case SDLK_UP: return tomboy::Memory::Button::Up;
+    case SDLK_DOWN: return tomboy::Memory::Button::Down;
+    case SDLK_X: return tomboy::Memory::Button::A;
+    case SDLK_Z: return tomboy::Memory::Button::B;
+    case SDLK_BACKSPACE: return tomboy::Memory::Button::Select;
+    case SDLK_RETURN: return tomboy::Memory::Button::Start;
+    default: return std::nullopt;
+    }
+}
+
+/// Run the console in real time until running is cleared, publishing each
+/// frame and its samples and reading the buttons before each one
+auto emulate(tomboy::GameBoy &gameboy, tomboy::TripleBuffer<Frame> &frames,
+    tomboy::Audio *audio, const std::atomic<tomboy::u8> &buttons,
+    const std::atomic<bool> &running, tomboy::FrameTimes &times) -> void
+{
+    tomboy::FramePacer pacer(frame_period());
+    std::vector<tomboy::i16> samples;
+    while (running.load(std::memory_order_relaxed)) {
+        gameboy.memory().set_buttons(
+            buttons.load(std::memory_order_relaxed));
+        gameboy.run_frame();
+
+        const std::span<const tomboy::u32> framebuffer =
+            gameboy.ppu().framebuffer();
+        std::ranges::copy(framebuffer, frames.back().begin());
+        frames.publish();
+
+        if (audio != nullptr) {
+            tomboy::Apu &apu = gameboy.apu();
+            samples.resize(apu.samples_available() * 2);
+            const size_t count =
+                apu.read_samples(samples.data(), samples.size() / 2);
+            audio->push(samples.data(), count);
+        }
+
+        pacer.wait();
+        times.record();
+    }
+}
+
+auto report_frame_times(std::string_view name, const tomboy::FrameTimes &times)
+    -> void
+{
+    std::println("{} thread: {} frames, {:.3f} ms mean, {:.3f} ms jitter, "
+                 "{:.3f} ms worst",
+        name, times.frames(), times.mean() * 1000.0, times.jitter() * 1000.0,
+        times.worst() * 1000.0);
+}
+
 auto main(int argc, char *argv[]) -> int
 {
-    if (!SDL_Init(SDL_INIT_VIDEO)) {
-        std::println(std::cerr, "Initialization failed.\n{}", SDL_GetError());
+    const std::optional<Options> options =
+        parse_options(std::span(argv, argc));
+    if (!options) {
+        std::println(std::cerr,
+            "Usage: tomboy [rom] [--core table|switch|threaded|cached|jit] "
+            "[--ppu scanline|timing] [--frame-skip skipped/period] "
+            "[--filter nearest|scale2x] [--vsync] [--sample-rate hz] "
+            "[--differential] [--benchmark frames] [--benchmark-tiles tiles] "
+            "[--benchmark-dispatch instructions] [--instances count] "
+            "[--save-interval seconds]");
         return -1;
     }
 
-    SDL_Window *window = SDL_CreateWindow("Tom Boy",
-        screen_width * screen_multiplier, screen_height * screen_multiplier, 0);
+    if (options->benchmark_tiles > 0) {
+        benchmark_tiles(options->benchmark_tiles);
+        return 0;
+    }
+
+    if (options->benchmark_dispatch > 0) {
+        benchmark_dispatch(options->benchmark_dispatch);
+        return 0;
+    }
 
-    if (window == nullptr) {
-        std::println(std::cerr, "Window creation failed.\n{}", SDL_GetError());
+    std::shared_ptr<const tomboy::Rom> rom;
+    if (!options->rom_path.empty()) {
+        rom = tomboy::Rom::open(options->rom_path);
+        if (rom == nullptr) {
+            std::println(
+                std::cerr, "Failed to load ROM: {}", options->rom_path);
+            return -1;
+        }
+    }
+
+    // Every console maps the same ROM pages
+    const std::optional<tomboy::u64> resident_before = resident_bytes();
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<tomboy::GameBoy>> gameboys;
+    for (tomboy::u64 i = 0; i < std::max<tomboy::u64>(options->instances, 1);
+        i++) {
+        auto &gameboy = gameboys.emplace_back(
+            std::make_unique<tomboy::GameBoy>(options->core));
+        gameboy->cpu().jit().set_differential(options->differential);
+        gameboy->ppu().set_accuracy(options->ppu_accuracy);
+        gameboy->ppu().set_frame_skip(
+            options->frame_skip, options->frame_period);
+        if (rom != nullptr && !load_cartridge(rom, *gameboy)) {
+            std::println(
+                std::cerr, "Failed to load ROM: {}", options->rom_path);
+            return -1;
+        }
+    }
+    const std::chrono::duration<double, std::milli> startup =
+        std::chrono::steady_clock::now() - start;
+
+    if (options->instances > 0) {
+        std::println("{} instances started in {:.3f} ms, {:.3f} ms each",
+            gameboys.size(), startup.count(),
+            startup.count() / static_cast<double>(gameboys.size()));
+        const std::optional<tomboy::u64> resident_after = resident_bytes();
+        if (resident_before && resident_after) {
+            std::println("{:.1f} KiB resident, {:.1f} KiB per instance",
+                static_cast<double>(*resident_after) / 1024.0,
+                static_cast<double>(*resident_after - *resident_before) /
+                    1024.0 / static_cast<double>(gameboys.size()));
+        }
+    }
+
+    if (options->benchmark_frames > 0) {
+        benchmark(gameboys, options->benchmark_frames);
+        if (const std::optional<tomboy::u64> resident = resident_bytes()) {
+            std::println("{:.1f} KiB resident after running",
+                static_cast<double>(*resident) / 1024.0);
+        }
+        return 0;
+    }
+    tomboy::GameBoy &gameboy = *gameboys.front();
+
+    // Benchmarks leave the save file alone
+    const tomboy::Cartridge *cartridge = gameboy.cartridge();
+    if (cartridge != nullptr && cartridge->has_battery()) {
+        const std::string save_path = std::filesystem::path(options->rom_path)
+                                          .replace_extension(".sav")
+                                          .string();
+        if (!gameboy.load_save(save_path)) {
+            std::println(std::cerr, "Failed to open save file: {}", save_path);
+        }
+        gameboy.set_save_interval(
+            options->save_interval * tomboy::Scheduler::cycles_per_second);
+    }
+
+    if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
+        std::println(std::cerr, "Initialization failed.\n{}", SDL_GetError());
         return -1;
     }
 
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, nullptr);
-    if (renderer == nullptr) {
-        std::println(
-            std::cerr, "Renderer creation failed.\n{}", SDL_GetError());
+    std::unique_ptr<tomboy::Display> display =
+        tomboy::Display::create(
+            screen_multiplier, options->filter, options->vsync);
+    if (display == nullptr) {
+        std::println(std::cerr, "Display creation failed.\n{}", SDL_GetError());
         return -1;
     }
 
-    bool running = true;
-    while (running) {
+    // Carry on silently without a playback device
+    std::unique_ptr<tomboy::Audio> audio;
+    if (options->sample_rate > 0) {
+        audio = tomboy::Audio::create(options->sample_rate);
+        if (audio == nullptr) {
+            std::println(
+                std::cerr, "Audio creation failed.\n{}", SDL_GetError());
+        }
+        else {
+            gameboy.apu().set_sample_rate(options->sample_rate);
+        }
+    }
+
+    // Frames pass to this thread through a triple buffer and the buttons
+    // pass back through an atomic, so neither thread waits on the other
+    auto frames = std::make_unique<tomboy::TripleBuffer<Frame>>();
+    std::atomic<tomboy::u8> buttons = 0;
+    std::atomic<bool> running = true;
+    tomboy::FrameTimes emulation_times;
+    std::thread emulation([&] {
+        emulate(gameboy, *frames, audio.get(), buttons, running,
+            emulation_times);
+    });
+
+    tomboy::FramePacer pacer(frame_period());
+    tomboy::FrameTimes present_times;
+    tomboy::u8 held = 0;
+    while (running.load(std::memory_order_relaxed)) {
         // Poll events
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_EVENT_QUIT) {
-                running = false;
+                running.store(false, std::memory_order_relaxed);
+            }
+            else if (event.type == SDL_EVENT_KEY_DOWN ||
+                     event.type == SDL_EVENT_KEY_UP) {
+                if (const std::optional<tomboy::Memory::Button> button =
+                        key_button(event.key.key)) {
+                    const tomboy::u8 bit = 1 << static_cast<int>(*button);
+                    held = event.key.down ? held | bit : held & ~bit;
+                    buttons.store(held, std::memory_order_relaxed);
+                }
             }
         }
 
-        // Render
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-        SDL_RenderPresent(renderer);
+        // Render the newest frame, or the last one again if none finished
+        frames->update();
+        if (!display->present(frames->front())) {
+            std::println(std::cerr, "Present failed.\n{}", SDL_GetError());
+        }
+        if (!options->vsync) {
+            pacer.wait();
+        }
+        present_times.record();
     }
+    emulation.join();
+
+    report_frame_times("Emulation", emulation_times);
+    report_frame_times("Presentation", present_times);
 
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    audio.reset();
+    display.reset();
     SDL_Quit();
 }
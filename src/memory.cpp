@@ -0,0 +1,718 @@
+#include "memory.hpp"
+
+#include "apu.hpp"
+#include "cartridge.hpp"
+#include "ppu.hpp"
+#include "scheduler.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace tomboy {
+
+constexpr std::array<Memory::IoRegister, 0x100> Memory::io_registers = [] {
+    std::array<IoRegister, 0x100> registers{};
+    // Registers missing on DMG read 0xFF and ignore writes, HRAM and IE are
+    // plain
+    for (size_t i = 0x00; i < 0x80; i++) {
+        registers[i] = {.initial = 0xFF, .read_mask = 0xFF, .write_mask = 0x00};
+    }
+
+    // Joypad, the low bits come from the buttons
+    registers[0x00] = {
+        .initial = 0xCF,
+        .read_mask = 0xC0,
+        .write_mask = 0x30,
+        .read = &Memory::read_joypad,
+    };
+    // Serial
+    registers[0x01] = {};
+    registers[0x02] = {
+        .initial = 0x7E,
+        .read_mask = 0x7E,
+        .write_mask = 0x81,
+        .write = &Memory::write_serial,
+    };
+    // Timer
+    registers[0x04] = {
+        .initial = 0xAB,
+        .read = &Memory::read_div,
+        .write = &Memory::write_div,
+    };
+    registers[0x05] = {
+        .read = &Memory::read_tima,
+        .write = &Memory::write_timer,
+    };
+    registers[0x06] = {.write = &Memory::write_timer};
+    registers[0x07] = {
+        .initial = 0xF8,
+        .read_mask = 0xF8,
+        .write_mask = 0x07,
+        .write = &Memory::write_timer,
+    };
+    registers[0x0F] = {.initial = 0xE1, .read_mask = 0xE0, .write_mask = 0x1F};
+
+    // Sound, lengths and frequencies are write-only
+    registers[0x10] = {.initial = 0x80, .read_mask = 0x80, .write_mask = 0x7F};
+    registers[0x11] = {.initial = 0xBF, .read_mask = 0x3F};
+    registers[0x12] = {.initial = 0xF3};
+    registers[0x13] = {.initial = 0xFF, .read_mask = 0xFF};
+    registers[0x14] = {.initial = 0xBF, .read_mask = 0xBF, .write_mask = 0xC7};
+    registers[0x16] = {.initial = 0x3F, .read_mask = 0x3F};
+    registers[0x17] = {.initial = 0x00};
+    registers[0x18] = {.initial = 0xFF, .read_mask = 0xFF};
+    registers[0x19] = {.initial = 0xBF, .read_mask = 0xBF, .write_mask = 0xC7};
+    registers[0x1A] = {.initial = 0x7F, .read_mask = 0x7F, .write_mask = 0x80};
+    registers[0x1B] = {.initial = 0xFF, .read_mask = 0xFF};
+    registers[0x1C] = {.initial = 0x9F, .read_mask = 0x9F, .write_mask = 0x60};
+    registers[0x1D] = {.initial = 0xFF, .read_mask = 0xFF};
+    registers[0x1E] = {.initial = 0xBF, .read_mask = 0xBF, .write_mask = 0xC7};
+    registers[0x20] = {.initial = 0xFF, .read_mask = 0xFF, .write_mask = 0x3F};
+    registers[0x21] = {.initial = 0x00};
+    registers[0x22] = {.initial = 0x00};
+    registers[0x23] = {.initial = 0xBF, .read_mask = 0xBF, .write_mask = 0xC0};
+    registers[0x24] = {.initial = 0x77};
+    registers[0x25] = {.initial = 0xF3};
+    // Channel status bits are read-only
+    registers[0x26] = {
+        .initial = 0xF1,
+        .read_mask = 0x70,
+        .write_mask = 0x80,
+        .read = &Memory::read_apu_status,
+    };
+    for (size_t i = 0x30; i < 0x40; i++) {
+        registers[i] = {};
+    }
+    for (size_t i = 0x10; i < 0x40; i++) {
+        if (i <= 0x26 || i >= 0x30) {
+            registers[i].write = &Memory::write_apu;
+        }
+    }
+
+    // LCD, the mode and coincidence bits of STAT and LY are read-only
+    registers[0x40] = {.initial = 0x91, .write = &Memory::write_lcd};
+    registers[0x41] = {
+        .initial = 0x85,
+        .read_mask = 0x80,
+        .write_mask = 0x78,
+        .write = &Memory::write_lcd,
+    };
+    registers[0x42] = {};
+    registers[0x43] = {};
+    registers[0x44] = {.initial = 0x00, .write_mask = 0x00};
+    registers[0x45] = {.write = &Memory::write_lcd};
+    registers[0x46] = {.initial = 0xFF, .write = &Memory::write_dma};
+    registers[0x47] = {.initial = 0xFC};
+    registers[0x48] = {.initial = 0xFF};
+    registers[0x49] = {.initial = 0xFF};
+    registers[0x4A] = {};
+    registers[0x4B] = {};
+
+    // Game Boy Color HDMA, the source and destination are write-only
+    for (size_t i = 0x51; i < 0x55; i++) {
+        registers[i] = {.initial = 0xFF, .read_mask = 0xFF};
+    }
+    registers[0x55] = {
+        .initial = 0xFF,
+        .read = &Memory::read_hdma,
+        .write = &Memory::write_hdma,
+    };
+    return registers;
+}();
+
+Memory::Memory()
+  : read_pages_(),
+    write_pages_(),
+    regions_(),
+    banks_()
+{
+    for (size_t i = 0; i < high_.size(); i++) {
+        high_[i] = io_registers[i].initial;
+    }
+    map();
+}
+
+Memory::Memory(const Memory &other)
+  : read_pages_(),
+    write_pages_(),
+    regions_(),
+    banks_(),
+    vram_(other.vram_),
+    wram_(other.wram_),
+    oam_(other.oam_),
+    high_(other.high_),
+    cartridge_(other.cartridge_),
+    block_cache_(nullptr),
+    tile_cache_(other.tile_cache_),
+    scheduler_(other.scheduler_),
+    ppu_(other.ppu_),
+    apu_(other.apu_),
+    div_origin_(other.div_origin_),
+    timer_synced_(other.timer_synced_),
+    buttons_(other.buttons_),
+    oam_dma_(other.oam_dma_),
+    cgb_(other.cgb_),
+    hdma_active_(other.hdma_active_),
+    hdma_source_(other.hdma_source_),
+    hdma_destination_(other.hdma_destination_),
+    hdma_remaining_(other.hdma_remaining_),
+    dirty_(other.dirty_),
+    dirty_shift_(other.dirty_shift_)
+{
+    // Mapping the copy must not drop the blocks of the original
+    map();
+    block_cache_ = other.block_cache_;
+}
+
+auto Memory::operator=(const Memory &other) -> Memory &
+{
+    // Pages point into each instance's own storage, so only copy the storage
+    // and follow the cartridge's banks
+    vram_ = other.vram_;
+    wram_ = other.wram_;
+    oam_ = other.oam_;
+    high_ = other.high_;
+    cartridge_ = other.cartridge_;
+    block_cache_ = other.block_cache_;
+    tile_cache_ = other.tile_cache_;
+    scheduler_ = other.scheduler_;
+    ppu_ = other.ppu_;
+    apu_ = other.apu_;
+    div_origin_ = other.div_origin_;
+    timer_synced_ = other.timer_synced_;
+    buttons_ = other.buttons_;
+    oam_dma_ = other.oam_dma_;
+    cgb_ = other.cgb_;
+    hdma_active_ = other.hdma_active_;
+    hdma_source_ = other.hdma_source_;
+    hdma_destination_ = other.hdma_destination_;
+    hdma_remaining_ = other.hdma_remaining_;
+    dirty_ = other.dirty_;
+    dirty_shift_ = other.dirty_shift_;
+    map_cartridge();
+    // VRAM changed without passing through write
+    if (tile_cache_ != nullptr) {
+        tile_cache_->invalidate_all();
+    }
+    return *this;
+}
+
+auto Memory::set_cartridge(Cartridge *cartridge) -> void
+{
+    cartridge_ = cartridge;
+    map_cartridge();
+    if (block_cache_ != nullptr) {
+        block_cache_->clear();
+    }
+}
+
+auto Memory::set_scheduler(Scheduler *scheduler) -> void
+{
+    scheduler_ = scheduler;
+    if (scheduler != nullptr) {
+        scheduler->set_callback(
+            Scheduler::Event::Dma, Scheduler::bind<&Memory::on_dma>(this));
+        scheduler->set_callback(Scheduler::Event::Timer,
+            Scheduler::bind<&Memory::on_timer>(this));
+        scheduler->set_callback(Scheduler::Event::Serial,
+            Scheduler::bind<&Memory::on_serial>(this));
+    }
+}
+
+auto Memory::set_cgb(bool cgb) -> void
+{
+    cgb_ = cgb;
+}
+
+auto Memory::set_ppu(Ppu *ppu) -> void
+{
+    ppu_ = ppu;
+}
+
+auto Memory::set_apu(Apu *apu) -> void
+{
+    apu_ = apu;
+}
+
+auto Memory::set_buttons(u8 buttons) -> void
+{
+    // Pressing a button pulls its line low, raising the interrupt when its
+    // group is selected
+    const u8 before = read_joypad(0x00);
+    buttons_ = buttons;
+    if ((before & ~read_joypad(0x00) & 0x0F) != 0) {
+        request_interrupt(Interrupt::Joypad);
+    }
+}
+
+auto Memory::hblank() -> void
+{
+    if (hdma_active_) {
+        copy_hdma_chunk();
+    }
+}
+
+auto Memory::set_dirty_tracking(DirtyTracking tracking) -> void
+{
+    switch (tracking) {
+    case DirtyTracking::Off: dirty_shift_ = 0; break;
+    case DirtyTracking::Pages: dirty_shift_ = 8; break;
+    case DirtyTracking::Blocks: dirty_shift_ = 12; break;
+    }
+    dirty_.fill(0);
+}
+
+auto Memory::dirty_tracking() const -> DirtyTracking
+{
+    switch (dirty_shift_) {
+    case 8: return DirtyTracking::Pages;
+    case 12: return DirtyTracking::Blocks;
+    default: return DirtyTracking::Off;
+    }
+}
+
+auto Memory::dirty(u16 first, u16 last) const -> bool
+{
+    if (dirty_shift_ == 0) {
+        return false;
+    }
+    const u32 last_unit = last >> dirty_shift_;
+    for (u32 unit = first >> dirty_shift_; unit <= last_unit; unit++) {
+        if ((dirty_[unit >> 6] >> (unit & 63) & 1) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+auto Memory::mark_dirty(u16 first, u16 last) -> void
+{
+    if (dirty_shift_ == 0) {
+        return;
+    }
+    for (u32 address = first; address <= last;
+        address += 1u << dirty_shift_) {
+        const u16 unit = dirty_unit(static_cast<u16>(address));
+        dirty_[unit >> 6] |= u64{1} << (unit & 63);
+    }
+    const u16 unit = dirty_unit(last);
+    dirty_[unit >> 6] |= u64{1} << (unit & 63);
+}
+
+auto Memory::clear_dirty(u16 first, u16 last) -> void
+{
+    if (dirty_shift_ == 0) {
+        return;
+    }
+    const u32 last_unit = last >> dirty_shift_;
+    for (u32 unit = first >> dirty_shift_; unit <= last_unit; unit++) {
+        dirty_[unit >> 6] &= ~(u64{1} << (unit & 63));
+    }
+}
+
+auto Memory::clear_dirty() -> void
+{
+    dirty_.fill(0);
+}
+
+auto Memory::switchable(u16 address) const -> bool
+{
+    return (address >= 0x4000 && address < 0x8000) ||
+           (address >= 0xA000 && address < 0xC000);
+}
+
+auto Memory::map() -> void
+{
+    map(0x00, 0x7F, nullptr, Region::Rom);
+    map(0x80, 0x9F, vram_.data(), Region::Direct);
+    map(0xA0, 0xBF, nullptr, Region::ExternalRam);
+    map(0xC0, 0xDF, wram_.data(), Region::Direct);
+    // Echo RAM mirrors the first 0x1E00 bytes of WRAM
+    map(0xE0, 0xFD, wram_.data(), Region::Direct);
+    map(0xFE, 0xFE, nullptr, Region::Oam);
+    map(0xFF, 0xFF, nullptr, Region::High);
+    map_cartridge();
+}
+
+auto Memory::map(u8 first_page, u8 last_page, u8 *data, Region region) -> void
+{
+    for (u16 page = first_page; page <= last_page; page++) {
+        u8 *page_data =
+            data != nullptr ? data + (page - first_page) * 0x100 : nullptr;
+        read_pages_[page] = page_data;
+        write_pages_[page] = page_data;
+        regions_[page] = region;
+    }
+}
+
+auto Memory::map_cartridge() -> void
+{
+    const u8 *bank0 = nullptr;
+    const u8 *bank = nullptr;
+    u8 *ram = nullptr;
+    if (cartridge_ != nullptr) {
+        bank0 = cartridge_->rom_bank0();
+        bank = cartridge_->rom_bank();
+        ram = cartridge_->ram_bank();
+        banks_[0] = banks_[1] = cartridge_->rom_bank0_number();
+        banks_[2] = banks_[3] = cartridge_->rom_bank_number();
+        // Keep blocks decoded from unmapped RAM apart from RAM banks
+        banks_[5] = ram != nullptr ? cartridge_->ram_bank_number() : 0xFFFF;
+    }
+    else {
+        banks_.fill(0);
+    }
+
+    // ROM is read directly but always written through the bank controller.
+    // Only pages whose bank changed are repointed.
+    if (read_pages_[0x00] != bank0) {
+        for (u16 page = 0x00; page < 0x40; page++) {
+            read_pages_[page] =
+                bank0 != nullptr ? bank0 + page * 0x100 : nullptr;
+        }
+        // Blocks are only linked outside switchable regions, so drop them all
+        // in the rare case bank 0 is swapped
+        if (block_cache_ != nullptr) {
+            block_cache_->clear();
+        }
+    }
+    if (read_pages_[0x40] != bank) {
+        for (u16 page = 0x40; page < 0x80; page++) {
+            read_pages_[page] =
+                bank != nullptr ? bank + (page - 0x40) * 0x100 : nullptr;
+        }
+        if (block_cache_ != nullptr) {
+            block_cache_->remap();
+        }
+    }
+    if (read_pages_[0xA0] != ram) {
+        map(0xA0, 0xBF, ram, Region::ExternalRam);
+        if (block_cache_ != nullptr) {
+            block_cache_->remap();
+        }
+    }
+    // Clean RAM in a save file is written through write_slow, which marks it
+    // dirty and maps it for writing until it is next flushed
+    u8 *ram_write = ram;
+    if (ram != nullptr && cartridge_->has_save() && !cartridge_->ram_dirty()) {
+        ram_write = nullptr;
+    }
+    if (write_pages_[0xA0] != ram_write) {
+        for (u16 page = 0xA0; page < 0xC0; page++) {
+            write_pages_[page] =
+                ram_write != nullptr ? ram_write + (page - 0xA0) * 0x100
+                                     : nullptr;
+        }
+    }
+}
+
+auto Memory::read_slow(u16 address) const -> u8
+{
+    switch (regions_[address >> 8]) {
+    case Region::ExternalRam:
+        return cartridge_ != nullptr ? cartridge_->read_ram(address) : 0xFF;
+    case Region::Oam: {
+        const u8 offset = address & 0xFF;
+        if (oam_dma_) {
+            return 0xFF;
+        }
+        return offset < oam_.size() ? oam_[offset] : 0x00;
+    }
+    case Region::High: return read_io(address & 0xFF);
+    case Region::Direct:
+    case Region::Rom: break;
+    }
+    return 0xFF;
+}
+
+auto Memory::write_slow(u16 address, u8 value) -> void
+{
+    switch (regions_[address >> 8]) {
+    case Region::Rom:
+        if (cartridge_ != nullptr) {
+            cartridge_->write(address, value);
+            map_cartridge();
+        }
+        break;
+    case Region::ExternalRam:
+        if (cartridge_ == nullptr) {
+            break;
+        }
+        if (u8 *ram = cartridge_->ram_bank(); ram != nullptr) {
+            ram[address - 0xA000] = value;
+            cartridge_->mark_ram_dirty();
+            map_cartridge();
+        }
+        else {
+            cartridge_->write_ram(address, value);
+        }
+        break;
+    case Region::Oam: {
+        const u8 offset = address & 0xFF;
+        if (offset < oam_.size() && !oam_dma_) {
+            oam_[offset] = value;
+        }
+        break;
+    }
+    case Region::High: store_io(address & 0xFF, value); break;
+    case Region::Direct: break;
+    }
+}
+
+auto Memory::read_joypad(u8 offset) const -> u8
+{
+    // Selected groups pull the lines of their held buttons low
+    const u8 select = high_[offset];
+    u8 lines = 0x0F;
+    if ((select & 0x10) == 0) {
+        lines &= ~buttons_ & 0x0F;
+    }
+    if ((select & 0x20) == 0) {
+        lines &= ~(buttons_ >> 4) & 0x0F;
+    }
+    return (select & 0x30) | lines;
+}
+
+auto Memory::read_div(u8 offset) const -> u8
+{
+    if (scheduler_ == nullptr) {
+        return high_[offset];
+    }
+    return static_cast<u8>((scheduler_->now() - div_origin_) >> 6);
+}
+
+auto Memory::write_div(u8 offset, u8 /*value*/) -> void
+{
+    // Any write resets the divider, and with it the timer's phase
+    high_[offset] = 0;
+    if (scheduler_ != nullptr) {
+        sync_timer();
+        div_origin_ = scheduler_->now();
+        schedule_timer();
+    }
+}
+
+auto Memory::timer_period() const -> u64
+{
+    // Input clock selected by TAC, in cycles per TIMA increment
+    constexpr std::array<u64, 4> periods = {256, 4, 16, 64};
+    const u8 control = high_[0x07];
+    return (control & 0x04) != 0 ? periods[control & 0x03] : 0;
+}
+
+auto Memory::timer_count(u64 cycle) const -> u32
+{
+    // TIMA counts the periods of DIV's counter that end after it was synced
+    const u64 period = timer_period();
+    if (scheduler_ == nullptr || period == 0) {
+        return high_[0x05];
+    }
+    const u64 ticks = (cycle - div_origin_) / period -
+                      (timer_synced_ - div_origin_) / period;
+    return high_[0x05] + static_cast<u32>(ticks);
+}
+
+auto Memory::sync_timer() -> void
+{
+    high_[0x05] = static_cast<u8>(timer_count(scheduler_->now()));
+    timer_synced_ = scheduler_->now();
+}
+
+auto Memory::schedule_timer() -> void
+{
+    const u64 period = timer_period();
+    if (period == 0) {
+        scheduler_->cancel(Scheduler::Event::Timer);
+        return;
+    }
+    const u64 counted = (timer_synced_ - div_origin_) / period;
+    scheduler_->schedule(Scheduler::Event::Timer,
+        div_origin_ + (counted + 0x100 - high_[0x05]) * period);
+}
+
+auto Memory::on_timer(u64 deadline) -> void
+{
+    // TIMA wraps to TMA, counting on from the cycle it overflowed
+    high_[0x05] = high_[0x06];
+    timer_synced_ = deadline;
+    request_interrupt(Interrupt::Timer);
+    schedule_timer();
+}
+
+auto Memory::read_tima(u8 offset) const -> u8
+{
+    if (scheduler_ == nullptr) {
+        return high_[offset];
+    }
+    return static_cast<u8>(timer_count(scheduler_->now()));
+}
+
+auto Memory::write_timer(u8 offset, u8 value) -> void
+{
+    // TIMA, TMA and TAC, counted up to the write at the old rate first
+    if (scheduler_ == nullptr) {
+        store_masked(offset, value);
+        return;
+    }
+    sync_timer();
+    store_masked(offset, value);
+    schedule_timer();
+}
+
+auto Memory::on_serial(u64 /*deadline*/) -> void
+{
+    // Nothing is linked, so the byte shifted in is all ones
+    high_[0x01] = 0xFF;
+    high_[0x02] &= ~0x80;
+    request_interrupt(Interrupt::Serial);
+}
+
+auto Memory::write_serial(u8 offset, u8 value) -> void
+{
+    store_masked(offset, value);
+    if (scheduler_ == nullptr) {
+        return;
+    }
+    // Only the internal clock shifts without a partner, 8 bits at 8192 Hz.
+    // An external clock waits for good.
+    if ((value & 0x81) == 0x81) {
+        scheduler_->schedule_in(Scheduler::Event::Serial, 8 * 128);
+    }
+    else {
+        scheduler_->cancel(Scheduler::Event::Serial);
+    }
+}
+
+auto Memory::copy(u16 source, u8 *destination, u16 size) const -> void
+{
+    while (size > 0) {
+        const u16 chunk = std::min<u16>(size, 0x100 - (source & 0xFF));
+        const u8 *page = read_pages_[source >> 8];
+        if (page != nullptr) {
+            std::memcpy(destination, page + (source & 0xFF), chunk);
+        }
+        else {
+            for (u16 i = 0; i < chunk; i++) {
+                destination[i] = read_slow(source + i);
+            }
+        }
+        source += chunk;
+        destination += chunk;
+        size -= chunk;
+    }
+}
+
+auto Memory::copied(u16 first, u16 last) -> void
+{
+    mark_dirty(first, last);
+    if (block_cache_ != nullptr) {
+        for (u32 page = first >> 8; page <= static_cast<u32>(last >> 8);
+            page++) {
+            block_cache_->invalidate(static_cast<u16>(page << 8));
+        }
+    }
+    if (tile_cache_ != nullptr && first >= 0x8000 && first < 0x9800) {
+        tile_cache_->invalidate(first - 0x8000, last - 0x8000);
+    }
+}
+
+auto Memory::copy_hdma_chunk() -> void
+{
+    copy(hdma_source_, vram_.data() + hdma_destination_, 0x10);
+    copied(0x8000 + hdma_destination_, 0x8000 + hdma_destination_ + 0x0F);
+    hdma_source_ += 0x10;
+    hdma_destination_ = (hdma_destination_ + 0x10) & 0x1FF0;
+    hdma_remaining_--;
+    if (hdma_remaining_ == 0xFF) {
+        hdma_active_ = false;
+    }
+}
+
+auto Memory::on_dma(u64 /*deadline*/) -> void
+{
+    oam_dma_ = false;
+}
+
+auto Memory::write_dma(u8 offset, u8 value) -> void
+{
+    high_[offset] = value;
+    // Sources past WRAM read its echo
+    const u16 source = value < 0xE0 ? value << 8 : (value - 0x20) << 8;
+    oam_dma_ = false;
+    copy(source, oam_.data(), oam_.size());
+    copied(0xFE00, 0xFE9F);
+
+    // The bytes are all copied up front, the event only ends the 160 cycles
+    // the CPU cannot reach OAM, counted from the write. Scheduling it stops
+    // the running slice so the lock is lifted on time.
+    if (scheduler_ != nullptr) {
+        oam_dma_ = true;
+        scheduler_->schedule_in(Scheduler::Event::Dma, oam_.size());
+    }
+}
+
+auto Memory::write_lcd(u8 offset, u8 value) -> void
+{
+    const u8 previous = high_[offset];
+    store_masked(offset, value);
+    if (ppu_ != nullptr) {
+        ppu_->written(offset, previous);
+    }
+}
+
+auto Memory::read_apu_status(u8 offset) const -> u8
+{
+    if (apu_ == nullptr) {
+        return high_[offset];
+    }
+    return (high_[offset] & 0x80) | apu_->status();
+}
+
+auto Memory::write_apu(u8 offset, u8 value) -> void
+{
+    // Powered off, everything but NR52 and wave RAM ignores writes
+    if (apu_ != nullptr && !apu_->writable(offset)) {
+        return;
+    }
+    store_masked(offset, value);
+    if (apu_ != nullptr) {
+        apu_->written(offset, value);
+    }
+}
+
+auto Memory::read_hdma(u8 /*offset*/) const -> u8
+{
+    if (!cgb_) {
+        return 0xFF;
+    }
+    return (hdma_active_ ? 0x00 : 0x80) | hdma_remaining_;
+}
+
+auto Memory::write_hdma(u8 offset, u8 value) -> void
+{
+    if (!cgb_) {
+        return;
+    }
+    high_[offset] = value;
+
+    // Clearing bit 7 stops a running HBlank transfer
+    if (hdma_active_ && (value & 0x80) == 0) {
+        hdma_active_ = false;
+        return;
+    }
+
+    hdma_source_ = (high_[0x51] << 8 | high_[0x52]) & 0xFFF0;
+    hdma_destination_ = (high_[0x53] << 8 | high_[0x54]) & 0x1FF0;
+    hdma_remaining_ = value & 0x7F;
+    if ((value & 0x80) != 0) {
+        hdma_active_ = true;
+        return;
+    }
+
+    // General purpose transfers copy everything at once
+    do {
+        copy_hdma_chunk();
+    } while (hdma_remaining_ != 0xFF);
+}
+} // namespace tomboy
@@ -1,41 +1,416 @@
 #pragma once
 
+#include "block_cache.hpp"
+#include "cartridge.hpp"
+#include "tile_cache.hpp"
 #include "types.hpp"
 
 #include <array>
 
 namespace tomboy {
+class Apu;
+class Ppu;
+class Scheduler;
+} // namespace tomboy
+
+namespace tomboy {
+/// Address space mapped through 256 byte pages
+///
+/// Each page has a host pointer for reads and one for writes. Plain memory
+/// is accessed directly through them, pages without a pointer fall back to
+/// a handler chosen by the page's region.
+///
+/// The page of IO registers, HRAM and IE is accessed through a table giving
+/// each byte masks for the bits that read as 1 and the bits that can be
+/// written. Plain registers are a masked load and store, registers with
+/// side effects also have handlers.
 class Memory {
   public:
-    Memory() = default;
+    /// Size of the units writes are tracked in
+    enum class DirtyTracking : u8 {
+        Off,
+        /// 256 byte pages, as mapped
+        Pages,
+        /// 4 KiB blocks
+        Blocks,
+    };
+
+    /// Bits of IF and IE, in priority order
+    enum class Interrupt : u8 {
+        VBlank,
+        Stat,
+        Timer,
+        Serial,
+        Joypad,
+    };
+
+    /// Bits of the button state, set while held
+    enum class Button : u8 {
+        Right,
+        Left,
+        Up,
+        Down,
+        A,
+        B,
+        Select,
+        Start,
+    };
+
+  public:
+    Memory();
+    Memory(const Memory &other);
+    auto operator=(const Memory &other) -> Memory &;
 
     [[nodiscard]] auto read(u16 address) const -> u8;
     [[nodiscard]] auto read_io(u8 offset) const -> u8;
+    /// Host memory of each page read directly, nullptr where reads go
+    /// through a handler
+    [[nodiscard]] auto read_pages() const
+        -> const std::array<const u8 *, 256> &;
 
     auto write(u16 address, u8 value) -> void;
     auto write_io(u8 offset, u8 value) -> void;
 
+    /// Cartridge bank mapped at address, 0 outside of the cartridge
+    [[nodiscard]] auto bank(u16 address) const -> u16;
+    /// Whether a write to the bank controller can change what is mapped at
+    /// address, bank 0 aside
+    [[nodiscard]] auto switchable(u16 address) const -> bool;
+
+    /// Map a cartridge into ROM and external RAM, nullptr to remove it
+    auto set_cartridge(Cartridge *cartridge) -> void;
+    [[nodiscard]] auto cartridge() const -> Cartridge *;
+    /// Point the cartridge pages at the banks currently selected, needed
+    /// after changing the cartridge other than by writing to it
+    auto map_cartridge() -> void;
+
+    /// Invalidate cached blocks on writes, nullptr to disable
+    auto set_block_cache(BlockCache *block_cache) -> void;
+    /// Mark decoded tiles on writes to VRAM tile data, nullptr to disable
+    auto set_tile_cache(TileCache *tile_cache) -> void;
+    /// Count DIV and TIMA and time DMA and serial transfers with the
+    /// scheduler, all stand still without one
+    auto set_scheduler(Scheduler *scheduler) -> void;
+    /// Enable the Game Boy Color HDMA registers
+    auto set_cgb(bool cgb) -> void;
+    /// Notify the PPU of writes to LCDC, STAT and LYC, nullptr to only store
+    /// them
+    auto set_ppu(Ppu *ppu) -> void;
+    /// Pass writes to the sound registers and wave RAM on to the APU,
+    /// nullptr to only store them
+    auto set_apu(Apu *apu) -> void;
+
+    /// Set an IO register as the hardware does, bypassing its write mask
+    /// and handler
+    auto set_io(u8 offset, u8 value) -> void;
+    auto request_interrupt(Interrupt interrupt) -> void;
+    [[nodiscard]] auto vram() const -> const std::array<u8, 0x2000> &;
+    [[nodiscard]] auto wram() const -> const std::array<u8, 0x2000> &;
+    [[nodiscard]] auto oam() const -> const std::array<u8, 0xA0> &;
+
+    /// Update the buttons held, a bit per Button
+    auto set_buttons(u8 buttons) -> void;
+
+    /// Copy the next 16 bytes of an HBlank HDMA transfer, called by the PPU
+    /// as each line enters HBlank
+    auto hblank() -> void;
+
+    /// Record which units of the address space are written, clearing the
+    /// record. Echo RAM writes mark the WRAM they alias.
+    auto set_dirty_tracking(DirtyTracking tracking) -> void;
+    [[nodiscard]] auto dirty_tracking() const -> DirtyTracking;
+    /// Whether a unit overlapping first to last was written since cleared
+    [[nodiscard]] auto dirty(u16 first, u16 last) const -> bool;
+    /// Mark the units overlapping first to last, for writes bypassing write
+    auto mark_dirty(u16 first, u16 last) -> void;
+    auto clear_dirty(u16 first, u16 last) -> void;
+    auto clear_dirty() -> void;
+    /// Call function with the first and last address of each run of written
+    /// units
+    template <class Function>
+    auto for_each_dirty(Function function) const -> void;
+
+  private:
+    /// Handler of accesses to a page without a host pointer
+    enum class Region : u8 {
+        /// Accessed directly
+        Direct,
+        /// ROM, writes go to the memory bank controller
+        Rom,
+        /// External RAM while disabled, replaced by clock registers or clean
+        /// in a save file
+        ExternalRam,
+        /// OAM followed by the unusable region
+        Oam,
+        /// IO registers, HRAM and IE, through the register table
+        High,
+    };
+
+    /// Behaviour of a byte of the high page
+    struct IoRegister {
+        /// Value left by the boot ROM
+        u8 initial = 0x00;
+        /// Bits that always read as 1
+        u8 read_mask = 0x00;
+        /// Bits that can be written, the rest keep their value
+        u8 write_mask = 0xFF;
+        /// Produces the value read instead of the stored one
+        auto (Memory::*read)(u8 offset) const -> u8 = nullptr;
+        /// Stores a write instead of the masked store
+        auto (Memory::*write)(u8 offset, u8 value) -> void = nullptr;
+    };
+
+    /// Indexed by the low byte of the address
+    static const std::array<IoRegister, 0x100> io_registers;
+
   private:
-    std::array<u8, 0xFFFF> memory_;
+    /// Point the pages of the regions at this instance's storage
+    auto map() -> void;
+    /// Map pages from first_page to last_page onto data
+    auto map(u8 first_page, u8 last_page, u8 *data, Region region) -> void;
+
+    /// Unit of address, 0 when tracking is off
+    [[nodiscard]] auto dirty_unit(u16 address) const -> u16;
+
+    [[nodiscard]] auto read_slow(u16 address) const -> u8;
+    auto write_slow(u16 address, u8 value) -> void;
+    /// Store to the high page through the register table
+    auto store_io(u8 offset, u8 value) -> void;
+    /// Store the writable bits of a register
+    auto store_masked(u8 offset, u8 value) -> void;
+    /// Mark a written address dirty and drop the blocks and tiles decoded
+    /// from it
+    auto wrote(u16 address) -> void;
+
+    /// Copy size bytes starting at source, directly from its page when it
+    /// has a host pointer
+    auto copy(u16 source, u8 *destination, u16 size) const -> void;
+    /// Note a copy into first to last that bypassed write
+    auto copied(u16 first, u16 last) -> void;
+    /// Copy one 16 byte HDMA chunk, ending the transfer after the last
+    auto copy_hdma_chunk() -> void;
+    auto on_dma(u64 deadline) -> void;
+    /// Cycles per TIMA increment, 0 while the timer is stopped
+    [[nodiscard]] auto timer_period() const -> u64;
+    /// TIMA counted on to cycle from its value at timer_synced_, past 0xFF
+    /// if it overflowed
+    [[nodiscard]] auto timer_count(u64 cycle) const -> u32;
+    /// Store TIMA as counted up to now
+    auto sync_timer() -> void;
+    /// Schedule TIMA's overflow, or cancel it while the timer is stopped
+    auto schedule_timer() -> void;
+    auto on_timer(u64 deadline) -> void;
+    auto on_serial(u64 deadline) -> void;
+
+    [[nodiscard]] auto read_joypad(u8 offset) const -> u8;
+    [[nodiscard]] auto read_div(u8 offset) const -> u8;
+    auto write_div(u8 offset, u8 value) -> void;
+    [[nodiscard]] auto read_tima(u8 offset) const -> u8;
+    auto write_timer(u8 offset, u8 value) -> void;
+    auto write_serial(u8 offset, u8 value) -> void;
+    auto write_dma(u8 offset, u8 value) -> void;
+    auto write_lcd(u8 offset, u8 value) -> void;
+    [[nodiscard]] auto read_apu_status(u8 offset) const -> u8;
+    auto write_apu(u8 offset, u8 value) -> void;
+    [[nodiscard]] auto read_hdma(u8 offset) const -> u8;
+    auto write_hdma(u8 offset, u8 value) -> void;
+
+  private:
+    std::array<const u8 *, 256> read_pages_;
+    std::array<u8 *, 256> write_pages_;
+    std::array<Region, 256> regions_;
+    /// Bank of each 8 KiB region, kept up to date by map_cartridge
+    std::array<u16, 8> banks_;
+
+    std::array<u8, 0x2000> vram_{};
+    std::array<u8, 0x2000> wram_{};
+    std::array<u8, 0xA0> oam_{};
+    /// IO registers, HRAM and IE indexed by the low byte of the address
+    std::array<u8, 0x100> high_{};
+    Cartridge *cartridge_ = nullptr;
+    BlockCache *block_cache_ = nullptr;
+    TileCache *tile_cache_ = nullptr;
+    Scheduler *scheduler_ = nullptr;
+    Ppu *ppu_ = nullptr;
+    Apu *apu_ = nullptr;
+    /// Cycle DIV last counted from 0, it counts every 64 cycles
+    u64 div_origin_ = 0 - (u64{0xAB} << 6);
+    /// Cycle the stored TIMA was counted up to
+    u64 timer_synced_ = 0;
+    /// Buttons held, a bit per Button
+    u8 buttons_ = 0;
+
+    /// OAM is locked by a transfer until the DMA event
+    bool oam_dma_ = false;
+    bool cgb_ = false;
+    /// Whether an HBlank HDMA transfer is running
+    bool hdma_active_ = false;
+    u16 hdma_source_ = 0;
+    /// Offset into VRAM
+    u16 hdma_destination_ = 0;
+    /// Chunks left to copy, minus one, as read from HDMA5
+    u8 hdma_remaining_ = 0x7F;
+
+    /// Bit per unit, units are 1 << dirty_shift_ bytes
+    std::array<u64, 4> dirty_{};
+    /// 0 while tracking is off
+    u8 dirty_shift_ = 0;
 };
 
 inline auto Memory::read(u16 address) const -> u8
 {
-    return memory_.at(address);
+    const u8 *page = read_pages_[address >> 8];
+    if (page != nullptr) {
+        return page[address & 0xFF];
+    }
+    return read_slow(address);
+}
+
+inline auto Memory::read_pages() const -> const std::array<const u8 *, 256> &
+{
+    return read_pages_;
 }
 
 inline auto Memory::read_io(u8 offset) const -> u8
 {
-    return read(0xFF00 + offset);
+    const IoRegister &io = io_registers[offset];
+    if (io.read != nullptr) {
+        return (this->*io.read)(offset) | io.read_mask;
+    }
+    return high_[offset] | io.read_mask;
 }
 
 inline auto Memory::write(u16 address, u8 value) -> void
 {
-    memory_.at(address) = value;
+    u8 *page = write_pages_[address >> 8];
+    if (page != nullptr) {
+        page[address & 0xFF] = value;
+    }
+    else {
+        write_slow(address, value);
+        // Controller writes only repoint banks, blocks are keyed by bank and
+        // the ROM bytes themselves never change
+        if (address < 0x8000) {
+            return;
+        }
+    }
+    wrote(address);
 }
 
 inline auto Memory::write_io(u8 offset, u8 value) -> void
 {
-    write(0xFF00 + offset, value);
+    store_io(offset, value);
+    wrote(0xFF00 + offset);
+}
+
+inline auto Memory::store_io(u8 offset, u8 value) -> void
+{
+    const IoRegister &io = io_registers[offset];
+    if (io.write != nullptr) {
+        (this->*io.write)(offset, value);
+    }
+    else {
+        store_masked(offset, value);
+    }
+}
+
+inline auto Memory::store_masked(u8 offset, u8 value) -> void
+{
+    const u8 mask = io_registers[offset].write_mask;
+    high_[offset] = (high_[offset] & ~mask) | (value & mask);
+}
+
+inline auto Memory::set_io(u8 offset, u8 value) -> void
+{
+    high_[offset] = value;
+}
+
+inline auto Memory::request_interrupt(Interrupt interrupt) -> void
+{
+    high_[0x0F] |= 1 << static_cast<u8>(interrupt);
+}
+
+inline auto Memory::vram() const -> const std::array<u8, 0x2000> &
+{
+    return vram_;
+}
+
+inline auto Memory::wram() const -> const std::array<u8, 0x2000> &
+{
+    return wram_;
+}
+
+inline auto Memory::oam() const -> const std::array<u8, 0xA0> &
+{
+    return oam_;
+}
+
+inline auto Memory::wrote(u16 address) -> void
+{
+    if (dirty_shift_ != 0) {
+        const u16 unit = dirty_unit(address);
+        dirty_[unit >> 6] |= u64{1} << (unit & 63);
+    }
+    if (block_cache_ != nullptr) {
+        block_cache_->invalidate(address);
+        // Echo RAM aliases WRAM, drop blocks decoded through either address
+        if (address >= 0xC000 && address < 0xFE00 &&
+            (address & 0x1FFF) < 0x1E00) {
+            block_cache_->invalidate(address ^ 0x2000);
+        }
+    }
+    if (tile_cache_ != nullptr && address >= 0x8000 && address < 0x9800) {
+        tile_cache_->invalidate(address - 0x8000);
+    }
+}
+
+inline auto Memory::bank(u16 address) const -> u16
+{
+    return banks_[address >> 13];
+}
+
+inline auto Memory::cartridge() const -> Cartridge *
+{
+    return cartridge_;
+}
+
+inline auto Memory::set_block_cache(BlockCache *block_cache) -> void
+{
+    block_cache_ = block_cache;
+}
+
+inline auto Memory::set_tile_cache(TileCache *tile_cache) -> void
+{
+    tile_cache_ = tile_cache;
+}
+
+inline auto Memory::dirty_unit(u16 address) const -> u16
+{
+    if (address >= 0xE000 && address < 0xFE00) {
+        address -= 0x2000;
+    }
+    return address >> dirty_shift_;
+}
+
+template <class Function>
+auto Memory::for_each_dirty(Function function) const -> void
+{
+    if (dirty_shift_ == 0) {
+        return;
+    }
+    const u32 units = 0x10000 >> dirty_shift_;
+    u32 unit = 0;
+    while (unit < units) {
+        if ((dirty_[unit >> 6] >> (unit & 63) & 1) == 0) {
+            unit++;
+            continue;
+        }
+        const u32 first = unit;
+        while (unit < units && (dirty_[unit >> 6] >> (unit & 63) & 1) != 0) {
+            unit++;
+        }
+        function(static_cast<u16>(first << dirty_shift_),
+            static_cast<u16>((unit << dirty_shift_) - 1));
+    }
 }
 } // namespace tomboy
@@ -0,0 +1,360 @@
+#include "ppu.hpp"
+
+#include "frame_converter.hpp"
+#include "memory.hpp"
+#include "scheduler.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+
+namespace tomboy {
+
+/// RGBA of the four DMG shades, lightest first
+constexpr FrameConverter::Palette shades = {
+    0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF, 0x000000FF,
+};
+
+Ppu::Ppu(Memory *memory, Scheduler *scheduler)
+  : memory_(memory),
+    scheduler_(scheduler),
+    accuracy_(Accuracy::Scanline),
+    mode_(Mode::HBlank),
+    ly_(0),
+    window_line_(0),
+    stat_line_(false),
+    drawing_(drawing_cycles),
+    frames_(0),
+    skip_(0),
+    period_(1),
+    sprites_(),
+    sprite_count_(0),
+    decoder_(),
+    tiles_(),
+    converter_(),
+    framebuffer_()
+{
+    framebuffer_.fill(shades[0]);
+    memory_->set_tile_cache(&tiles_);
+    scheduler_->set_callback(
+        Scheduler::Event::Ppu, Scheduler::bind<&Ppu::on_event>(this));
+    if ((memory_->read_io(0x40) & 0x80) != 0) {
+        start(scheduler_->now());
+    }
+}
+
+auto Ppu::accuracy() const -> Accuracy
+{
+    return accuracy_;
+}
+
+auto Ppu::set_accuracy(Accuracy accuracy) -> void
+{
+    accuracy_ = accuracy;
+}
+
+auto Ppu::decoder() const -> const TileDecoder &
+{
+    return decoder_;
+}
+
+auto Ppu::set_decoder(TileDecoder decoder) -> void
+{
+    decoder_ = decoder;
+}
+
+auto Ppu::set_frame_skip(u32 skip, u32 period) -> void
+{
+    period_ = std::max<u32>(period, 1);
+    skip_ = std::min(skip, period_);
+}
+
+auto Ppu::rendering() const -> bool
+{
+    return frames_ % period_ >= skip_;
+}
+
+auto Ppu::framebuffer() const -> std::span<const u32>
+{
+    return framebuffer_;
+}
+
+auto Ppu::frames() const -> u64
+{
+    return frames_;
+}
+
+auto Ppu::mode() const -> Mode
+{
+    return mode_;
+}
+
+auto Ppu::written(u8 offset, u8 previous) -> void
+{
+    const u8 lcdc = memory_->read_io(0x40);
+    if (offset == 0x40) {
+        if ((lcdc & 0x80) != (previous & 0x80)) {
+            if ((lcdc & 0x80) != 0) {
+                start(scheduler_->now());
+            }
+            else {
+                stop();
+            }
+        }
+        return;
+    }
+
+    // STAT sources or LYC changed
+    if ((lcdc & 0x80) != 0) {
+        set_ly(ly_);
+        update_stat();
+    }
+}
+
+auto Ppu::on_event(u64 deadline) -> void
+{
+    switch (mode_) {
+    case Mode::OamScan: enter(Mode::Drawing, deadline); break;
+    case Mode::Drawing:
+        enter(Mode::HBlank, deadline);
+        memory_->hblank();
+        break;
+    case Mode::HBlank:
+        set_ly(ly_ + 1);
+        if (ly_ < height) {
+            enter(Mode::OamScan, deadline);
+            break;
+        }
+        frames_++;
+        memory_->request_interrupt(Memory::Interrupt::VBlank);
+        enter(Mode::VBlank, deadline);
+        break;
+    case Mode::VBlank:
+        if (ly_ < 153) {
+            set_ly(ly_ + 1);
+            enter(Mode::VBlank, deadline);
+            break;
+        }
+        set_ly(0);
+        window_line_ = 0;
+        enter(Mode::OamScan, deadline);
+        break;
+    }
+}
+
+auto Ppu::enter(Mode mode, u64 deadline) -> void
+{
+    mode_ = mode;
+    const u8 stat = memory_->read_io(0x41);
+    memory_->set_io(0x41, (stat & ~0x03) | static_cast<u8>(mode));
+
+    u64 length = cycles_per_line;
+    switch (mode) {
+    case Mode::OamScan:
+        select_sprites();
+        length = oam_scan_cycles;
+        break;
+    case Mode::Drawing:
+        drawing_ = drawing_length();
+        if (rendering()) {
+            render_line();
+        }
+        else if (window_visible()) {
+            // The window line counter is state, not pixel work
+            window_line_++;
+        }
+        length = drawing_;
+        break;
+    case Mode::HBlank:
+        length = cycles_per_line - oam_scan_cycles - drawing_;
+        break;
+    case Mode::VBlank: break;
+    }
+    scheduler_->schedule(Scheduler::Event::Ppu, deadline + length);
+    update_stat();
+}
+
+auto Ppu::set_ly(u8 ly) -> void
+{
+    ly_ = ly;
+    memory_->set_io(0x44, ly);
+    const u8 stat = memory_->read_io(0x41) & ~0x04;
+    const bool coincidence = ly == memory_->read_io(0x45);
+    memory_->set_io(0x41, stat | (coincidence ? 0x04 : 0x00));
+}
+
+auto Ppu::update_stat() -> void
+{
+    const u8 stat = memory_->read_io(0x41);
+    const bool line = ((stat & 0x40) != 0 && (stat & 0x04) != 0) ||
+                      ((stat & 0x08) != 0 && mode_ == Mode::HBlank) ||
+                      ((stat & 0x10) != 0 && mode_ == Mode::VBlank) ||
+                      ((stat & 0x20) != 0 && mode_ == Mode::OamScan);
+    if (line && !stat_line_) {
+        memory_->request_interrupt(Memory::Interrupt::Stat);
+    }
+    stat_line_ = line;
+}
+
+auto Ppu::start(u64 now) -> void
+{
+    set_ly(0);
+    window_line_ = 0;
+    enter(Mode::OamScan, now);
+}
+
+auto Ppu::stop() -> void
+{
+    // The screen blanks and LY holds at 0 until the LCD is enabled again
+    scheduler_->cancel(Scheduler::Event::Ppu);
+    mode_ = Mode::HBlank;
+    const u8 stat = memory_->read_io(0x41);
+    memory_->set_io(0x41, stat & ~0x03);
+    set_ly(0);
+    stat_line_ = false;
+    framebuffer_.fill(shades[0]);
+}
+
+auto Ppu::select_sprites() -> void
+{
+    sprite_count_ = 0;
+    const u8 lcdc = memory_->read_io(0x40);
+    const int sprite_height = (lcdc & 0x04) != 0 ? 16 : 8;
+    const auto &oam = memory_->oam();
+    for (size_t i = 0; i < oam.size() && sprite_count_ < sprites_.size();
+        i += 4) {
+        const int top = oam[i] - 16;
+        if (ly_ >= top && ly_ < top + sprite_height) {
+            sprites_[sprite_count_++] = {
+                .y = oam[i],
+                .x = oam[i + 1],
+                .tile = oam[i + 2],
+                .attributes = oam[i + 3],
+            };
+        }
+    }
+
+    // Lower X draws on top, OAM order breaks ties
+    std::stable_sort(sprites_.begin(), sprites_.begin() + sprite_count_,
+        [](const Sprite &a, const Sprite &b) { return a.x < b.x; });
+}
+
+auto Ppu::drawing_length() const -> u64
+{
+    if (accuracy_ == Accuracy::Scanline) {
+        return drawing_cycles;
+    }
+
+    // Dots spent discarding scrolled pixels, restarting the fetcher for the
+    // window and fetching each sprite
+    const u8 lcdc = memory_->read_io(0x40);
+    const u8 scx = memory_->read_io(0x43);
+    u64 dots = 172 + (scx & 7);
+    if (window_visible()) {
+        dots += 6;
+    }
+    if ((lcdc & 0x02) != 0) {
+        for (size_t i = 0; i < sprite_count_; i++) {
+            dots += 11 - std::min(5, (sprites_[i].x + scx) & 7);
+        }
+    }
+    return std::min<u64>((dots + 3) / 4, 72);
+}
+
+auto Ppu::window_visible() const -> bool
+{
+    const u8 lcdc = memory_->read_io(0x40);
+    return (lcdc & 0x21) == 0x21 && ly_ >= memory_->read_io(0x4A) &&
+           memory_->read_io(0x4B) < width + 7;
+}
+
+auto Ppu::render_line() -> void
+{
+    const auto &vram = memory_->vram();
+    tiles_.update(vram, decoder_);
+    const u8 lcdc = memory_->read_io(0x40);
+    const u8 scy = memory_->read_io(0x42);
+    const u8 scx = memory_->read_io(0x43);
+    const u8 wx = memory_->read_io(0x4B);
+
+    // Index of a background or window tile in either addressing mode
+    const auto tile_index = [&](u8 tile) -> u16 {
+        if ((lcdc & 0x10) != 0) {
+            return tile;
+        }
+        return static_cast<u16>(256 + static_cast<i8>(tile));
+    };
+
+    // Colour numbers before the palette, kept for sprite priority. Drawn 8
+    // pixels to the right, the margin takes the fine scroll.
+    std::array<u8, width + 16> background{};
+    if ((lcdc & 0x01) != 0) {
+        const u16 map = (lcdc & 0x08) != 0 ? 0x1C00 : 0x1800;
+        const u8 y = ly_ + scy;
+        for (int i = 0; i <= width / 8; i++) {
+            const u8 tile = vram[map + (y / 8) * 32 + ((scx / 8 + i) & 31)];
+            std::copy_n(tiles_.row(tile_index(tile), y & 7), 8,
+                background.begin() + 8 + i * 8 - (scx & 7));
+        }
+
+        const int window_x = wx - 7;
+        if (window_visible()) {
+            const u16 window_map = (lcdc & 0x40) != 0 ? 0x1C00 : 0x1800;
+            const u8 y = window_line_++;
+            for (int x = window_x; x < width; x += 8) {
+                const int column = (x - window_x) / 8;
+                const u8 tile = vram[window_map + (y / 8) * 32 + column];
+                std::copy_n(tiles_.row(tile_index(tile), y & 7), 8,
+                    background.begin() + 8 + x);
+            }
+        }
+    }
+
+    // Sprites are drawn from lowest to highest priority, so each pixel ends
+    // up with the highest priority opaque one
+    std::array<u8, width + 16> sprite_colors{};
+    std::array<u8, width + 16> sprite_attributes{};
+    if ((lcdc & 0x02) != 0) {
+        const bool tall = (lcdc & 0x04) != 0;
+        for (size_t i = sprite_count_; i-- > 0;) {
+            const Sprite &sprite = sprites_[i];
+            if (sprite.x >= width + 8) {
+                continue;
+            }
+            int row = ly_ - (sprite.y - 16);
+            if ((sprite.attributes & 0x40) != 0) {
+                row = (tall ? 15 : 7) - row;
+            }
+            const u8 tile = tall ? sprite.tile & 0xFE : sprite.tile;
+            const u8 *pixels = tiles_.row(tile + row / 8, row & 7);
+            const bool flip = (sprite.attributes & 0x20) != 0;
+            for (int x = 0; x < 8; x++) {
+                const u8 color = pixels[flip ? 7 - x : x];
+                if (color != 0) {
+                    sprite_colors[sprite.x + x] = color;
+                    sprite_attributes[sprite.x + x] = sprite.attributes;
+                }
+            }
+        }
+    }
+
+    const u8 bgp = memory_->read_io(0x47);
+    const u8 obp0 = memory_->read_io(0x48);
+    const u8 obp1 = memory_->read_io(0x49);
+    // Shades through the palettes first, then RGBA for the whole line
+    std::array<u8, width> line{};
+    for (int x = 0; x < width; x++) {
+        const u8 color = background[x + 8];
+        const u8 sprite_color = sprite_colors[x + 8];
+        const u8 attributes = sprite_attributes[x + 8];
+        if (sprite_color != 0 && ((attributes & 0x80) == 0 || color == 0)) {
+            const u8 palette = (attributes & 0x10) != 0 ? obp1 : obp0;
+            line[x] = palette >> (sprite_color * 2) & 0x03;
+        }
+        else {
+            line[x] = bgp >> (color * 2) & 0x03;
+        }
+    }
+    converter_.convert_dmg(
+        line.data(), width, shades, framebuffer_.data() + ly_ * width);
+}
+} // namespace tomboy
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "frame_converter.hpp"
+#include "tile_cache.hpp"
+#include "tile_decoder.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <span>
+
+namespace tomboy {
+class Memory;
+class Scheduler;
+} // namespace tomboy
+
+namespace tomboy {
+/// Picture processing unit, drawing a whole scanline at a time
+///
+/// Mode changes are scheduler events, so the PPU costs nothing between
+/// them. Each visible line is rendered as mode 3 starts, from the
+/// registers, VRAM and OAM as they are at that moment, into an RGBA
+/// framebuffer the console owns.
+class Ppu {
+  public:
+    static constexpr int width = 160;
+    static constexpr int height = 144;
+
+    /// Mode reported in the low bits of STAT
+    enum class Mode : u8 {
+        HBlank,
+        VBlank,
+        OamScan,
+        Drawing,
+    };
+
+    enum class Accuracy : u8 {
+        /// Mode 3 always lasts 172 dots
+        Scanline,
+        /// Mode 3 is lengthened by fine scrolling, the window and sprites,
+        /// shortening HBlank
+        Timing,
+    };
+
+    /// Machine cycles per scanline and in each mode of a visible line
+    static constexpr u64 cycles_per_line = 114;
+    static constexpr u64 oam_scan_cycles = 20;
+    static constexpr u64 drawing_cycles = 43;
+
+  public:
+    Ppu(Memory *memory, Scheduler *scheduler);
+
+    Ppu(const Ppu &) = delete;
+    auto operator=(const Ppu &) -> Ppu & = delete;
+
+    [[nodiscard]] auto accuracy() const -> Accuracy;
+    auto set_accuracy(Accuracy accuracy) -> void;
+
+    [[nodiscard]] auto decoder() const -> const TileDecoder &;
+    /// Decode tile data with a specific kernel
+    auto set_decoder(TileDecoder decoder) -> void;
+
+    /// Skip drawing the first skip of every period frames. Timing,
+    /// registers, interrupts and sprite selection are unchanged, only the
+    /// framebuffer keeps the last frame drawn.
+    auto set_frame_skip(u32 skip, u32 period) -> void;
+    /// Whether the current frame is drawn into the framebuffer
+    [[nodiscard]] auto rendering() const -> bool;
+
+    /// 160x144 pixels, 0xRRGGBBAA, complete as VBlank starts
+    [[nodiscard]] auto framebuffer() const -> std::span<const u32>;
+    /// Frames completed
+    [[nodiscard]] auto frames() const -> u64;
+    [[nodiscard]] auto mode() const -> Mode;
+
+    /// Called by Memory after LCDC, STAT or LYC is written
+    auto written(u8 offset, u8 previous) -> void;
+
+  private:
+    /// Sprite selected for the current line
+    struct Sprite {
+        u8 y;
+        u8 x;
+        u8 tile;
+        u8 attributes;
+    };
+
+  private:
+    auto on_event(u64 deadline) -> void;
+    /// Enter a mode, scheduling the next change
+    auto enter(Mode mode, u64 deadline) -> void;
+    auto set_ly(u8 ly) -> void;
+    /// Raise the STAT interrupt on a rising edge of its sources
+    auto update_stat() -> void;
+
+    auto start(u64 now) -> void;
+    auto stop() -> void;
+
+    /// Sprites on the current line in drawing priority order, at most 10
+    auto select_sprites() -> void;
+    /// Whether the window shows on the current line
+    [[nodiscard]] auto window_visible() const -> bool;
+    /// Cycles mode 3 lasts on the current line
+    [[nodiscard]] auto drawing_length() const -> u64;
+    auto render_line() -> void;
+
+  private:
+    Memory *memory_;
+    Scheduler *scheduler_;
+    Accuracy accuracy_;
+
+    Mode mode_;
+    u8 ly_;
+    /// Line of the window drawn next, counted only on lines showing it
+    u8 window_line_;
+    /// Level of the STAT interrupt line, raised on its rising edge
+    bool stat_line_;
+    u64 drawing_;
+    u64 frames_;
+    u32 skip_;
+    u32 period_;
+
+    std::array<Sprite, 10> sprites_;
+    u8 sprite_count_;
+    TileDecoder decoder_;
+    TileCache tiles_;
+    FrameConverter converter_;
+    std::array<u32, width * height> framebuffer_;
+};
+} // namespace tomboy
@@ -26,7 +26,7 @@ class Register16 {
     Register8 lo_;
 };
 
-Register16::Register16(u16 value)
+inline Register16::Register16(u16 value)
   : hi_(static_cast<Register8>(value >> 8)),
     lo_(static_cast<Register8>(value))
 {
@@ -66,11 +66,11 @@ inline auto Register16::operator=(u16 value) -> Register16 &
 
 inline auto Register16::operator+=(u16 value) -> Register16 &
 {
-    return (*this = *this + 1);
+    return (*this = static_cast<u16>(*this + value));
 }
 
 inline auto Register16::operator-=(u16 value) -> Register16 &
 {
-    return (*this = *this - 1);
+    return (*this = static_cast<u16>(*this - value));
 }
 } // namespace tomboy
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+namespace tomboy {
+/// Queue between one producer thread and one consumer thread, without locks
+///
+/// Each side owns one index and only reads the other's, so pushing and
+/// popping never wait. Values that do not fit are dropped by push, and pop
+/// returns fewer than asked for when the queue runs dry.
+template <class T>
+class RingBuffer {
+  public:
+    /// Hold at least capacity values
+    explicit RingBuffer(size_t capacity);
+
+    RingBuffer(const RingBuffer &) = delete;
+    auto operator=(const RingBuffer &) -> RingBuffer & = delete;
+
+    /// Append up to count values, returns the number appended
+    auto push(const T *values, size_t count) -> size_t;
+    /// Remove up to count values into output, returns the number removed
+    auto pop(T *output, size_t count) -> size_t;
+
+    /// Values waiting, exact for the consumer, a lower bound for the
+    /// producer
+    [[nodiscard]] auto size() const -> size_t;
+    [[nodiscard]] auto capacity() const -> size_t;
+
+  private:
+    /// Copy count values between the ring at index and linear memory
+    auto copy_in(size_t index, const T *values, size_t count) -> void;
+    auto copy_out(size_t index, T *output, size_t count) const -> void;
+
+  private:
+    std::vector<T> values_;
+    /// Capacity minus one, the capacity is a power of two
+    size_t mask_;
+    /// Total values pushed, written by the producer
+    alignas(64) std::atomic<size_t> head_;
+    /// Total values popped, written by the consumer
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+template <class T>
+RingBuffer<T>::RingBuffer(size_t capacity)
+  : values_(std::bit_ceil(std::max<size_t>(capacity, 1))),
+    mask_(values_.size() - 1),
+    head_(0),
+    tail_(0)
+{
+}
+
+template <class T>
+auto RingBuffer<T>::push(const T *values, size_t count) -> size_t
+{
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    count = std::min(count, values_.size() - (head - tail));
+    copy_in(head & mask_, values, count);
+    head_.store(head + count, std::memory_order_release);
+    return count;
+}
+
+template <class T>
+auto RingBuffer<T>::pop(T *output, size_t count) -> size_t
+{
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_acquire);
+    count = std::min(count, head - tail);
+    copy_out(tail & mask_, output, count);
+    tail_.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+template <class T>
+auto RingBuffer<T>::size() const -> size_t
+{
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+}
+
+template <class T>
+auto RingBuffer<T>::capacity() const -> size_t
+{
+    return values_.size();
+}
+
+template <class T>
+auto RingBuffer<T>::copy_in(size_t index, const T *values, size_t count)
+    -> void
+{
+    // The free space may wrap around the end
+    const size_t first = std::min(count, values_.size() - index);
+    std::copy_n(values, first, values_.begin() + index);
+    std::copy_n(values + first, count - first, values_.begin());
+}
+
+template <class T>
+auto RingBuffer<T>::copy_out(size_t index, T *output, size_t count) const
+    -> void
+{
+    const size_t first = std::min(count, values_.size() - index);
+    std::copy_n(values_.begin() + index, first, output);
+    std::copy_n(values_.begin(), count - first, output + first);
+}
+} // namespace tomboy
@@ -0,0 +1,92 @@
+#include "rom.hpp"
+
+#include "types.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TOMBOY_MMAP_ROM
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+
+namespace tomboy {
+
+auto Rom::open(std::string_view path) -> std::shared_ptr<const Rom>
+{
+#ifdef TOMBOY_MMAP_ROM
+    const int fd = ::open(std::string(path).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat status {};
+    if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    // Reserve zeroed pages for the padding, then map the file over the start
+    const auto file_size = static_cast<size_t>(status.st_size);
+    const size_t size = padded_size(file_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+    if (mmap(data, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+        MAP_FAILED) {
+        munmap(data, size);
+        close(fd);
+        return nullptr;
+    }
+    close(fd);
+
+    std::shared_ptr<Rom> rom(new Rom());
+    rom->data_ = static_cast<const u8 *>(data);
+    rom->size_ = size;
+    rom->file_size_ = file_size;
+    rom->mapped_ = true;
+    return rom;
+#else
+    std::ifstream file(std::string(path), std::ios::binary);
+    if (!file) {
+        return nullptr;
+    }
+    return from_bytes(
+        std::vector<u8>(std::istreambuf_iterator<char>(file), {}));
+#endif
+}
+
+auto Rom::from_bytes(std::vector<u8> bytes) -> std::shared_ptr<const Rom>
+{
+    std::shared_ptr<Rom> rom(new Rom());
+    rom->file_size_ = bytes.size();
+    rom->size_ = padded_size(bytes.size());
+    rom->bytes_ = std::move(bytes);
+    rom->bytes_.resize(rom->size_);
+    rom->data_ = rom->bytes_.data();
+    return rom;
+}
+
+Rom::~Rom()
+{
+#ifdef TOMBOY_MMAP_ROM
+    if (mapped_) {
+        munmap(const_cast<u8 *>(data_), size_);
+    }
+#endif
+}
+
+auto Rom::padded_size(size_t size) -> size_t
+{
+    const size_t banks = (size + bank_size - 1) / bank_size;
+    return std::max<size_t>(banks, 2) * bank_size;
+}
+} // namespace tomboy
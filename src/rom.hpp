@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace tomboy {
+/// Read-only ROM image padded to whole banks
+///
+/// Files are memory mapped privately, so every cartridge built from the same
+/// Rom, and every process mapping the same file, shares its physical pages.
+class Rom {
+  public:
+    static constexpr size_t bank_size = 0x4000;
+
+  public:
+    /// Map a ROM file, nullptr if it cannot be read
+    [[nodiscard]] static auto open(std::string_view path)
+        -> std::shared_ptr<const Rom>;
+    /// Wrap an image already in memory
+    [[nodiscard]] static auto from_bytes(std::vector<u8> bytes)
+        -> std::shared_ptr<const Rom>;
+
+    ~Rom();
+
+    Rom(const Rom &) = delete;
+    auto operator=(const Rom &) -> Rom & = delete;
+
+    [[nodiscard]] auto data() const -> const u8 *;
+    /// Size in bytes, a whole number of at least two banks
+    [[nodiscard]] auto size() const -> size_t;
+    /// Size of the image before padding
+    [[nodiscard]] auto file_size() const -> size_t;
+
+  private:
+    Rom() = default;
+
+    /// Bytes needed to hold an image of size in whole banks
+    [[nodiscard]] static auto padded_size(size_t size) -> size_t;
+
+  private:
+    const u8 *data_ = nullptr;
+    size_t size_ = 0;
+    size_t file_size_ = 0;
+    /// Whether data_ is a mapping to release
+    bool mapped_ = false;
+    std::vector<u8> bytes_;
+};
+
+inline auto Rom::data() const -> const u8 *
+{
+    return data_;
+}
+
+inline auto Rom::size() const -> size_t
+{
+    return size_;
+}
+
+inline auto Rom::file_size() const -> size_t
+{
+    return file_size_;
+}
+} // namespace tomboy
@@ -0,0 +1,103 @@
+#include "save_file.hpp"
+
+#include "types.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TOMBOY_MMAP_SAVE
+#endif
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace tomboy {
+
+auto SaveFile::open(std::string_view path, size_t size)
+    -> std::unique_ptr<SaveFile>
+{
+    if (size == 0) {
+        return nullptr;
+    }
+
+#ifdef TOMBOY_MMAP_SAVE
+    const int fd = ::open(std::string(path).c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat status {};
+    if (fstat(fd, &status) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    // Pages past the end of the file cannot be written, so extend it first.
+    // Longer files are left as they are.
+    if (static_cast<size_t>(status.st_size) < size &&
+        ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    void *data =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    std::unique_ptr<SaveFile> save(new SaveFile());
+    save->data_ = static_cast<u8 *>(data);
+    save->size_ = size;
+    save->mapped_ = true;
+    return save;
+#else
+    std::unique_ptr<SaveFile> save(new SaveFile());
+    save->path_ = path;
+    std::ifstream file(save->path_, std::ios::binary);
+    if (file) {
+        save->bytes_.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    save->bytes_.resize(size);
+    save->data_ = save->bytes_.data();
+    save->size_ = size;
+    return save;
+#endif
+}
+
+SaveFile::~SaveFile()
+{
+    sync();
+#ifdef TOMBOY_MMAP_SAVE
+    if (mapped_) {
+        munmap(data_, size_);
+    }
+#endif
+}
+
+auto SaveFile::flush() -> void
+{
+#ifdef TOMBOY_MMAP_SAVE
+    if (mapped_) {
+        msync(data_, size_, MS_ASYNC);
+        return;
+    }
+#endif
+    sync();
+}
+
+auto SaveFile::sync() -> void
+{
+#ifdef TOMBOY_MMAP_SAVE
+    if (mapped_) {
+        msync(data_, size_, MS_SYNC);
+        return;
+    }
+#endif
+    // Without a mapping the whole file is rewritten
+    std::ofstream file(path_, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(bytes_.data()),
+        static_cast<std::streamsize>(bytes_.size()));
+}
+} // namespace tomboy
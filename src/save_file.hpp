@@ -0,0 +1,60 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tomboy {
+/// Battery-backed cartridge RAM stored in a file
+///
+/// Files are memory mapped shared and writable, so RAM writes land in the
+/// page cache as they happen and survive the process crashing. Flushing
+/// only asks the system to write those pages back to disk.
+class SaveFile {
+  public:
+    /// Map a save file holding size bytes, created or extended with zeros,
+    /// nullptr if it cannot be opened
+    [[nodiscard]] static auto open(std::string_view path, size_t size)
+        -> std::unique_ptr<SaveFile>;
+
+    /// Writes back and waits for any changes
+    ~SaveFile();
+
+    SaveFile(const SaveFile &) = delete;
+    auto operator=(const SaveFile &) -> SaveFile & = delete;
+
+    [[nodiscard]] auto data() -> u8 *;
+    [[nodiscard]] auto size() const -> size_t;
+
+    /// Start writing changes back without waiting for them
+    auto flush() -> void;
+    /// Write changes back and wait until they reach the disk
+    auto sync() -> void;
+
+  private:
+    SaveFile() = default;
+
+  private:
+    u8 *data_ = nullptr;
+    size_t size_ = 0;
+    /// Whether data_ is a mapping to release
+    bool mapped_ = false;
+    /// Contents and path of the file where it cannot be mapped
+    std::vector<u8> bytes_;
+    std::string path_;
+};
+
+inline auto SaveFile::data() -> u8 *
+{
+    return data_;
+}
+
+inline auto SaveFile::size() const -> size_t
+{
+    return size_;
+}
+} // namespace tomboy
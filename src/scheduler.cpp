@@ -0,0 +1,73 @@
+#include "scheduler.hpp"
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace tomboy {
+
+Scheduler::Scheduler()
+  : now_(0),
+    next_(never),
+    deadlines_(),
+    callbacks_(),
+    preempt_(nullptr)
+{
+    deadlines_.fill(never);
+}
+
+auto Scheduler::schedule(Event event, u64 deadline) -> void
+{
+    // Replacing a pending event may postpone the earliest deadline
+    deadlines_[static_cast<size_t>(event)] = deadline;
+    if (deadline < next_ && preempt_ != nullptr) {
+        *preempt_ = true;
+    }
+    update_next();
+}
+
+auto Scheduler::schedule_in(Event event, u64 cycles) -> void
+{
+    schedule(event, now_ + cycles);
+}
+
+auto Scheduler::cancel(Event event) -> void
+{
+    deadlines_[static_cast<size_t>(event)] = never;
+    update_next();
+}
+
+auto Scheduler::set_callback(Event event, Callback callback) -> void
+{
+    callbacks_[static_cast<size_t>(event)] = callback;
+}
+
+auto Scheduler::set_preempt(bool *flag) -> void
+{
+    preempt_ = flag;
+}
+
+auto Scheduler::dispatch() -> void
+{
+    // Callbacks may schedule further events, including ones already due
+    while (next_ <= now_) {
+        const auto earliest = std::ranges::min_element(deadlines_);
+        const u64 deadline = *earliest;
+        const auto index =
+            static_cast<size_t>(std::distance(deadlines_.begin(), earliest));
+        *earliest = never;
+        update_next();
+
+        const Callback &callback = callbacks_[index];
+        if (callback.function != nullptr) {
+            callback.function(callback.object, deadline);
+        }
+    }
+}
+
+auto Scheduler::update_next() -> void
+{
+    next_ = std::ranges::min(deadlines_);
+}
+} // namespace tomboy
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <cstddef>
+#include <limits>
+
+namespace tomboy {
+/// Timing backbone, owns the machine cycle counter and the pending events
+///
+/// Components schedule their next state change at an absolute cycle instead
+/// of being ticked every instruction. The CPU runs until the earliest
+/// deadline, then advances the counter, which dispatches every due event in
+/// deadline order. Each kind of event is pending at most once, so the queue
+/// is a small array indexed by kind with the earliest deadline cached.
+class Scheduler {
+  public:
+    enum class Event : u8 {
+        /// PPU mode change
+        Ppu,
+        /// Timer counter overflow
+        Timer,
+        /// OAM or HDMA transfer completion
+        Dma,
+        /// Serial transfer completion
+        Serial,
+        /// Battery RAM flush to the save file
+        Save,
+        Count,
+    };
+
+    /// Called with the deadline the event was scheduled for, which is at or
+    /// before the current cycle
+    struct Callback {
+        void *object;
+        auto (*function)(void *object, u64 deadline) -> void;
+    };
+
+    static constexpr u64 never = std::numeric_limits<u64>::max();
+    static constexpr u64 cycles_per_second = 1048576;
+
+  public:
+    Scheduler();
+
+    /// Elapsed machine cycles
+    [[nodiscard]] auto now() const -> u64;
+    /// Cycle of the earliest pending event, never if there is none
+    [[nodiscard]] auto next_deadline() const -> u64;
+    /// Cycle an event is pending at, never if it is not scheduled
+    [[nodiscard]] auto deadline(Event event) const -> u64;
+
+    /// Move the counter forward, dispatching every event that became due
+    auto advance(u64 cycles) -> void;
+    /// Move the counter forward without dispatching, for the CPU to keep it
+    /// current while it runs a slice. Events that become due wait for the
+    /// next advance.
+    auto elapse(u64 cycles) -> void;
+
+    /// Schedule an event at an absolute cycle, replacing a pending one
+    auto schedule(Event event, u64 deadline) -> void;
+    /// Schedule an event a number of cycles from now
+    auto schedule_in(Event event, u64 cycles) -> void;
+    auto cancel(Event event) -> void;
+
+    auto set_callback(Event event, Callback callback) -> void;
+    /// Set flag whenever an event is scheduled ahead of the earliest one, so
+    /// the CPU can stop a slice that would run past it. nullptr to disable.
+    auto set_preempt(bool *flag) -> void;
+    /// Callback invoking a member function on object
+    template <auto handler, class T>
+    [[nodiscard]] static auto bind(T *object) -> Callback;
+
+  private:
+    /// Native code moves the counter in place
+    friend class Jit;
+
+    static constexpr size_t event_count = static_cast<size_t>(Event::Count);
+
+  private:
+    auto dispatch() -> void;
+    auto update_next() -> void;
+
+  private:
+    u64 now_;
+    u64 next_;
+    std::array<u64, event_count> deadlines_;
+    std::array<Callback, event_count> callbacks_;
+    bool *preempt_;
+};
+
+inline auto Scheduler::now() const -> u64
+{
+    return now_;
+}
+
+inline auto Scheduler::next_deadline() const -> u64
+{
+    return next_;
+}
+
+inline auto Scheduler::deadline(Event event) const -> u64
+{
+    return deadlines_[static_cast<size_t>(event)];
+}
+
+inline auto Scheduler::advance(u64 cycles) -> void
+{
+    now_ += cycles;
+    if (now_ >= next_) {
+        dispatch();
+    }
+}
+
+inline auto Scheduler::elapse(u64 cycles) -> void
+{
+    now_ += cycles;
+}
+
+template <auto handler, class T>
+auto Scheduler::bind(T *object) -> Callback
+{
+    return {
+        .object = object,
+        .function = [](void *object, u64 deadline) {
+            (static_cast<T *>(object)->*handler)(deadline);
+        },
+    };
+}
+} // namespace tomboy
@@ -0,0 +1,53 @@
+#include "tile_cache.hpp"
+
+#include "tile_decoder.hpp"
+#include "types.hpp"
+
+#include <bit>
+
+namespace tomboy {
+
+TileCache::TileCache()
+  : pixels_(),
+    dirty_()
+{
+    invalidate_all();
+}
+
+auto TileCache::invalidate(u16 first, u16 last) -> void
+{
+    for (u32 offset = first & ~0x0F; offset <= last; offset += 16) {
+        invalidate(static_cast<u16>(offset));
+    }
+}
+
+auto TileCache::invalidate_all() -> void
+{
+    dirty_.fill(~u64{0});
+}
+
+auto TileCache::update(
+    const std::array<u8, 0x2000> &vram, const TileDecoder &decoder) -> void
+{
+    size_t index = 0;
+    while (index < tile_count) {
+        // Skip to the next marked tile, a word at a time
+        const u64 bits = dirty_[index >> 6] >> (index & 63);
+        if (bits == 0) {
+            index = (index | 63) + 1;
+            continue;
+        }
+        index += std::countr_zero(bits);
+
+        const size_t first = index;
+        while (index < tile_count &&
+               (dirty_[index >> 6] >> (index & 63) & 1) != 0) {
+            index++;
+        }
+        // Tiles are 16 contiguous bytes, 8 rows of 2
+        decoder.decode(vram.data() + first * 16, (index - first) * 8,
+            pixels_.data() + first * 64);
+    }
+    dirty_.fill(0);
+}
+} // namespace tomboy
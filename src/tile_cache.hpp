@@ -0,0 +1,55 @@
+#pragma once
+
+#include "tile_decoder.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstddef>
+
+namespace tomboy {
+/// Tiles of VRAM decoded into colour numbers, one byte per pixel
+///
+/// Writes to tile data mark their tile, and the PPU brings the cache up to
+/// date before drawing a line, decoding each run of marked tiles in one
+/// batch. Lines then read their pixels straight from the cache, so a tile is
+/// decoded once per change rather than once per line it appears on.
+class TileCache {
+  public:
+    /// Tiles in the 0x1800 bytes of tile data of a VRAM bank
+    static constexpr size_t tile_count = 384;
+
+  public:
+    TileCache();
+
+    /// Mark the tile holding offset into VRAM, ignoring the tile maps
+    auto invalidate(u16 offset) -> void;
+    /// Mark the tiles overlapping first to last, offsets into VRAM
+    auto invalidate(u16 first, u16 last) -> void;
+    auto invalidate_all() -> void;
+
+    /// Decode the marked tiles from vram
+    auto update(const std::array<u8, 0x2000> &vram, const TileDecoder &decoder)
+        -> void;
+
+    /// 8 pixels of a row of tile index, leftmost first
+    [[nodiscard]] auto row(u16 index, int row) const -> const u8 *;
+
+  private:
+    std::array<u8, tile_count * 64> pixels_;
+    /// Bit per tile written since it was last decoded
+    std::array<u64, tile_count / 64> dirty_;
+};
+
+inline auto TileCache::invalidate(u16 offset) -> void
+{
+    const u16 index = offset >> 4;
+    if (index < tile_count) {
+        dirty_[index >> 6] |= u64{1} << (index & 63);
+    }
+}
+
+inline auto TileCache::row(u16 index, int row) const -> const u8 *
+{
+    return pixels_.data() + index * 64 + row * 8;
+}
+} // namespace tomboy
@@ -0,0 +1,173 @@
+#include "tile_decoder.hpp"
+
+#include "types.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TOMBOY_TILE_X86_64
+#endif
+
+#include <cstddef>
+#include <cstring>
+
+namespace tomboy {
+
+namespace {
+auto decode_scalar(const u8 *data, size_t rows, u8 *pixels) -> void
+{
+    for (size_t row = 0; row < rows; row++) {
+        const u8 low = data[row * 2];
+        const u8 high = data[row * 2 + 1];
+        for (int i = 0; i < 8; i++) {
+            const int bit = 7 - i;
+            pixels[row * 8 + i] =
+                static_cast<u8>((high >> bit & 1) << 1 | (low >> bit & 1));
+        }
+    }
+}
+
+#ifdef TOMBOY_TILE_X86_64
+/// Bit of each pixel in memory order, leftmost first
+alignas(32) constexpr u8 pixel_bits[32] = {
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, //
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, //
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, //
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, //
+};
+
+auto decode_sse2(const u8 *data, size_t rows, u8 *pixels) -> void
+{
+    const __m128i bits =
+        _mm_load_si128(reinterpret_cast<const __m128i *>(pixel_bits));
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+
+    size_t row = 0;
+    for (; row + 2 <= rows; row += 2) {
+        // Spread the four bytes of two rows into low and high vectors, each
+        // byte repeated once per pixel
+        u32 packed;
+        std::memcpy(&packed, data + row * 2, sizeof(packed));
+        __m128i v = _mm_cvtsi32_si128(static_cast<int>(packed));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        const __m128i first = _mm_unpacklo_epi32(v, v);
+        const __m128i second = _mm_unpackhi_epi32(v, v);
+        const __m128i low = _mm_unpacklo_epi64(first, second);
+        const __m128i high = _mm_unpackhi_epi64(first, second);
+
+        const __m128i low_set =
+            _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+        const __m128i high_set =
+            _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+        const __m128i colors = _mm_or_si128(
+            _mm_and_si128(low_set, one), _mm_and_si128(high_set, two));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(pixels + row * 8), colors);
+    }
+    decode_scalar(data + row * 2, rows - row, pixels + row * 8);
+}
+
+__attribute__((target("avx2"))) auto decode_avx2(
+    const u8 *data, size_t rows, u8 *pixels) -> void
+{
+    const __m256i bits =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(pixel_bits));
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    // Shuffles only move bytes within a 128-bit lane, so each lane holds
+    // all eight bytes and picks out its own two rows
+    const __m256i low_index = _mm256_setr_epi8( //
+        0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2, //
+        4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+    const __m256i high_index = _mm256_add_epi8(low_index, one);
+
+    size_t row = 0;
+    for (; row + 4 <= rows; row += 4) {
+        i64 packed;
+        std::memcpy(&packed, data + row * 2, sizeof(packed));
+        const __m256i v = _mm256_set1_epi64x(packed);
+        const __m256i low = _mm256_shuffle_epi8(v, low_index);
+        const __m256i high = _mm256_shuffle_epi8(v, high_index);
+
+        const __m256i low_set =
+            _mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits);
+        const __m256i high_set =
+            _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits);
+        const __m256i colors = _mm256_or_si256(
+            _mm256_and_si256(low_set, one), _mm256_and_si256(high_set, two));
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(pixels + row * 8), colors);
+    }
+    decode_sse2(data + row * 2, rows - row, pixels + row * 8);
+}
+
+__attribute__((target("bmi2"))) auto decode_bmi2(
+    const u8 *data, size_t rows, u8 *pixels) -> void
+{
+    // Deposit each bit into the bottom of its own byte, then swap the bytes
+    // so the top bit, the leftmost pixel, comes first
+    constexpr u64 low_mask = 0x0101010101010101;
+    constexpr u64 high_mask = 0x0202020202020202;
+    for (size_t row = 0; row < rows; row++) {
+        const u64 colors = _pdep_u64(data[row * 2], low_mask) |
+                           _pdep_u64(data[row * 2 + 1], high_mask);
+        const u64 ordered = __builtin_bswap64(colors);
+        std::memcpy(pixels + row * 8, &ordered, sizeof(ordered));
+    }
+}
+#endif
+
+auto function(TileDecoder::Kernel kernel) -> TileDecoder::Function
+{
+    switch (kernel) {
+    case TileDecoder::Kernel::Scalar: return &decode_scalar;
+#ifdef TOMBOY_TILE_X86_64
+    case TileDecoder::Kernel::Sse2: return &decode_sse2;
+    case TileDecoder::Kernel::Avx2: return &decode_avx2;
+    case TileDecoder::Kernel::Bmi2: return &decode_bmi2;
+#else
+    default: break;
+#endif
+    }
+    return &decode_scalar;
+}
+} // namespace
+
+TileDecoder::TileDecoder()
+  : TileDecoder(best())
+{
+}
+
+TileDecoder::TileDecoder(Kernel kernel)
+  : kernel_(supported(kernel) ? kernel : Kernel::Scalar),
+    function_(function(kernel_))
+{
+}
+
+auto TileDecoder::supported(Kernel kernel) -> bool
+{
+    switch (kernel) {
+    case Kernel::Scalar: return true;
+#ifdef TOMBOY_TILE_X86_64
+    case Kernel::Sse2: return true;
+    case Kernel::Avx2: return __builtin_cpu_supports("avx2") != 0;
+    case Kernel::Bmi2: return __builtin_cpu_supports("bmi2") != 0;
+#else
+    default: return false;
+#endif
+    }
+    return false;
+}
+
+auto TileDecoder::best() -> Kernel
+{
+    if (supported(Kernel::Avx2)) {
+        return Kernel::Avx2;
+    }
+    if (supported(Kernel::Sse2)) {
+        return Kernel::Sse2;
+    }
+    return Kernel::Scalar;
+}
+} // namespace tomboy
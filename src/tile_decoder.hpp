@@ -0,0 +1,58 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstddef>
+
+namespace tomboy {
+/// Decodes rows of 2 bits per pixel tile data into colour numbers
+///
+/// Each row is a byte of low bits followed by a byte of high bits, leftmost
+/// pixel in the top bit, and decodes to 8 bytes holding colours 0 to 3. Rows
+/// are decoded in batches so the vector kernels can handle several at once.
+class TileDecoder {
+  public:
+    enum class Kernel : u8 {
+        /// Portable bit by bit decoding
+        Scalar,
+        /// Two rows per 128-bit vector
+        Sse2,
+        /// Four rows per 256-bit vector
+        Avx2,
+        /// One row per pair of parallel bit deposits
+        Bmi2,
+    };
+
+    /// Decode rows from data, 2 bytes each, into pixels, 8 bytes each
+    using Function = auto (*)(const u8 *data, size_t rows, u8 *pixels) -> void;
+
+  public:
+    /// Use the fastest kernel the running CPU supports
+    TileDecoder();
+    /// Use kernel, falling back to Scalar if the CPU does not support it
+    explicit TileDecoder(Kernel kernel);
+
+    [[nodiscard]] auto kernel() const -> Kernel;
+    auto decode(const u8 *data, size_t rows, u8 *pixels) const -> void;
+
+    /// Whether the running CPU can execute kernel
+    [[nodiscard]] static auto supported(Kernel kernel) -> bool;
+    /// Fastest supported kernel
+    [[nodiscard]] static auto best() -> Kernel;
+
+  private:
+    Kernel kernel_;
+    Function function_;
+};
+
+inline auto TileDecoder::kernel() const -> Kernel
+{
+    return kernel_;
+}
+
+inline auto TileDecoder::decode(const u8 *data, size_t rows, u8 *pixels) const
+    -> void
+{
+    function_(data, rows, pixels);
+}
+} // namespace tomboy
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <atomic>
+
+namespace tomboy {
+/// Passes the latest value from one thread to another without locks
+///
+/// The producer fills the back buffer and publishes it by swapping it with
+/// the middle one, the consumer takes the middle one by swapping it with the
+/// front. Neither side ever waits, a value published before the consumer
+/// took the previous one replaces it, and neither side can see the buffer
+/// the other is using.
+template <class T>
+class TripleBuffer {
+  public:
+    TripleBuffer() = default;
+
+    TripleBuffer(const TripleBuffer &) = delete;
+    auto operator=(const TripleBuffer &) -> TripleBuffer & = delete;
+
+    /// Buffer the producer writes the next value into
+    [[nodiscard]] auto back() -> T &;
+    /// Hand the back buffer to the consumer
+    auto publish() -> void;
+
+    /// Take the newest published value, false if there is none since the
+    /// last one taken
+    auto update() -> bool;
+    /// Value the consumer took last
+    [[nodiscard]] auto front() const -> const T &;
+
+  private:
+    /// Bits of middle_ holding a buffer index
+    static constexpr u8 index_mask = 0x03;
+    /// Set in middle_ when it holds a value the consumer has not taken
+    static constexpr u8 fresh = 0x04;
+
+  private:
+    std::array<T, 3> buffers_{};
+    std::atomic<u8> middle_ = 2;
+    /// Owned by the producer
+    u8 back_ = 0;
+    /// Owned by the consumer
+    u8 front_ = 1;
+};
+
+template <class T>
+auto TripleBuffer<T>::back() -> T &
+{
+    return buffers_[back_];
+}
+
+template <class T>
+auto TripleBuffer<T>::publish() -> void
+{
+    back_ = middle_.exchange(back_ | fresh, std::memory_order_acq_rel) &
+            index_mask;
+}
+
+template <class T>
+auto TripleBuffer<T>::update() -> bool
+{
+    if ((middle_.load(std::memory_order_relaxed) & fresh) == 0) {
+        return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & index_mask;
+    return true;
+}
+
+template <class T>
+auto TripleBuffer<T>::front() const -> const T &
+{
+    return buffers_[front_];
+}
+} // namespace tomboy
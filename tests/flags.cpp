@@ -0,0 +1,342 @@
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "gameboy.hpp"
+#include "memory.hpp"
+#include "rom.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <print>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Runs instructions on every 8-bit operand pair and every flag state they
+// read, comparing A and F with a reference model written straight from the
+// hardware's documented behaviour. Built once with lazy and once with eager
+// flags, both must agree with the model.
+
+namespace {
+using tomboy::u16;
+using tomboy::u8;
+
+enum Flag : u8 {
+    Zero = 0x80,
+    Subtraction = 0x40,
+    HalfCarry = 0x20,
+    Carry = 0x10,
+};
+
+struct State {
+    u8 a;
+    u8 f;
+};
+
+/// Result of op on A = a and B = b with flags f
+using Reference = auto (*)(u8 a, u8 b, u8 f) -> State;
+
+struct Case {
+    std::string_view name;
+    /// Up to two bytes of code, padded with nop
+    std::array<u8, 2> code;
+    /// Whether B is an operand, otherwise it is left at 0
+    bool binary;
+    Reference reference;
+};
+
+auto zero(u8 value) -> u8
+{
+    return value == 0 ? Zero : 0;
+}
+
+auto carry(u8 f) -> u8
+{
+    return (f & Carry) != 0 ? 1 : 0;
+}
+
+auto add(u8 a, u8 b, u8 c) -> State
+{
+    const unsigned result = a + b + c;
+    const auto value = static_cast<u8>(result);
+    return {value,
+        static_cast<u8>(zero(value) |
+                        ((a & 0xF) + (b & 0xF) + c > 0xF ? HalfCarry : 0) |
+                        (result > 0xFF ? Carry : 0))};
+}
+
+auto sub(u8 a, u8 b, u8 c) -> State
+{
+    const auto value = static_cast<u8>(a - b - c);
+    return {value,
+        static_cast<u8>(zero(value) | Subtraction |
+                        ((a & 0xF) < (b & 0xF) + c ? HalfCarry : 0) |
+                        (a < b + c ? Carry : 0))};
+}
+
+auto daa(u8 a, u8 f) -> State
+{
+    bool c = (f & Carry) != 0;
+    if ((f & Subtraction) == 0) {
+        if (c || a > 0x99) {
+            a += 0x60;
+            c = true;
+        }
+        if ((f & HalfCarry) != 0 || (a & 0x0F) > 0x09) {
+            a += 0x06;
+        }
+    }
+    else {
+        if (c) {
+            a -= 0x60;
+        }
+        if ((f & HalfCarry) != 0) {
+            a -= 0x06;
+        }
+    }
+    return {a,
+        static_cast<u8>(zero(a) | (f & Subtraction) | (c ? Carry : 0))};
+}
+
+/// Rotate or shift result with the carry out, Z only for the prefixed forms
+auto shifted(u8 value, bool carry_out, bool prefixed) -> State
+{
+    const u8 z = prefixed ? zero(value) : 0;
+    return {value, static_cast<u8>(z | (carry_out ? Carry : 0))};
+}
+
+auto rlc(u8 a, bool prefixed) -> State
+{
+    return shifted(static_cast<u8>(a << 1 | a >> 7), (a & 0x80) != 0, prefixed);
+}
+
+auto rrc(u8 a, bool prefixed) -> State
+{
+    return shifted(static_cast<u8>(a >> 1 | a << 7), (a & 0x01) != 0, prefixed);
+}
+
+auto rl(u8 a, u8 f, bool prefixed) -> State
+{
+    return shifted(
+        static_cast<u8>(a << 1 | carry(f)), (a & 0x80) != 0, prefixed);
+}
+
+auto rr(u8 a, u8 f, bool prefixed) -> State
+{
+    return shifted(
+        static_cast<u8>(a >> 1 | carry(f) << 7), (a & 0x01) != 0, prefixed);
+}
+
+auto bit(u8 a, u8 f, int index) -> State
+{
+    return {a,
+        static_cast<u8>(((a >> index & 1) == 0 ? Zero : 0) | HalfCarry |
+                        (f & Carry))};
+}
+
+const std::array cases = {
+    Case{"add a, b", {0x80, 0x00}, true,
+        [](u8 a, u8 b, u8 /*f*/) { return add(a, b, 0); }},
+    Case{"adc a, b", {0x88, 0x00}, true,
+        [](u8 a, u8 b, u8 f) { return add(a, b, carry(f)); }},
+    Case{"sub a, b", {0x90, 0x00}, true,
+        [](u8 a, u8 b, u8 /*f*/) { return sub(a, b, 0); }},
+    Case{"sbc a, b", {0x98, 0x00}, true,
+        [](u8 a, u8 b, u8 f) { return sub(a, b, carry(f)); }},
+    Case{"and a, b", {0xA0, 0x00}, true,
+        [](u8 a, u8 b, u8 /*f*/) {
+            const u8 value = a & b;
+            return State{value, static_cast<u8>(zero(value) | HalfCarry)};
+        }},
+    Case{"xor a, b", {0xA8, 0x00}, true,
+        [](u8 a, u8 b, u8 /*f*/) {
+            const u8 value = a ^ b;
+            return State{value, zero(value)};
+        }},
+    Case{"or a, b", {0xB0, 0x00}, true,
+        [](u8 a, u8 b, u8 /*f*/) {
+            const u8 value = a | b;
+            return State{value, zero(value)};
+        }},
+    Case{"cp a, b", {0xB8, 0x00}, true,
+        [](u8 a, u8 b, u8 /*f*/) { return State{a, sub(a, b, 0).f}; }},
+    Case{"add a, b; daa", {0x80, 0x27}, true,
+        [](u8 a, u8 b, u8 /*f*/) {
+            const State sum = add(a, b, 0);
+            return daa(sum.a, sum.f);
+        }},
+    Case{"sub a, b; daa", {0x90, 0x27}, true,
+        [](u8 a, u8 b, u8 /*f*/) {
+            const State difference = sub(a, b, 0);
+            return daa(difference.a, difference.f);
+        }},
+    Case{"inc a", {0x3C, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) {
+            const auto value = static_cast<u8>(a + 1);
+            return State{value,
+                static_cast<u8>(zero(value) |
+                                ((a & 0xF) == 0xF ? HalfCarry : 0) |
+                                (f & Carry))};
+        }},
+    Case{"dec a", {0x3D, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) {
+            const auto value = static_cast<u8>(a - 1);
+            return State{value,
+                static_cast<u8>(zero(value) | Subtraction |
+                                ((a & 0xF) == 0 ? HalfCarry : 0) |
+                                (f & Carry))};
+        }},
+    Case{"daa", {0x27, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return daa(a, f); }},
+    Case{"cpl", {0x2F, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) {
+            return State{static_cast<u8>(~a),
+                static_cast<u8>((f & (Zero | Carry)) | Subtraction |
+                                HalfCarry)};
+        }},
+    Case{"scf", {0x37, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) {
+            return State{a, static_cast<u8>((f & Zero) | Carry)};
+        }},
+    Case{"ccf", {0x3F, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) {
+            return State{a, static_cast<u8>((f & (Zero | Carry)) ^ Carry)};
+        }},
+    Case{"rlca", {0x07, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) { return rlc(a, false); }},
+    Case{"rrca", {0x0F, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) { return rrc(a, false); }},
+    Case{"rla", {0x17, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return rl(a, f, false); }},
+    Case{"rra", {0x1F, 0x00}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return rr(a, f, false); }},
+    Case{"rlc a", {0xCB, 0x07}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) { return rlc(a, true); }},
+    Case{"rrc a", {0xCB, 0x0F}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) { return rrc(a, true); }},
+    Case{"rl a", {0xCB, 0x17}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return rl(a, f, true); }},
+    Case{"rr a", {0xCB, 0x1F}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return rr(a, f, true); }},
+    Case{"sla a", {0xCB, 0x27}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) {
+            return shifted(static_cast<u8>(a << 1), (a & 0x80) != 0, true);
+        }},
+    Case{"sra a", {0xCB, 0x2F}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) {
+            return shifted(
+                static_cast<u8>(a >> 1 | (a & 0x80)), (a & 0x01) != 0, true);
+        }},
+    Case{"swap a", {0xCB, 0x37}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) {
+            return shifted(static_cast<u8>(a << 4 | a >> 4), false, true);
+        }},
+    Case{"srl a", {0xCB, 0x3F}, false,
+        [](u8 a, u8 /*b*/, u8 /*f*/) {
+            return shifted(static_cast<u8>(a >> 1), (a & 0x01) != 0, true);
+        }},
+    Case{"bit 0, a", {0xCB, 0x47}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return bit(a, f, 0); }},
+    Case{"bit 3, a", {0xCB, 0x5F}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return bit(a, f, 3); }},
+    Case{"bit 4, a", {0xCB, 0x67}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return bit(a, f, 4); }},
+    Case{"bit 7, a", {0xCB, 0x7F}, false,
+        [](u8 a, u8 /*b*/, u8 f) { return bit(a, f, 7); }},
+};
+
+// The program runs from WRAM so each run can patch its operands. AF comes
+// from the stack and goes back to it, which sets and reads every flag.
+constexpr u16 program = 0xC000;
+constexpr u16 operand_b = 0xC006;
+constexpr u16 code = 0xC007;
+constexpr u16 done = 0xC00A;
+constexpr u16 stack = 0xC0F0;
+constexpr std::array<u8, 13> program_code = {
+    0xF3,             // di
+    0x31, 0xF0, 0xC0, // ld sp, 0xC0F0
+    0xF1,             // pop af
+    0x06, 0x00,       // ld b, n
+    0x00, 0x00,       // instructions under test
+    0xF5,             // push af
+    0xC3, 0x00, 0xC0, // jp 0xC000
+};
+
+/// Cartridge entry jumping straight to the program
+auto make_rom() -> std::shared_ptr<const tomboy::Rom>
+{
+    std::vector<u8> bytes(0x8000);
+    bytes[0x100] = 0xC3; // jp 0xC000
+    bytes[0x101] = program & 0xFF;
+    bytes[0x102] = program >> 8;
+    return tomboy::Rom::from_bytes(std::move(bytes));
+}
+
+/// Run the program once from a jump to it, returns AF as pushed
+auto run(tomboy::GameBoy &gameboy, u8 a, u8 b, u8 f) -> State
+{
+    tomboy::Memory &memory = gameboy.memory();
+    memory.write(stack, f);
+    memory.write(stack + 1, a);
+    memory.write(operand_b, b);
+    gameboy.cpu().step();
+    gameboy.cpu().run_until(
+        [](const tomboy::Cpu &cpu) { return cpu.pc() == done; });
+    return {memory.read(stack + 1), memory.read(stack)};
+}
+} // namespace
+
+auto main() -> int
+{
+    std::optional<tomboy::Cartridge> cartridge =
+        tomboy::Cartridge::from_rom(make_rom());
+    if (!cartridge) {
+        return 1;
+    }
+    tomboy::GameBoy gameboy(tomboy::Cpu::Core::Table);
+    gameboy.insert(std::move(*cartridge));
+    for (size_t i = 0; i < program_code.size(); i++) {
+        gameboy.memory().write(program + i, program_code[i]);
+    }
+
+    tomboy::u64 checked = 0;
+    tomboy::u64 failures = 0;
+    for (const Case &test : cases) {
+        const tomboy::u64 failures_before = failures;
+        gameboy.memory().write(code, test.code[0]);
+        gameboy.memory().write(code + 1, test.code[1]);
+        const unsigned b_count = test.binary ? 0x100 : 1;
+        for (unsigned f = 0; f < 0x100; f += 0x10) {
+            for (unsigned a = 0; a < 0x100; a++) {
+                for (unsigned b = 0; b < b_count; b++) {
+                    const auto expected = test.reference(
+                        static_cast<u8>(a), static_cast<u8>(b),
+                        static_cast<u8>(f));
+                    const State actual = run(gameboy, static_cast<u8>(a),
+                        static_cast<u8>(b), static_cast<u8>(f));
+                    checked++;
+                    if (actual.a == expected.a && actual.f == expected.f) {
+                        continue;
+                    }
+                    if (failures++ < 20) {
+                        std::println(std::cerr,
+                            "{}: a=0x{:02x} b=0x{:02x} f=0x{:02x} expected "
+                            "a=0x{:02x} f=0x{:02x}, got a=0x{:02x} f=0x{:02x}",
+                            test.name, a, b, f, expected.a, expected.f,
+                            actual.a, actual.f);
+                    }
+                }
+            }
+        }
+        if (failures != failures_before) {
+            std::println(std::cerr, "{}: {} cases failed", test.name,
+                failures - failures_before);
+        }
+    }
+
+    std::println("{} of {} cases failed", failures, checked);
+    return failures == 0 ? 0 : 1;
+}
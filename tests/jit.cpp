@@ -0,0 +1,223 @@
+#include "cartridge.hpp"
+#include "cpu.hpp"
+#include "gameboy.hpp"
+#include "jit.hpp"
+#include "memory.hpp"
+#include "rom.hpp"
+#include "types.hpp"
+
+#include <cstddef>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <print>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Runs the same programs on the table core and the JIT core, with and
+// without differential mode, comparing the PC, counters and work RAM after
+// every frame. The programs mix natively translated instructions with ones
+// the JIT hands to their interpreter handler within the same block.
+
+namespace {
+using tomboy::u16;
+using tomboy::u32;
+using tomboy::u64;
+using tomboy::u8;
+
+constexpr u16 entry = 0x150;
+constexpr int frames = 40;
+
+struct Program {
+    std::string_view name;
+    std::vector<u8> code;
+};
+
+struct Snapshot {
+    u16 pc;
+    u64 cycles;
+    u64 instructions;
+    std::vector<u8> ram;
+
+    auto operator==(const Snapshot &) const -> bool = default;
+};
+
+/// Cartridge with code at the entry point, every other byte is 0
+auto make_rom(const std::vector<u8> &code) -> std::shared_ptr<const tomboy::Rom>
+{
+    std::vector<u8> bytes(0x8000);
+    bytes[0x100] = 0xC3; // jp entry
+    bytes[0x101] = entry & 0xFF;
+    bytes[0x102] = entry >> 8;
+    for (size_t i = 0; i < code.size(); i++) {
+        bytes[entry + i] = code[i];
+    }
+    return tomboy::Rom::from_bytes(std::move(bytes));
+}
+
+/// Linear congruential generator, the programs must not differ between runs
+class Random {
+  public:
+    explicit Random(u32 seed)
+      : state_(seed)
+    {}
+
+    auto next(u32 bound) -> u8
+    {
+        state_ = state_ * 1664525 + 1013904223;
+        return static_cast<u8>((state_ >> 16) % bound);
+    }
+
+  private:
+    u32 state_;
+};
+
+/// Straight-line code over every translated instruction group and some that
+/// are not, then registers pushed to work RAM and a jump back to the start
+auto random_program(u32 seed) -> std::vector<u8>
+{
+    Random random(seed);
+    std::vector<u8> code = {0x31, 0xF0, 0xDF}; // ld sp, 0xDFF0
+    const auto loop = static_cast<u16>(entry + code.size());
+    const auto emit = [&code](std::initializer_list<u8> bytes) {
+        code.insert(code.end(), bytes);
+    };
+    while (code.size() < 0x1000) {
+        // Any register but (hl), A as often as the rest
+        const u8 r = random.next(8) == 0 ? 7 : random.next(6);
+        const u8 operand = random.next(0x100);
+        const auto next = static_cast<u16>(entry + code.size() + 3);
+        switch (random.next(14)) {
+        case 0: emit({static_cast<u8>(0x40 | r << 3 | random.next(8))}); break;
+        case 1: emit({static_cast<u8>(0x80 | random.next(0x40))}); break;
+        case 2: emit({static_cast<u8>(0xC6 | random.next(8) << 3), operand});
+            break;
+        case 3: emit({static_cast<u8>(0x06 | r << 3), operand}); break;
+        case 4: emit({static_cast<u8>(0x04 | r << 3 | random.next(2))}); break;
+        case 5: emit({static_cast<u8>(0x03 | random.next(3) << 4 |
+                                      random.next(2) << 3)});
+            break;
+        case 6: emit({static_cast<u8>(0x07 | random.next(4) << 3)}); break;
+        case 7: emit({static_cast<u8>(0x2F | random.next(3) << 3)}); break;
+        case 8: emit({static_cast<u8>(0x20 | random.next(4) << 3), 0x00});
+            break;
+        case 9: emit({static_cast<u8>(0xC2 | random.next(4) << 3),
+                    static_cast<u8>(next & 0xFF), static_cast<u8>(next >> 8)});
+            break;
+        case 10: // ld hl, work RAM; ld (hl), r
+            emit({0x21, operand, static_cast<u8>(0xC0 + random.next(0x1E)),
+                static_cast<u8>(0x70 | r)});
+            break;
+        case 11: emit({0xCB, static_cast<u8>((operand & 0xF8) | r)}); break;
+        case 12: emit({0x27}); break; // daa
+        case 13: // ldh a, (div) or (ly)
+            emit({0xF0, static_cast<u8>(random.next(2) == 0 ? 0x04 : 0x44)});
+            break;
+        }
+    }
+    // ld (0xDF00), sp; ld sp, 0xDF10; push af, bc, de, hl; ld sp, 0xDFF0
+    emit({0x08, 0x00, 0xDF, 0x31, 0x10, 0xDF, 0xF5, 0xC5, 0xD5, 0xE5});
+    emit({0x31, 0xF0, 0xDF});
+    emit({0xC3, static_cast<u8>(loop & 0xFF), static_cast<u8>(loop >> 8)});
+    return code;
+}
+
+auto run(const Program &program, tomboy::Cpu::Core core, bool differential,
+    u64 &mismatches) -> std::vector<Snapshot>
+{
+    std::optional<tomboy::Cartridge> cartridge =
+        tomboy::Cartridge::from_rom(make_rom(program.code));
+    tomboy::GameBoy gameboy(core);
+    gameboy.insert(std::move(*cartridge));
+    gameboy.cpu().jit().set_differential(differential);
+
+    std::vector<Snapshot> snapshots;
+    for (int frame = 0; frame < frames; frame++) {
+        gameboy.run_frame();
+        Snapshot &snapshot = snapshots.emplace_back(gameboy.cpu().pc(),
+            gameboy.cpu().cycles(), gameboy.cpu().instructions());
+        for (unsigned address = 0xC000; address < 0xE000; address++) {
+            snapshot.ram.push_back(
+                gameboy.memory().read(static_cast<u16>(address)));
+        }
+    }
+    mismatches = gameboy.cpu().jit().mismatches();
+    return snapshots;
+}
+
+/// Frame at which actual first differs from expected, frames if it never does
+auto first_difference(
+    const std::vector<Snapshot> &expected, const std::vector<Snapshot> &actual)
+    -> size_t
+{
+    size_t frame = 0;
+    while (frame < expected.size() && expected[frame] == actual[frame]) {
+        frame++;
+    }
+    return frame;
+}
+} // namespace
+
+auto main() -> int
+{
+    std::vector<Program> programs = {
+        {"store after translated code",
+            {
+                0x06, 0x41,       // ld b, 0x41
+                0x78,             // ld a, b
+                0x3C,             // inc a
+                0xE0, 0x81,       // ldh (0x81), a
+                0xFA, 0x00, 0xC0, // ld a, (0xC000)
+                0x3C,             // inc a
+                0xEA, 0x00, 0xC0, // ld (0xC000), a
+                0x18, 0xF1,       // jr entry
+            }},
+        {"ei after translated code",
+            {
+                0x00,       // nop
+                0xFB,       // ei
+                0x18, 0xFC, // jr entry
+            }},
+    };
+    for (u32 seed = 1; seed <= 8; seed++) {
+        programs.push_back({"random", random_program(seed)});
+    }
+
+    int failures = 0;
+    for (const Program &program : programs) {
+        u64 mismatches = 0;
+        const std::vector<Snapshot> expected =
+            run(program, tomboy::Cpu::Core::Table, false, mismatches);
+        for (const bool differential : {false, true}) {
+            const std::vector<Snapshot> actual =
+                run(program, tomboy::Cpu::Core::Jit, differential, mismatches);
+            const size_t frame = first_difference(expected, actual);
+            if (frame == expected.size() && mismatches == 0) {
+                continue;
+            }
+            failures++;
+            const std::string_view mode =
+                differential ? "differential" : "native";
+            if (frame == expected.size()) {
+                std::println(std::cerr, "{}, {}: {} mismatches reported",
+                    program.name, mode, mismatches);
+                continue;
+            }
+            std::println(std::cerr,
+                "{}, {}: frame {} expected pc=0x{:04x} cycles={} "
+                "instructions={}, got pc=0x{:04x} cycles={} instructions={}{}",
+                program.name, mode, frame, expected[frame].pc,
+                expected[frame].cycles, expected[frame].instructions,
+                actual[frame].pc, actual[frame].cycles,
+                actual[frame].instructions,
+                expected[frame].ram == actual[frame].ram
+                    ? ""
+                    : ", work RAM differs");
+        }
+    }
+
+    std::println("{} of {} runs failed", failures, programs.size() * 2);
+    return failures == 0 ? 0 : 1;
+}